@@ -1,9 +1,20 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 #define BUFFER_SZ 50
+#define STREAM_BUFF_SZ 65536    // chunk size used when streaming a file or stdin
+#define PAR_CHUNK_SZ (1 << 20)  // bytes of a big file one thread takes at a time
+#define PAR_WINDOW 4            // chunks of -w output per thread waiting to be written
 
 //prototypes
 void usage(char *);
@@ -16,6 +27,250 @@ int count_words(char *, int, int);
 int reverse_string(char *, int);
 int print_words(char *, int);
 
+// state carried from one chunk to the next when streaming input
+typedef struct stream_state {
+    long long words;        // words seen so far
+    long long word_len;     // characters of the current word so far
+    int inside_word;        // last character seen was part of a word
+} stream_state_t;
+
+// The words -w prints are put together here instead of with printf(), formatting is
+// most of the work.  With a sink the buffer is written out whenever it fills up,
+// without one it grows until whoever owns it writes it out.
+typedef struct out_buff {
+    char *data;
+    size_t len;
+    size_t cap;
+    FILE *sink;
+} out_buff_t;
+
+int out_write(out_buff_t *, const char *, size_t);
+int out_number(out_buff_t *, long long);
+int out_flush(out_buff_t *);
+
+int is_stream_space(char);
+int stream_count_words(char *, int, stream_state_t *);
+int stream_print_words(char *, int, stream_state_t *, out_buff_t *);
+int stream_reverse(FILE *, char *, int);
+int stream_input(char, char *, char *, char *);
+
+// Big files are counted (-c) and listed (-w) by STRINGFUN_THREADS threads, one per cpu
+// by default.  The file is cut into PAR_CHUNK_SZ chunks that are moved up to the next
+// whitespace so no word is split.  The first pass counts the words of every chunk, for
+// -w the second pass formats each chunk numbering from the words before it, and the
+// main thread writes the chunks out in order.
+typedef struct par_job {
+    int fd;
+    off_t size;
+    long nchunks;
+    long long *words;       // words in each chunk, then words before each chunk
+    int listing;            // second pass, format the words instead of counting them
+    long next;              // next chunk a thread takes
+    long written;           // chunks written to stdout by the main thread
+    long window;            // threads stay less than this many chunks ahead of it
+    out_buff_t *out;        // formatted chunk k is in out[k % window]...
+    int *ready;             // ...once ready[k % window] is set
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} par_job_t;
+
+int  par_threads(void);
+off_t par_chunk_edge(int, off_t, off_t);
+int  par_chunk(par_job_t *, long, char *);
+void *par_worker(void *);
+int  par_pass(par_job_t *, int);
+long long par_words(int, off_t, char, int);
+
+// Two-way string search (Crochemore-Perrin), linear in the text even for patterns like
+// "aaab" that make simpler searches go quadratic.  The pattern is split at a critical
+// position, the right part is matched left to right and then the left part right to left.
+typedef struct search_ctx {
+    const char *pat;
+    long len;
+    long crit;      // the right part of the pattern starts here
+    long period;    // how far to shift after matching the right part
+    int periodic;   // the left part repeats period bytes later, remember what matched
+} search_ctx_t;
+
+void search_init(search_ctx_t *, const char *, long);
+long search_next(const search_ctx_t *, const char *, long);
+int  user_str_length(char *, int);
+int  replace_buff(char *, int, int, char *, char *);
+int  stream_replace(FILE *, char *, char *, char *);
+
+// Whitespace sets for the kernels below, always 4 characters so the vector code can do the
+// same 4 compares for each of them
+#define WS_SPACE  "    "        // count_words(), the buffer only has spaces left
+#define WS_BLANK  " \t \t"      // what setup_buff() collapses
+#define WS_STREAM " \t\n\r"     // streamed input, see is_stream_space()
+
+// Kernels that look at 16 (SSE2) or 32 (AVX2) bytes at a time, picked by init_kernels()
+// for the cpu running the program.  STRINGFUN_SIMD=scalar|sse2|avx2 forces one of them,
+// any other value is refused.
+typedef long long (*count_starts_fn)(const char *, long, const char *, int *);
+typedef long (*word_span_fn)(const char *, long, const char *);
+
+int  init_kernels(void);
+long long count_starts_scalar(const char *, long, const char *, int *);
+long word_span_scalar(const char *, long, const char *);
+
+// counts words that start in buf, *inside_word says if a word was already going on and
+// is updated to say if one still is at the end of buf
+count_starts_fn count_word_starts = count_starts_scalar;
+// returns how many bytes at the start of buf are not whitespace
+word_span_fn word_span = word_span_scalar;
+
+
+long long count_starts_scalar(const char *buf, long len, const char *ws, int *inside_word) {
+    long long count = 0;
+    int inside = *inside_word;
+
+    for (long i = 0; i < len; i++) {
+        char c = *(buf + i);
+        int word = c != ws[0] && c != ws[1] && c != ws[2] && c != ws[3];
+        count += word && !inside;
+        inside = word;
+    }
+
+    *inside_word = inside;
+    return count;
+}
+
+long word_span_scalar(const char *buf, long len, const char *ws) {
+    long i = 0;
+
+    while (i < len && *(buf + i) != ws[0] && *(buf + i) != ws[1] &&
+           *(buf + i) != ws[2] && *(buf + i) != ws[3]) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef HAVE_X86_SIMD
+// Each block becomes a bitmask with bit i set if byte i is part of a word.  A word starts
+// at every set bit whose lower neighbour is clear, the carry in is the last bit of the
+// block before, so the count for a block is one popcount.
+
+__attribute__((target("sse2,popcnt")))
+static unsigned word_mask_sse2(const char *p, __m128i w0, __m128i w1, __m128i w2, __m128i w3) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i sp = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, w0), _mm_cmpeq_epi8(v, w1)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, w2), _mm_cmpeq_epi8(v, w3)));
+    return ~(unsigned)_mm_movemask_epi8(sp) & 0xffff;
+}
+
+__attribute__((target("sse2,popcnt")))
+long long count_starts_sse2(const char *buf, long len, const char *ws, int *inside_word) {
+    __m128i w0 = _mm_set1_epi8(ws[0]), w1 = _mm_set1_epi8(ws[1]);
+    __m128i w2 = _mm_set1_epi8(ws[2]), w3 = _mm_set1_epi8(ws[3]);
+    unsigned carry = *inside_word;
+    long long count = 0;
+    long i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        unsigned word = word_mask_sse2(buf + i, w0, w1, w2, w3);
+        count += __builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 15;
+    }
+
+    *inside_word = carry;
+    return count + count_starts_scalar(buf + i, len - i, ws, inside_word);
+}
+
+__attribute__((target("sse2,popcnt")))
+long word_span_sse2(const char *buf, long len, const char *ws) {
+    __m128i w0 = _mm_set1_epi8(ws[0]), w1 = _mm_set1_epi8(ws[1]);
+    __m128i w2 = _mm_set1_epi8(ws[2]), w3 = _mm_set1_epi8(ws[3]);
+    long i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        unsigned space = ~word_mask_sse2(buf + i, w0, w1, w2, w3) & 0xffff;
+        if (space) {
+            return i + __builtin_ctz(space);
+        }
+    }
+    return i + word_span_scalar(buf + i, len - i, ws);
+}
+
+__attribute__((target("avx2,popcnt")))
+static unsigned word_mask_avx2(const char *p, __m256i w0, __m256i w1, __m256i w2, __m256i w3) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i sp = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, w0), _mm256_cmpeq_epi8(v, w1)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, w2), _mm256_cmpeq_epi8(v, w3)));
+    return ~(unsigned)_mm256_movemask_epi8(sp);
+}
+
+__attribute__((target("avx2,popcnt")))
+long long count_starts_avx2(const char *buf, long len, const char *ws, int *inside_word) {
+    __m256i w0 = _mm256_set1_epi8(ws[0]), w1 = _mm256_set1_epi8(ws[1]);
+    __m256i w2 = _mm256_set1_epi8(ws[2]), w3 = _mm256_set1_epi8(ws[3]);
+    unsigned carry = *inside_word;
+    long long count = 0;
+    long i = 0;
+
+    // two blocks per pass so the loads of the second overlap the popcount of the first
+    for (; i + 64 <= len; i += 64) {
+        unsigned lo = word_mask_avx2(buf + i, w0, w1, w2, w3);
+        unsigned hi = word_mask_avx2(buf + i + 32, w0, w1, w2, w3);
+        count += __builtin_popcount(lo & ~((lo << 1) | carry));
+        count += __builtin_popcount(hi & ~((hi << 1) | (lo >> 31)));
+        carry = hi >> 31;
+    }
+    for (; i + 32 <= len; i += 32) {
+        unsigned word = word_mask_avx2(buf + i, w0, w1, w2, w3);
+        count += __builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 31;
+    }
+
+    *inside_word = carry;
+    return count + count_starts_scalar(buf + i, len - i, ws, inside_word);
+}
+
+__attribute__((target("avx2,popcnt")))
+long word_span_avx2(const char *buf, long len, const char *ws) {
+    __m256i w0 = _mm256_set1_epi8(ws[0]), w1 = _mm256_set1_epi8(ws[1]);
+    __m256i w2 = _mm256_set1_epi8(ws[2]), w3 = _mm256_set1_epi8(ws[3]);
+    long i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        unsigned space = ~word_mask_avx2(buf + i, w0, w1, w2, w3);
+        if (space) {
+            return i + __builtin_ctz(space);
+        }
+    }
+    return i + word_span_scalar(buf + i, len - i, ws);
+}
+#endif
+
+// returns 0, or -1 when STRINGFUN_SIMD names no kernel
+int init_kernels(void) {
+    char *force = getenv("STRINGFUN_SIMD");
+
+    if (force != NULL && strcmp(force, "scalar") != 0 && strcmp(force, "sse2") != 0 &&
+        strcmp(force, "avx2") != 0) {
+        return -1;
+    }
+    if (force != NULL && strcmp(force, "scalar") == 0) {
+        return 0;
+    }
+#ifdef HAVE_X86_SIMD
+    // every vector kernel counts mask bits with popcnt, so neither runs without it
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("popcnt")) {
+        return 0;
+    }
+    if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "avx2") == 0)) {
+        count_word_starts = count_starts_avx2;
+        word_span = word_span_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        count_word_starts = count_starts_sse2;
+        word_span = word_span_sse2;
+    }
+#endif
+    return 0;
+}
+
 
 int setup_buff(char *buff, char *user_str, int len){
     //TODO: #4:  Implement the setup buff as per the directions
@@ -29,31 +284,36 @@ int setup_buff(char *buff, char *user_str, int len){
     char *user_pointer = user_str;
     
     int count = 0; // counts number of characters copied
-    int consec_whitespace = 0; // Handles cases where multiple whitespace characters are in user string
 
     while (*user_pointer == ' ' || *user_pointer == '\t') {
         user_pointer++; // skips leading whitespace
     }
 
-    while (*user_pointer != '\0') { // loops until end of user string
-        if (*user_pointer == ' '  || *user_pointer == '\t') { // checks for whitespace (space or tab)
-            if (consec_whitespace == 0 && count < len) {
+    // Copies a whole word at a time, word_span() finds where it ends.  After each word a
+    // run of whitespace becomes one space (dropped if the buffer is already full).
+    long remaining = strlen(user_pointer);
+    while (remaining > 0) {
+        long run = word_span(user_pointer, remaining, WS_BLANK);
+        if (run > len - count) {
+            return -1; // User supplied string is too large
+        }
+        memcpy(buff_pointer, user_pointer, run);
+        buff_pointer += run;
+        count += run;
+        user_pointer += run;
+        remaining -= run;
+
+        if (remaining > 0) {
+            if (count < len) {
                 *buff_pointer = ' '; // Adds space to buffer
                 buff_pointer++;
                 count++;
-                consec_whitespace = 1;
             }
-        } else {
-            if (count < len) {
-                *buff_pointer = *user_pointer;
-                buff_pointer++;
-                count++;
-                consec_whitespace = 0;
-            } else {
-                return -1; // User supplied string is too large
+            while (remaining > 0 && (*user_pointer == ' ' || *user_pointer == '\t')) {
+                user_pointer++;
+                remaining--;
             }
         }
-        user_pointer++; 
     }
     
     // Created this statement when debugging due to an issue of the buffer having an extra space at the end
@@ -84,26 +344,20 @@ void print_buff(char *buff, int len){
 
 void usage(char *exename){
     printf("usage: %s [-h|c|r|w|x] \"string\" [other args]\n", exename);
+    printf("       %s [-c|r|w] -f file     (file of - reads stdin)\n", exename);
+    printf("       %s -x -f file search replace\n", exename);
 
 }
 
 int count_words(char *buff, int len, int str_len){
-    int count = 0;
     int inside_word = 0;
 
-    // iterates until we have hit string length
-    for (int i = 0; i < str_len; i++) {
-        if (*(buff + i) == ' ') { // count is only increased for non-whitespace (word)
-            inside_word = 0;
-        } else {
-            if (!inside_word) {
-                count++;
-                inside_word = 1;
-            }
-        }
+    if (str_len > len) {
+        return -1;
     }
 
-    return count; // returns number of words in user string
+    // count is only increased at the start of a word (non-whitespace after whitespace)
+    return (int)count_word_starts(buff, str_len, WS_SPACE, &inside_word); // returns number of words in user string
 }
 
 int reverse_string(char *buff, int str_len) {
@@ -154,6 +408,633 @@ int print_words(char *buff, int str_len) {
 
 //ADD OTHER HELPER FUNCTIONS HERE FOR OTHER REQUIRED PROGRAM OPTIONS
 
+// finds the maximal suffix of pat for one of the two byte orders and its period
+long max_suffix(const unsigned char *pat, long len, int reverse, long *period) {
+    long ms = -1, j = 0, k = 1, p = 1;
+
+    while (j + k < len) {
+        unsigned char a = pat[j + k];
+        unsigned char b = pat[ms + k];
+        if (reverse ? b < a : a < b) {
+            j += k;
+            k = 1;
+            p = j - ms;
+        } else if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            ms = j++;
+            k = p = 1;
+        }
+    }
+
+    *period = p;
+    return ms;
+}
+
+void search_init(search_ctx_t *ctx, const char *pat, long len) {
+    long p1, p2;
+    long ms1 = max_suffix((const unsigned char *)pat, len, 0, &p1);
+    long ms2 = max_suffix((const unsigned char *)pat, len, 1, &p2);
+
+    // the later of the two maximal suffixes gives a critical factorization
+    ctx->pat = pat;
+    ctx->len = len;
+    ctx->crit = (ms1 > ms2 ? ms1 : ms2) + 1;
+    ctx->period = ms1 > ms2 ? p1 : p2;
+    ctx->periodic = ctx->crit + ctx->period <= len &&
+                    memcmp(pat, pat + ctx->period, ctx->crit) == 0;
+    if (!ctx->periodic) {
+        // no overlap worth remembering, any shift up to this is safe
+        long right = len - ctx->crit;
+        ctx->period = (ctx->crit > right ? ctx->crit : right) + 1;
+    }
+}
+
+// Returns the offset of the first match in text, or -1.  Whenever nothing is remembered
+// from the last attempt memchr() (vectorized in libc) skips ahead to the next place the
+// first byte of the right part could line up, most of the text is never compared at all.
+long search_next(const search_ctx_t *ctx, const char *text, long text_len) {
+    const char *pat = ctx->pat;
+    long len = ctx->len, crit = ctx->crit;
+    long memory = 0; // bytes of the left part known to match from the last shift
+    long j = 0;      // where the pattern starts in text
+
+    if (len == 0 || len > text_len) {
+        return len == 0 ? 0 : -1;
+    }
+
+    while (j <= text_len - len) {
+        if (memory == 0 && text[j + crit] != pat[crit]) {
+            const char *next = memchr(text + j + crit, pat[crit], text_len - len - j + 1);
+            if (next == NULL) {
+                return -1;
+            }
+            j = next - text - crit;
+        }
+
+        long i = crit > memory ? crit : memory;
+        while (i < len && pat[i] == text[j + i]) {
+            i++;
+        }
+        if (i < len) {
+            j += i - crit + 1; // mismatch in the right part
+            memory = 0;
+            continue;
+        }
+
+        i = crit - 1;
+        while (i >= memory && pat[i] == text[j + i]) {
+            i--;
+        }
+        if (i < memory) {
+            return j;
+        }
+        j += ctx->period;
+        memory = ctx->periodic ? len - ctx->period : 0;
+    }
+
+    return -1;
+}
+
+// setup_buff() pads with dots and returns the whole buffer length, this is how much of
+// the buffer the user's string fills once its whitespace is collapsed
+int user_str_length(char *user_str, int len) {
+    int inside_word = 0;
+    long str_len = strlen(user_str);
+    long words = count_word_starts(user_str, str_len, WS_BLANK, &inside_word);
+    long chars = words > 0 ? words - 1 : 0; // one space between each word
+
+    for (long i = 0; i < str_len; i++) {
+        chars += *(user_str + i) != ' ' && *(user_str + i) != '\t';
+    }
+    return chars < len ? (int)chars : len;
+}
+
+// Replaces every match of search in the first str_len bytes of buff.  The result is cut
+// off at len bytes and the rest is filled with '.' again.  When the replacement is not
+// longer than the search string the buffer is rewritten in place, otherwise the result
+// is built in a second buffer.  Returns the new string length, -1 if search was not
+// found or -2 if memory runs out.
+int replace_buff(char *buff, int len, int str_len, char *search, char *replace) {
+    search_ctx_t ctx;
+    long slen = strlen(search), rlen = strlen(replace);
+    char *out = buff;
+    int out_len = 0, done = 0, found = 0;
+    long at;
+
+    search_init(&ctx, search, slen);
+    if (rlen > slen && (out = (char *)malloc(len)) == NULL) {
+        return -2;
+    }
+
+    while ((at = search_next(&ctx, buff + done, str_len - done)) >= 0) {
+        int keep = (int)(at < len - out_len ? at : len - out_len);
+        memmove(out + out_len, buff + done, keep); // never ahead of what is left to read
+        out_len += keep;
+        keep = (int)(rlen < len - out_len ? rlen : len - out_len);
+        memcpy(out + out_len, replace, keep);
+        out_len += keep;
+        done += at + slen;
+        found++;
+    }
+
+    int rest = str_len - done < len - out_len ? str_len - done : len - out_len;
+    memmove(out + out_len, buff + done, rest);
+    out_len += rest;
+    memset(out + out_len, '.', len - out_len);
+
+    if (out != buff) {
+        memcpy(buff, out, len);
+        free(out);
+    }
+    return found ? out_len : -1;
+}
+
+// Copies in to stdout with every match of search replaced.  buff must hold
+// STREAM_BUFF_SZ + strlen(search) bytes, the end of a chunk that could be the start of a
+// match is carried over to the next chunk.  Returns the number of matches or -1 if
+// reading fails.
+int stream_replace(FILE *in, char *buff, char *search, char *replace) {
+    search_ctx_t ctx;
+    long slen = strlen(search), rlen = strlen(replace);
+    long carry = 0, found = 0;
+    size_t n;
+
+    search_init(&ctx, search, slen);
+    while ((n = fread(buff + carry, 1, STREAM_BUFF_SZ, in)) > 0 || carry > 0) {
+        long total = carry + (long)n, done = 0, at;
+
+        while ((at = search_next(&ctx, buff + done, total - done)) >= 0) {
+            fwrite(buff + done, 1, at, stdout);
+            fwrite(replace, 1, rlen, stdout);
+            done += at + slen;
+            found++;
+        }
+
+        // keep the last slen - 1 bytes unless the input has ended
+        carry = n > 0 ? slen - 1 : 0;
+        if (carry > total - done) {
+            carry = total - done;
+        }
+        fwrite(buff + done, 1, total - done - carry, stdout);
+        memmove(buff, buff + total - carry, carry);
+        if (n == 0) {
+            break;
+        }
+    }
+
+    if (ferror(in)) {
+        return -1;
+    }
+    return found > 0x7fffffff ? 0x7fffffff : (int)found;
+}
+
+// Streaming mode reads the input STREAM_BUFF_SZ bytes at a time so memory use does not
+// depend on the input size.  Newlines count as whitespace too since files have them.
+int is_stream_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// counts the words in one chunk, a word that runs into the next chunk is only counted once
+int stream_count_words(char *chunk, int len, stream_state_t *st) {
+    st->words += count_word_starts(chunk, len, WS_STREAM, &st->inside_word);
+    return 0;
+}
+
+int out_write(out_buff_t *out, const char *p, size_t n) {
+    if (out->cap - out->len < n) {
+        if (out->sink != NULL) {
+            if (out_flush(out) != 0) {
+                return -1;
+            }
+            if (n >= out->cap) {
+                return fwrite(p, 1, n, out->sink) == n ? 0 : -1;
+            }
+        } else {
+            size_t cap = out->cap ? out->cap : STREAM_BUFF_SZ;
+            while (cap - out->len < n) {
+                cap *= 2;
+            }
+            char *data = (char *)realloc(out->data, cap);
+            if (data == NULL) {
+                return -1;
+            }
+            out->data = data;
+            out->cap = cap;
+        }
+    }
+
+    memcpy(out->data + out->len, p, n);
+    out->len += n;
+    return 0;
+}
+
+int out_number(out_buff_t *out, long long n) {
+    char digits[24];
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    return out_write(out, digits + i, sizeof(digits) - i);
+}
+
+int out_flush(out_buff_t *out) {
+    size_t n = out->len;
+
+    out->len = 0;
+    return fwrite(out->data, 1, n, out->sink) == n ? 0 : -1;
+}
+
+// prints the words in one chunk to out in the same format as print_words(), the part of
+// a word at the end of a chunk is printed right away and its length once the word ends
+int stream_print_words(char *chunk, int len, stream_state_t *st, out_buff_t *out) {
+    long i = 0;
+    int rc = 0;
+
+    while (rc == 0 && i < len) {
+        if (!st->inside_word) {
+            while (i < len && is_stream_space(*(chunk + i))) {
+                i++;
+            }
+            if (i == len) {
+                break;
+            }
+            rc |= out_number(out, ++st->words);
+            rc |= out_write(out, ". ", 2);
+            st->word_len = 0;
+            st->inside_word = 1;
+        }
+
+        long run = word_span(chunk + i, len - i, WS_STREAM);
+        rc |= out_write(out, chunk + i, run);
+        st->word_len += run;
+        i += run;
+        if (i < len) { // the word ended in this chunk
+            rc |= out_write(out, " (", 2);
+            rc |= out_number(out, st->word_len);
+            rc |= out_write(out, ")\n", 2);
+            st->inside_word = 0;
+            i++;
+        }
+    }
+
+    return rc;
+}
+
+// Reverses a whole file by reading its chunks from the end backwards, collapsing runs of
+// whitespace and trimming both ends the same way setup_buff() does.  The file must be
+// seekable.  out is a second buffer of len bytes used to batch the output.
+int stream_reverse(FILE *in, char *buff, int len) {
+    char *out = buff + len;
+    int pending_space = 0; // whitespace seen after the last character printed
+    int started = 0;       // printed a character yet
+    int out_len = 0;
+    off_t pos;
+
+    if (fseeko(in, 0, SEEK_END) != 0 || (pos = ftello(in)) < 0) {
+        return -1;
+    }
+
+    printf("Reversed String: ");
+    while (pos > 0) {
+        int n = pos < len ? (int)pos : len;
+        pos -= n;
+        if (fseeko(in, pos, SEEK_SET) != 0 || fread(buff, 1, n, in) != (size_t)n) {
+            return -1;
+        }
+
+        for (int i = n - 1; i >= 0; i--) {
+            if (is_stream_space(*(buff + i))) {
+                pending_space = started;
+                continue;
+            }
+            if (out_len > len - 2) { // room for a space and the character
+                fwrite(out, 1, out_len, stdout);
+                out_len = 0;
+            }
+            if (pending_space) {
+                *(out + out_len++) = ' ';
+                pending_space = 0;
+            }
+            *(out + out_len++) = *(buff + i);
+            started = 1;
+        }
+    }
+
+    fwrite(out, 1, out_len, stdout);
+    printf("\n");
+    return 0;
+}
+
+// STRINGFUN_THREADS if set, otherwise the number of cpus
+int par_threads(void) {
+    char *env = getenv("STRINGFUN_THREADS");
+    long n = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n < 1 ? 1 : n > 256 ? 256 : (int)n;
+}
+
+// Moves a chunk edge forward to the next whitespace so words are never split.  Both
+// chunks next to an edge work it out the same way.
+off_t par_chunk_edge(int fd, off_t off, off_t size) {
+    char buf[256];
+    ssize_t n;
+
+    if (off <= 0 || off >= size) {
+        return off <= 0 ? 0 : size;
+    }
+    while ((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (is_stream_space(buf[i])) {
+                return off + i;
+            }
+        }
+        off += n;
+    }
+    return size;
+}
+
+// Counts the words of chunk k or, in the second pass, formats them into the chunk's
+// output slot.  The writer is done with the slot since threads wait for it to fall
+// less than a window behind.  buf is the thread's own STREAM_BUFF_SZ buffer.
+int par_chunk(par_job_t *job, long k, char *buf) {
+    off_t start = par_chunk_edge(job->fd, (off_t)k * PAR_CHUNK_SZ, job->size);
+    off_t end = par_chunk_edge(job->fd, (off_t)(k + 1) * PAR_CHUNK_SZ, job->size);
+    out_buff_t *out = job->listing ? &job->out[k % job->window] : NULL;
+    stream_state_t st = {0};
+    int rc = 0;
+
+    if (out != NULL) {
+        st.words = job->words[k];
+    }
+
+    while (rc == 0 && start < end) {
+        ssize_t n = pread(job->fd, buf, end - start < STREAM_BUFF_SZ ? end - start : STREAM_BUFF_SZ, start);
+        if (n <= 0) {
+            return -1;
+        }
+        if (out != NULL) {
+            rc = stream_print_words(buf, (int)n, &st, out);
+        } else {
+            stream_count_words(buf, (int)n, &st);
+        }
+        start += n;
+    }
+
+    if (out == NULL) {
+        job->words[k] = st.words;
+        return rc;
+    }
+
+    if (rc == 0 && st.inside_word) { // the chunk ends at the end of the file
+        rc = out_write(out, " (", 2) | out_number(out, st.word_len) | out_write(out, ")\n", 2);
+    }
+    pthread_mutex_lock(&job->lock);
+    job->ready[k % job->window] = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    return rc;
+}
+
+void *par_worker(void *arg) {
+    par_job_t *job = (par_job_t *)arg;
+    char *buf = (char *)malloc(STREAM_BUFF_SZ);
+    long k;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        // when listing wait for the writer so the output held in memory stays bounded
+        while (job->listing && !job->failed && job->next < job->nchunks &&
+               job->next >= job->written + job->window) {
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        k = job->failed || buf == NULL ? job->nchunks : job->next++;
+        if (buf == NULL) {
+            job->failed = 1;
+            pthread_cond_broadcast(&job->cond);
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (k >= job->nchunks) {
+            break;
+        }
+        if (par_chunk(job, k, buf) != 0) {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_cond_broadcast(&job->cond);
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+// Runs one pass of the job on nthreads threads.  While listing, the calling thread writes
+// the chunks to stdout in order as they become ready.
+int par_pass(par_job_t *job, int nthreads) {
+    pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    int started = 0;
+
+    job->next = 0;
+    job->written = 0;
+    for (; threads != NULL && started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, par_worker, job) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        free(threads);
+        return -1;
+    }
+
+    for (long k = 0; job->listing && k < job->nchunks; k++) {
+        long slot = k % job->window;
+
+        pthread_mutex_lock(&job->lock);
+        while (!job->ready[slot] && !job->failed) {
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        if (!job->ready[slot]) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        fwrite(job->out[slot].data, 1, job->out[slot].len, stdout);
+
+        pthread_mutex_lock(&job->lock);
+        job->out[slot].len = 0;
+        job->ready[slot] = 0;
+        job->written++;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return job->failed ? -1 : 0;
+}
+
+// Counts (opt 'c') or lists (opt 'w') the words of a regular file with nthreads threads.
+// Returns the number of words or -1 if reading fails or memory runs out.
+long long par_words(int fd, off_t size, char opt, int nthreads) {
+    par_job_t job = {0};
+    long long total = 0;
+    int rc = 0;
+
+    job.fd = fd;
+    job.size = size;
+    job.nchunks = (long)((size + PAR_CHUNK_SZ - 1) / PAR_CHUNK_SZ);
+    job.window = (long)nthreads * PAR_WINDOW;
+    job.words = (long long *)calloc(job.nchunks, sizeof(long long));
+    job.out = (out_buff_t *)calloc(job.window, sizeof(out_buff_t));
+    job.ready = (int *)calloc(job.window, sizeof(int));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    if (job.words == NULL || job.out == NULL || job.ready == NULL) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        rc = par_pass(&job, nthreads);
+    }
+
+    // words before each chunk, where its numbering starts
+    for (long k = 0; rc == 0 && k < job.nchunks; k++) {
+        long long n = job.words[k];
+        job.words[k] = total;
+        total += n;
+    }
+
+    if (rc == 0 && opt == 'w') {
+        job.listing = 1;
+        rc = par_pass(&job, nthreads);
+    }
+    for (long i = 0; job.out != NULL && i < job.window; i++) {
+        free(job.out[i].data);
+    }
+
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+    free(job.words);
+    free(job.out);
+    free(job.ready);
+    return rc == 0 ? total : -1;
+}
+
+// Runs -c, -w, -r or -x over a file (or stdin if path is "-") without ever holding all of
+// it in memory.  Input that cannot be seeked, like a pipe, is copied to a temporary file
+// first so it can be reversed.  -x leaves whitespace alone, it copies the input with
+// search replaced.  Returns the exit code for main().
+int stream_input(char opt, char *path, char *search, char *replace) {
+    stream_state_t st = {0};
+    FILE *in;
+    char *buff;
+    size_t n;
+    int rc = 0;
+
+    if (opt != 'c' && opt != 'w' && opt != 'r' && opt != 'x') {
+        return 1;
+    }
+    if (opt == 'x' && (*search == '\0' || strlen(search) >= STREAM_BUFF_SZ)) {
+        printf("Error: search string must be 1 to %d characters.\n", STREAM_BUFF_SZ - 1);
+        return 1;
+    }
+
+    in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (in == NULL) {
+        printf("Error opening %s\n", path);
+        return 2;
+    }
+
+    // reversing and listing need a second buffer for the output, replacing room for a
+    // partial match
+    if (opt == 'r' || opt == 'w') {
+        buff = (char *)malloc(2 * STREAM_BUFF_SZ);
+    } else {
+        buff = (char *)malloc(STREAM_BUFF_SZ + (opt == 'x' ? strlen(search) : 0));
+    }
+    if (buff == NULL) {
+        if (in != stdin) fclose(in);
+        return 2;
+    }
+
+    if (opt == 'r') {
+        if (fseeko(in, 0, SEEK_END) != 0) {
+            FILE *tmp = tmpfile();
+            if (tmp == NULL) {
+                rc = -1;
+            }
+            while (rc == 0 && (n = fread(buff, 1, STREAM_BUFF_SZ, in)) > 0) {
+                if (fwrite(buff, 1, n, tmp) != n) rc = -1;
+            }
+            if (in != stdin) fclose(in);
+            in = tmp;
+        }
+        if (rc == 0) {
+            rc = stream_reverse(in, buff, STREAM_BUFF_SZ);
+        }
+    } else if (opt == 'x') {
+        rc = stream_replace(in, buff, search, replace);
+        if (rc >= 0) {
+            rc = rc > 0 ? 0 : 3; // 3 when the search string is not there
+        }
+    } else {
+        struct stat sb;
+        out_buff_t out = {buff + STREAM_BUFF_SZ, 0, STREAM_BUFF_SZ, stdout};
+        int nthreads = par_threads();
+        int parallel = nthreads > 1 && in != stdin && fstat(fileno(in), &sb) == 0 &&
+                       S_ISREG(sb.st_mode) && sb.st_size >= 2 * PAR_CHUNK_SZ;
+
+        if (opt == 'w') {
+            printf("Word Print\n----------\n");
+        }
+        if (parallel) {
+            fflush(stdout); // the header has to come before what the threads write
+            st.words = par_words(fileno(in), sb.st_size, opt, nthreads);
+            rc = st.words < 0 ? -1 : 0;
+        }
+        while (!parallel && (n = fread(buff, 1, STREAM_BUFF_SZ, in)) > 0) {
+            if (opt == 'c') {
+                stream_count_words(buff, (int)n, &st);
+            } else {
+                rc = stream_print_words(buff, (int)n, &st, &out);
+            }
+        }
+        if (opt == 'w' && !parallel) {
+            if (rc == 0 && st.inside_word) { // input ended in the middle of a word
+                rc = out_write(&out, " (", 2) | out_number(&out, st.word_len) | out_write(&out, ")\n", 2);
+            }
+            rc |= out_flush(&out);
+        }
+        if (opt == 'c') {
+            printf("Word Count: %lld\n", st.words);
+        }
+    }
+
+    if (rc == 0 && in != NULL && ferror(in)) {
+        rc = -1;
+    }
+    if (rc < 0) {
+        printf("Error reading %s\n", path);
+    }
+
+    if (in != NULL && in != stdin) fclose(in);
+    free(buff);
+    return rc < 0 ? 2 : rc == 3 ? 3 : 0;
+}
+
 int main(int argc, char *argv[]){
 
     char *buff;             //placehoder for the internal buffer
@@ -162,6 +1043,11 @@ int main(int argc, char *argv[]){
     int  rc;                //used for return codes
     int  user_str_len;      //length of user supplied string
 
+    if (init_kernels() < 0) {
+        printf("Error: STRINGFUN_SIMD must be scalar, sse2 or avx2.\n");
+        exit(1);
+    }
+
     //TODO:  #1. WHY IS THIS SAFE, aka what if arv[1] does not exist?
     //      This is safe because the condition "argc < 2" first checks if there are less than 2 arguments passed. If this 
     //      is true, then the second condition of the or statement (*argv[1] != '-') would never be evaluated, since the or itself is already true.
@@ -191,6 +1077,19 @@ int main(int argc, char *argv[]){
         exit(1);
     }
 
+    // -f streams a file or stdin instead of working on a string in the buffer
+    if (strcmp(argv[2], "-f") == 0) {
+        if (argc != (opt == 'x' ? 6 : 4)) {
+            usage(argv[0]);
+            exit(1);
+        }
+        rc = stream_input(opt, argv[3], opt == 'x' ? argv[4] : NULL, opt == 'x' ? argv[5] : NULL);
+        if (rc == 1) {
+            usage(argv[0]);
+        }
+        exit(rc);
+    }
+
     input_string = argv[2]; //capture the user input string
 
     //TODO:  #3 Allocate space for the buffer using malloc and
@@ -244,9 +1143,17 @@ int main(int argc, char *argv[]){
                 free(buff);
                 exit(1);
             }
-            printf("Not Implemented!");
-            free(buff);
-            exit(0);
+            if (*argv[3] == '\0') {
+                printf("Error: search string can not be empty.\n");
+                free(buff);
+                exit(1);
+            }
+            rc = replace_buff(buff, BUFFER_SZ, user_str_length(input_string, BUFFER_SZ), argv[3], argv[4]);
+            if (rc < 0){
+                printf("Error replacing string, rc = %d", rc);
+                free(buff);
+                exit(rc == -1 ? 3 : 2); // 3 when the search string is not there
+            }
             break;
 
         //TODO:  #5 Implement the other cases for 'r' and 'w' by extending
@@ -98,3 +98,69 @@ Buffer:  [Lets get a lot of words to test...................]" ]
     [ "$output" = "Buffer:  [This is a super long string for testing my app....]" ] || 
     [ "$output" = "Not Implemented!" ]
 }
+
+@test "stream words from a file" {
+    printf "  Lets get\ta lot   of words\nto test  " > stream_test.txt
+    run ./stringfun -w -f stream_test.txt
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Print
+----------
+1. Lets (4)
+2. get (3)
+3. a (1)
+4. lot (3)
+5. of (2)
+6. words (5)
+7. to (2)
+8. test (4)" ]
+    run ./stringfun -r -f stream_test.txt
+    rm -f stream_test.txt
+    [ "$status" -eq 0 ]
+    [ "$output" = "Reversed String: tset ot sdrow fo tol a teg steL" ]
+}
+
+@test "stream large input from stdin" {
+    run bash -c "yes 'some words  longer than the buffer' | head -n 100000 | ./stringfun -c -f -"
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Count: 600000" ]
+    run bash -c "printf '%070000d' 0 | ./stringfun -r -f - | wc -c"
+    [ "$output" = "70018" ]
+}
+
+@test "vector and scalar kernels agree" {
+    for i in $(seq 1 300); do printf "w%d \t  x\n" $i; done > kernel_test.txt
+    for k in scalar sse2 avx2; do
+        run bash -c "STRINGFUN_SIMD=$k ./stringfun -c -f kernel_test.txt"
+        [ "$output" = "Word Count: 600" ]
+        run bash -c "STRINGFUN_SIMD=$k ./stringfun -c '  one two   three   four five six seven eight  '"
+        [ "${lines[0]}" = "Word Count: 8" ]
+    done
+    rm -f kernel_test.txt
+}
+
+@test "unknown kernel names are refused" {
+    run bash -c "STRINGFUN_SIMD=avx512 ./stringfun -c 'one two'"
+    [ "$status" -eq 1 ]
+    [ "$output" = "Error: STRINGFUN_SIMD must be scalar, sse2 or avx2." ]
+}
+
+@test "stream search replace every match" {
+    run bash -c "yes 'aab aaab' | head -n 20000 | ./stringfun -x -f - aab X | sort | uniq -c"
+    [ "$status" -eq 0 ]
+    [ "$(echo $output)" = "20000 X aX" ]
+    run bash -c "echo 'nothing here' | ./stringfun -x -f - bad great"
+    [ "$status" -eq 3 ]
+    [ "$output" = "nothing here" ]
+}
+
+@test "threaded word count and listing match one thread" {
+    yes 'split words across  the chunks  of a big file' | head -n 300000 > thread_test.txt
+    run bash -c "STRINGFUN_THREADS=4 ./stringfun -c -f thread_test.txt"
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Count: 2700000" ]
+    STRINGFUN_THREADS=1 ./stringfun -w -f thread_test.txt > thread_one.txt
+    STRINGFUN_THREADS=4 ./stringfun -w -f thread_test.txt > thread_four.txt
+    run cmp thread_one.txt thread_four.txt
+    rm -f thread_test.txt thread_one.txt thread_four.txt
+    [ "$status" -eq 0 ]
+}
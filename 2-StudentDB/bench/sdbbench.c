@@ -0,0 +1,574 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbsc_cache.h"
+
+/*
+ *  sdbbench - benchmark and workload generator for sdbsc
+ *
+ *  Links the sdbsc sources (built with SDBSC_NO_MAIN) and drives the database
+ *  functions in process, so every add_student(), get_student() or
+ *  print_db() is timed on its own.  For each workload it runs these
+ *  phases against a fresh database in a scratch directory:
+ *
+ *      insert    add_student() for every student of the roster
+ *      churn     (churn workload only) delete a random student and add it
+ *                back, n times
+ *      lookup    get_student() on random ids, one in ten is a miss
+ *      hot       get_student() on BENCH_HOT_IDS popular ids
+ *      batch     get_students() on BENCH_BATCH_IDS random ids, an op is
+ *                one batch
+ *      lname     find_students_by_lname() on random last names
+ *      print     print_db()
+ *      gpa       query_gpa_range() over a random quarter of the gpa range
+ *      stats     print_gpa_stats()
+ *      delete    del_student() on half of the students
+ *      compress  compress_db()
+ *
+ *  and reports ops/sec, p50 and p99 latency and the I/O system calls made
+ *  per op, then the hits and misses of the page cache.  The calls are
+ *  counted by wrapping them at link time (see the bench target in
+ *  makefile.txt), so only calls made by sdbsc itself are counted, not the
+ *  write()s stdio makes for printf().  Console output of
+ *  the database functions goes to /dev/null while phases run.
+ *
+ *  The environment selects the configuration being measured just like it
+ *  does for sdbsc (SDB_BACKEND, SDB_WAL, SDB_CACHE).
+ *
+ *  usage: sdbbench [-n records] [-w dense|sparse|churn|all] [-r seed] [-g]
+ *      -n   students in the roster (default BENCH_DEF_RECS)
+ *      -w   workload to run (default all)
+ *      -r   random seed, runs with the same seed do the same operations
+ *      -g   print the roster of the workload as id,first,last,gpa lines
+ *           (input for sdbsc -i) instead of running it
+ */
+
+#define BENCH_DEF_RECS      10000   //default roster size
+#define BENCH_SCAN_ITERS    5       //times each scan phase runs
+#define BENCH_MAX_PHASES    12
+#define BENCH_HOT_IDS       64      //working set of the hot phase
+#define BENCH_BATCH_IDS     256     //ids looked up per op of the batch phase
+
+//one timed phase: latency of every op and the calls made during it
+typedef struct bench_phase {
+    const char *name;
+    double     *lat_us;     //latency of each op
+    int         nops;
+    int         cap;
+    double      total_s;
+    unsigned long long calls;
+} bench_phase_t;
+
+//a generated roster: ids in insert order, names and gpas derived from ids
+typedef struct bench_roster {
+    const char *workload;
+    int        *ids;
+    int         n;
+} bench_roster_t;
+
+static const char *bench_syllables[] = {
+    "an", "bo", "ca", "de", "el", "fi", "go", "ha", "is", "jo",
+    "ka", "lu", "me", "no", "or", "pa", "ri", "so", "tu", "vi",
+};
+#define BENCH_NSYL  (sizeof(bench_syllables) / sizeof(bench_syllables[0]))
+
+/*
+ *  System call counting
+ *
+ *  The bench target links with -Wl,--wrap=<call> for every call below, so
+ *  sdbsc's calls land in __wrap_<call>, which counts and forwards to the
+ *  real one.
+ */
+static unsigned long long bench_calls = 0;     //scans may count from several threads
+
+#define BENCH_WRAP(ret, name, params, args)                    \
+    ret __real_##name params;                                  \
+    ret __wrap_##name params                                   \
+    {                                                          \
+        __atomic_fetch_add(&bench_calls, 1, __ATOMIC_RELAXED); \
+        return __real_##name args;                             \
+    }
+
+BENCH_WRAP(ssize_t, pread, (int fd, void *buf, size_t len, off_t off), (fd, buf, len, off))
+BENCH_WRAP(ssize_t, pwrite, (int fd, const void *buf, size_t len, off_t off), (fd, buf, len, off))
+BENCH_WRAP(ssize_t, read, (int fd, void *buf, size_t len), (fd, buf, len))
+BENCH_WRAP(ssize_t, write, (int fd, const void *buf, size_t len), (fd, buf, len))
+BENCH_WRAP(off_t, lseek, (int fd, off_t off, int whence), (fd, off, whence))
+BENCH_WRAP(int, fsync, (int fd), (fd))
+BENCH_WRAP(int, fdatasync, (int fd), (fd))
+BENCH_WRAP(int, ftruncate, (int fd, off_t len), (fd, len))
+BENCH_WRAP(int, fallocate, (int fd, int mode, off_t off, off_t len), (fd, mode, off, len))
+BENCH_WRAP(int, fstat, (int fd, struct stat *st), (fd, st))
+BENCH_WRAP(int, msync, (void *addr, size_t len, int flags), (addr, len, flags))
+BENCH_WRAP(int, close, (int fd), (fd))
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+
+    if (flags & O_CREAT)
+    {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    bench_calls++;
+    return __real_open(path, flags, mode);
+}
+
+// io_uring_enter() and friends, sdbsc makes them with syscall()
+long __real_syscall(long number, ...);
+long __wrap_syscall(long number, ...)
+{
+    va_list ap;
+    long a[6];
+
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++)
+        a[i] = va_arg(ap, long);
+    va_end(ap);
+    bench_calls++;
+    return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+int __real_fcntl(int fd, int cmd, ...);
+int __wrap_fcntl(int fd, int cmd, ...)
+{
+    va_list ap;
+
+    // every fcntl() sdbsc makes takes a pointer argument (struct flock)
+    va_start(ap, cmd);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    bench_calls++;
+    return __real_fcntl(fd, cmd, arg);
+}
+
+// microseconds between two timestamps
+static double elapsed_us(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e6 + (b->tv_nsec - a->tv_nsec) / 1e3;
+}
+
+// xorshift64*, reproducible across runs for a given seed
+static uint64_t bench_rng = 88172645463325252ULL;
+
+static uint64_t bench_rand(void)
+{
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return bench_rng * 2685821657736338717ULL;
+}
+
+static int bench_rand_below(int n)
+{
+    return (int)(bench_rand() % (uint64_t)n);
+}
+
+// a pronounceable name derived from id, so every run builds the same roster
+static void bench_name(int id, int salt, char *buf, size_t len)
+{
+    unsigned h = (unsigned)id * 2654435761u + (unsigned)salt * 40503u;
+    int nsyl = 2 + h % 3;
+
+    buf[0] = '\0';
+    for (int i = 0; i < nsyl && strlen(buf) + 3 <= len; i++)
+    {
+        strcat(buf, bench_syllables[h % BENCH_NSYL]);
+        h /= BENCH_NSYL;
+        h = h * 2654435761u + (unsigned)i;
+    }
+}
+
+// last names come from a small pool so -l style lookups find several students
+static void bench_lname(int id, char *buf, size_t len)
+{
+    bench_name(id % 997, 7, buf, len);
+}
+
+static int bench_gpa(int id)
+{
+    return (int)(((unsigned)id * 2246822519u) % (MAX_STD_GPA + 1));
+}
+
+static void bench_shuffle(int *a, int n)
+{
+    for (int i = n - 1; i > 0; i--)
+    {
+        int j = bench_rand_below(i + 1);
+        int t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+    }
+}
+
+/*
+ *  bench_make_roster
+ *      workload:  "dense", "sparse" or "churn"
+ *      n:         number of students
+ *      *r:        receives the roster
+ *
+ *  dense and churn use ids 1..n, sparse spreads n ids over the whole id
+ *  range with a random gap in each stride.  The ids are shuffled, so
+ *  inserts arrive in random order.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if memory runs out
+ */
+static int bench_make_roster(const char *workload, int n, bench_roster_t *r)
+{
+    r->workload = workload;
+    r->n = n;
+    r->ids = malloc(n * sizeof(int));
+    if (r->ids == NULL)
+        return ERR_DB_FILE;
+
+    if (strcmp(workload, "sparse") == 0)
+    {
+        int stride = MAX_STD_ID / n;
+        for (int i = 0; i < n; i++)
+            r->ids[i] = MIN_STD_ID + i * stride + bench_rand_below(stride);
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+            r->ids[i] = MIN_STD_ID + i;
+    }
+    bench_shuffle(r->ids, n);
+    return NO_ERROR;
+}
+
+static void bench_phase_begin(bench_phase_t *p, const char *name, int cap)
+{
+    p->name = name;
+    p->nops = 0;
+    p->cap = cap;
+    p->lat_us = malloc(cap * sizeof(double));
+    p->total_s = 0;
+    p->calls = bench_calls;
+}
+
+static void bench_phase_end(bench_phase_t *p)
+{
+    p->calls = bench_calls - p->calls;
+}
+
+// time one op of a phase, ops past the capacity are not recorded
+#define BENCH_OP(p, call)                                       \
+    do {                                                        \
+        struct timespec t0_, t1_;                               \
+        clock_gettime(CLOCK_MONOTONIC, &t0_);                   \
+        call;                                                   \
+        clock_gettime(CLOCK_MONOTONIC, &t1_);                   \
+        double us_ = elapsed_us(&t0_, &t1_);                    \
+        if ((p)->lat_us != NULL && (p)->nops < (p)->cap)        \
+            (p)->lat_us[(p)->nops++] = us_;                     \
+        (p)->total_s += us_ / 1e6;                              \
+    } while (0)
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double bench_percentile(const double *sorted, int n, double pct)
+{
+    int i = (int)(pct / 100.0 * (n - 1) + 0.5);
+
+    return n > 0 ? sorted[i] : 0;
+}
+
+static void bench_report(FILE *out, const char *workload, bench_phase_t *p)
+{
+    qsort(p->lat_us, p->nops, sizeof(double), cmp_double);
+    fprintf(out, "%-8s %-9s %8d %12.1f %10.2f %10.2f %12.2f\n",
+            workload, p->name, p->nops,
+            p->total_s > 0 ? p->nops / p->total_s : 0,
+            bench_percentile(p->lat_us, p->nops, 50),
+            bench_percentile(p->lat_us, p->nops, 99),
+            p->nops > 0 ? (double)p->calls / p->nops : 0);
+    free(p->lat_us);
+    p->lat_us = NULL;
+}
+
+/*
+ *  bench_run
+ *      *r:    roster of the workload
+ *      out:   where the report goes
+ *
+ *  Runs every phase of a workload against a new, empty database.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the database could not be opened
+ */
+static int bench_run(bench_roster_t *r, FILE *out)
+{
+    bench_phase_t phases[BENCH_MAX_PHASES];
+    int nphases = 0;
+    char fname[32], lname[32];
+    unsigned long long hits0, misses0, hits, misses;
+    student_t s;
+    int n = r->n;
+    int fd = open_db(DB_FILE, true);
+
+    cache_counters(&hits0, &misses0);
+
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    bench_phase_t *p = &phases[nphases++];
+    bench_phase_begin(p, "insert", n);
+    for (int i = 0; i < n; i++)
+    {
+        int id = r->ids[i];
+        bench_name(id, 1, fname, sizeof(fname));
+        bench_lname(id, lname, sizeof(lname));
+        BENCH_OP(p, add_student(fd, id, fname, lname, bench_gpa(id)));
+    }
+    bench_phase_end(p);
+
+    if (strcmp(r->workload, "churn") == 0)
+    {
+        p = &phases[nphases++];
+        bench_phase_begin(p, "churn", 2 * n);
+        for (int i = 0; i < n; i++)
+        {
+            int id = r->ids[bench_rand_below(n)];
+            bench_name(id, 1, fname, sizeof(fname));
+            bench_lname(id, lname, sizeof(lname));
+            BENCH_OP(p, del_student(fd, id));
+            BENCH_OP(p, add_student(fd, id, fname, lname, bench_gpa(id)));
+        }
+        bench_phase_end(p);
+    }
+
+    p = &phases[nphases++];
+    bench_phase_begin(p, "lookup", n);
+    for (int i = 0; i < n; i++)
+    {
+        int id = bench_rand_below(10) == 0 ? MIN_STD_ID + bench_rand_below(MAX_STD_ID)
+                                           : r->ids[bench_rand_below(n)];
+        BENCH_OP(p, get_student(fd, id, &s));
+    }
+    bench_phase_end(p);
+
+    // the same few students again and again, like a server sees them
+    p = &phases[nphases++];
+    bench_phase_begin(p, "hot", n);
+    for (int i = 0; i < n; i++)
+        BENCH_OP(p, get_student(fd, r->ids[bench_rand_below(n < BENCH_HOT_IDS ? n : BENCH_HOT_IDS)], &s));
+    bench_phase_end(p);
+
+    int nbatch = n / BENCH_BATCH_IDS > 0 ? n / BENCH_BATCH_IDS : 1;
+    int ids[BENCH_BATCH_IDS], rcs[BENCH_BATCH_IDS];
+    student_t found[BENCH_BATCH_IDS];
+    p = &phases[nphases++];
+    bench_phase_begin(p, "batch", nbatch);
+    for (int i = 0; i < nbatch; i++)
+    {
+        for (int k = 0; k < BENCH_BATCH_IDS; k++)
+            ids[k] = r->ids[bench_rand_below(n)];
+        BENCH_OP(p, get_students(fd, ids, found, rcs, BENCH_BATCH_IDS));
+    }
+    bench_phase_end(p);
+
+    int nlname = n / 10 > 0 ? n / 10 : 1;
+    p = &phases[nphases++];
+    bench_phase_begin(p, "lname", nlname);
+    for (int i = 0; i < nlname; i++)
+    {
+        bench_lname(r->ids[bench_rand_below(n)], lname, sizeof(lname));
+        BENCH_OP(p, find_students_by_lname(fd, lname));
+    }
+    bench_phase_end(p);
+
+    p = &phases[nphases++];
+    bench_phase_begin(p, "print", BENCH_SCAN_ITERS);
+    for (int i = 0; i < BENCH_SCAN_ITERS; i++)
+        BENCH_OP(p, print_db(fd));
+    bench_phase_end(p);
+
+    p = &phases[nphases++];
+    bench_phase_begin(p, "gpa", BENCH_SCAN_ITERS);
+    for (int i = 0; i < BENCH_SCAN_ITERS; i++)
+    {
+        int min = bench_rand_below(MAX_STD_GPA - MAX_STD_GPA / 4);
+        BENCH_OP(p, query_gpa_range(fd, min, min + MAX_STD_GPA / 4));
+    }
+    bench_phase_end(p);
+
+    p = &phases[nphases++];
+    bench_phase_begin(p, "stats", BENCH_SCAN_ITERS);
+    for (int i = 0; i < BENCH_SCAN_ITERS; i++)
+        BENCH_OP(p, print_gpa_stats(fd));
+    bench_phase_end(p);
+
+    p = &phases[nphases++];
+    bench_phase_begin(p, "delete", n / 2 > 0 ? n / 2 : 1);
+    for (int i = 0; i < n / 2; i++)
+        BENCH_OP(p, del_student(fd, r->ids[i]));
+    bench_phase_end(p);
+
+    p = &phases[nphases++];
+    bench_phase_begin(p, "compress", 1);
+    BENCH_OP(p, fd = compress_db(fd));
+    bench_phase_end(p);
+
+    cache_counters(&hits, &misses);
+    if (fd >= 0)
+        close_db(fd);
+
+    fflush(stdout);
+    for (int i = 0; i < nphases; i++)
+        bench_report(out, r->workload, &phases[i]);
+    fprintf(out, "%-8s %-9s %llu hits, %llu misses\n", r->workload, "cache",
+            hits - hits0, misses - misses0);
+    return fd >= 0 ? NO_ERROR : ERR_DB_FILE;
+}
+
+// prints a roster the way sdbsc -i reads it
+static void bench_print_roster(bench_roster_t *r)
+{
+    char fname[32], lname[32];
+
+    for (int i = 0; i < r->n; i++)
+    {
+        int id = r->ids[i];
+        bench_name(id, 1, fname, sizeof(fname));
+        bench_lname(id, lname, sizeof(lname));
+        printf("%d,%s,%s,%d\n", id, fname, lname, bench_gpa(id));
+    }
+}
+
+static void bench_usage(char *exename)
+{
+    printf("usage: %s [-n records] [-w dense|sparse|churn|all] [-r seed] [-g]\n", exename);
+    printf("\t-n records:  students in the roster (default %d)\n", BENCH_DEF_RECS);
+    printf("\t-w workload:  workload to run (default all)\n");
+    printf("\t-r seed:  random seed\n");
+    printf("\t-g:  print the roster as import input instead of running it\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *workloads[] = {"dense", "sparse", "churn"};
+    const char *which = "all";
+    char dir[] = "/tmp/sdbbench.XXXXXX";
+    bool gen = false;
+    int n = BENCH_DEF_RECS;
+    int opt;
+    int rc = EXIT_OK;
+
+    while ((opt = getopt(argc, argv, "n:w:r:gh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'w':
+            which = optarg;
+            break;
+        case 'r':
+            bench_rng = strtoull(optarg, NULL, 10) | 1;
+            break;
+        case 'g':
+            gen = true;
+            break;
+        case 'h':
+            bench_usage(argv[0]);
+            return EXIT_OK;
+        default:
+            bench_usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+    }
+    if (n < 1 || n > MAX_STD_ID || (strcmp(which, "all") != 0 &&
+        strcmp(which, "dense") != 0 && strcmp(which, "sparse") != 0 && strcmp(which, "churn") != 0))
+    {
+        bench_usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+
+    if (gen)
+    {
+        bench_roster_t r;
+        if (strcmp(which, "all") == 0 || bench_make_roster(which, n, &r) != NO_ERROR)
+        {
+            bench_usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+        bench_print_roster(&r);
+        free(r.ids);
+        return EXIT_OK;
+    }
+
+    // the database functions print, the report goes to the real stdout
+    int report_fd = dup(STDOUT_FILENO);
+    FILE *out = report_fd >= 0 ? fdopen(report_fd, "w") : NULL;
+    int devnull = open("/dev/null", O_WRONLY);
+    if (out == NULL || devnull < 0 || mkdtemp(dir) == NULL || chdir(dir) == -1)
+    {
+        perror("sdbbench");
+        return EXIT_FAIL_DB;
+    }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    fprintf(out, "records=%d backend=%s wal=%s cache=%s\n", n,
+            getenv(DB_BACKEND_ENV) ? getenv(DB_BACKEND_ENV) : "rw",
+            getenv(DB_WAL_ENV) ? getenv(DB_WAL_ENV) : "off",
+            getenv(DB_CACHE_ENV) ? getenv(DB_CACHE_ENV) : "default");
+    fprintf(out, "%-8s %-9s %8s %12s %10s %10s %12s\n",
+            "workload", "phase", "ops", "ops/sec", "p50(us)", "p99(us)", "syscalls/op");
+
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        bench_roster_t r = {0};
+
+        if (strcmp(which, "all") != 0 && strcmp(which, workloads[i]) != 0)
+            continue;
+        if (bench_make_roster(workloads[i], n, &r) != NO_ERROR || bench_run(&r, out) != NO_ERROR)
+        {
+            fprintf(out, "sdbbench: %s workload failed\n", workloads[i]);
+            rc = EXIT_FAIL_DB;
+        }
+        free(r.ids);
+        fflush(out);
+    }
+
+    // leave nothing behind in the scratch directory
+    unlink(DB_FILE);
+    unlink(DB_FILE DB_BITMAP_SUFFIX);
+    unlink(DB_FILE DB_INDEX_SUFFIX);
+    unlink(DB_FILE DB_WAL_SUFFIX);
+    unlink(DB_FILE DB_DIR_SUFFIX);
+    unlink(DB_FILE DB_CRC_SUFFIX);
+    unlink(DB_FILE DB_SNAP_SUFFIX);
+    unlink(DB_FILE DB_COL_SUFFIX);
+    unlink(TMP_DB_FILE);
+    if (chdir("/") == 0)
+        rmdir(dir);
+
+    fclose(out);
+    return rc;
+}
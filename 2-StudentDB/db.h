@@ -19,6 +19,7 @@ typedef struct student{
 //that value divided by 100.0 or 4.50.
 #define MIN_STD_ID      1
 #define MAX_STD_ID      100000
+#define MAX_PAGED_STD_ID 2147483646     //paged layout, INT_MAX ends a scan
 #define MIN_STD_GPA     0
 #define MAX_STD_GPA     500
 
@@ -29,7 +30,198 @@ static const int STUDENT_RECORD_SIZE  = sizeof(struct student);
 static const int DELETED_STUDENT_ID = 0;
 
 
+//Slot 0 of the database file never holds a student, it holds this header
+//instead.  It is engineered to be exactly one record (64 bytes) in size.
+typedef struct db_header{
+    char               magic[8];     //DB_HEADER_MAGIC
+    int                version;
+    int                count;        //number of live student records
+    unsigned long long generation;   //must match the bitmap or directory file
+    int                layout;       //DB_LAYOUT_DIRECT or DB_LAYOUT_PAGED
+    int                wal_log;      //1 while a process may be logging changes
+    unsigned long long wal_floor;    //log records numbered below this are applied
+    unsigned int       side_files;   //DB_SIDE_* bits, side files every change keeps
+    char               reserved[20];
+} db_header_t;
+
+//Header of the occupancy bitmap side file, followed by one bit per
+//student id (bit id % 64 of 64 bit word id / 64)
+typedef struct db_bitmap_hdr{
+    char               magic[8];     //DB_BITMAP_MAGIC
+    unsigned long long generation;
+} db_bitmap_hdr_t;
+
+//The last name index file starts with this header followed by count
+//entries sorted by last name, first name and id.  Both are 64 bytes.
+typedef struct db_idx_hdr{
+    char               magic[8];     //DB_INDEX_MAGIC
+    unsigned long long generation;   //database generation the index matches
+    int                count;        //number of entries
+    char               reserved[44];
+} db_idx_hdr_t;
+
+typedef struct db_idx_entry{
+    char lname[32];
+    char fname[24];
+    int  id;
+    int  reserved;
+} db_idx_entry_t;
+
+//The write-ahead log file starts with this header, the size of one
+//record, followed by the records.  The record at position i of the file
+//is numbered base + i, numbers keep growing across checkpoints.
+typedef struct db_wal_hdr{
+    char               magic[8];     //DB_WAL_MAGIC
+    unsigned long long base;         //number of the first record in the file
+    char               reserved[72];
+} db_wal_hdr_t;
+
+//Write-ahead log record, one per add or delete.  rec is the full image
+//of the student added or deleted so replaying a record is idempotent.
+typedef struct db_wal_rec{
+    char               magic[4];     //WAL_REC_MAGIC
+    int                op;           //WAL_OP_ADD or WAL_OP_DEL
+    unsigned long long seq;          //number of the record
+    student_t          rec;
+    unsigned int       checksum;     //covers every byte before it
+    int                reserved;
+} db_wal_rec_t;
+
+//A paged database stores students in 4KB pages of 64 records, logical page
+//id / 64 holding ids id / 64 * 64 .. +63, at whatever page of the file the
+//page directory says.  The directory file starts with this header (padded
+//to a page), then DB_DIR_ROOT_ENTRIES root entries each naming the leaf
+//that covers DB_DIR_LEAF_IDS ids, 0 if none, then the leaves.
+typedef struct db_dir_hdr{
+    char               magic[8];     //DB_DIR_MAGIC
+    unsigned long long generation;   //must match the database header
+    unsigned int       npages;       //pages allocated in the database file
+    unsigned int       nleaves;      //leaves allocated in the directory
+    char               reserved[40];
+} db_dir_hdr_t;
+
+//Leaf entry for one logical page, a leaf is DB_DIR_LEAF_ENTRIES of them
+typedef struct db_dir_entry{
+    unsigned int       page;         //page of the database file, 0 if none
+    unsigned int       reserved;
+    unsigned long long occupied;     //bit i set if slot i holds a student
+} db_dir_entry_t;
+
+//The page checksum file starts with this header followed by one CRC32C per
+//4KB page of the database file, entry p at sizeof(db_crc_hdr_t) + p * 4
+typedef struct db_crc_hdr{
+    char               magic[8];     //DB_CRC_MAGIC
+    unsigned long long generation;   //database generation the sums match
+    char               reserved[48];
+} db_crc_hdr_t;
+
+#define DB_SNAP_SLOTS       16              //snapshots pinned at once
+
+//The snapshot file starts with this header (padded to a page), then the
+//pages writers saved for pinned snapshots, each a db_snap_entry_t followed
+//by the 4KB the page held before the write
+typedef struct db_snap_hdr{
+    char               magic[8];     //DB_SNAP_MAGIC
+    unsigned int       active;       //bit s set while snapshot slot s is pinned
+    unsigned int       nsaved;       //pages saved so far
+    unsigned int       seq;          //bumped whenever a slot is pinned or freed
+    unsigned int       start[DB_SNAP_SLOTS];  //first saved page slot s uses
+    unsigned int       changes;      //odd while the database file is being
+                                     //changed, page caches compare it
+} db_snap_hdr_t;
+
+typedef struct db_snap_entry{
+    unsigned long long page;         //page of the database file
+    unsigned int       slots;        //snapshots the saved page belongs to
+    char               reserved[52];
+} db_snap_entry_t;
+
+//The column store file starts with this header followed by three arrays
+//of cap ints each: the ids of the students in increasing order, their
+//gpas, and where their names start in the name heap after the arrays.  A
+//student's names are its first and last name, each ending in a NUL.
+typedef struct db_col_hdr{
+    char               magic[8];     //DB_COL_MAGIC
+    unsigned long long generation;   //database generation the columns match
+    int                count;        //students in the columns
+    int                cap;          //entries each array has room for
+    unsigned int       heap_len;     //bytes of the name heap in use
+    unsigned int       heap_live;    //of those, bytes still naming a student
+    char               reserved[32];
+} db_col_hdr_t;
+
+//A binary export (sdbsc -e bin) is this header followed by count packed
+//student records in id order, the same bytes as the database slots.
+typedef struct db_export_hdr{
+    char               magic[8];     //DB_EXPORT_MAGIC
+    int                version;
+    int                rec_size;     //sizeof(student_t) of the exporter
+    int                count;        //number of records that follow
+    char               reserved[44];
+} db_export_hdr_t;
+
+#define WAL_REC_MAGIC       "WAL1"
+#define DB_WAL_MAGIC        "SDBWAL1"
+#define WAL_OP_ADD          1
+#define WAL_OP_DEL          2
+#define DB_HEADER_MAGIC     "SDBHDR1"
+#define DB_BITMAP_MAGIC     "SDBBMP1"
+#define DB_INDEX_MAGIC      "SDBIDX1"
+#define DB_EXPORT_MAGIC     "\x89SDBEXP"  //first byte never starts a csv line
+#define DB_HEADER_VERSION   1
+#define DB_EXPORT_VERSION   1
+#define DB_BITMAP_WORDS     ((MAX_STD_ID + 64) / 64)
+#define DB_DIR_MAGIC        "SDBDIR1"
+#define DB_CRC_MAGIC        "SDBCRC1"
+#define DB_SNAP_MAGIC       "SDBSNP1"
+#define DB_COL_MAGIC        "SDBCOL1"
+#define DB_LAYOUT_DIRECT    0               //student id at offset id * 64
+#define DB_LAYOUT_PAGED     1               //pages found through the directory
+#define DB_SIDE_COLUMNS     1               //the column store was created
+#define DB_SIDE_INDEX       2               //the last name index was created
+#define DB_PAGE_SIZE        4096
+#define DB_PAGE_RECS        (DB_PAGE_SIZE / 64)
+#define DB_DIR_LEAF_ENTRIES (DB_PAGE_SIZE / 16)             //a leaf is one page
+#define DB_DIR_LEAF_IDS     (DB_DIR_LEAF_ENTRIES * DB_PAGE_RECS)
+#define DB_DIR_ROOT_ENTRIES (MAX_PAGED_STD_ID / DB_DIR_LEAF_IDS + 1)
+
 #define DB_FILE     "student.db"            //name of database file
 #define TMP_DB_FILE ".tmp_student.db"       //for extra credit
+#define DB_BITMAP_SUFFIX ".bmp"             //occupancy bitmap, student.db.bmp
+#define DB_INDEX_SUFFIX  ".idx"             //last name index, student.db.idx
+#define DB_WAL_SUFFIX    ".wal"             //write-ahead log, student.db.wal
+#define DB_DIR_SUFFIX    ".dir"             //page directory, student.db.dir
+#define DB_CRC_SUFFIX    ".crc"             //page checksums, student.db.crc
+#define DB_SNAP_SUFFIX   ".snap"            //snapshot pages, student.db.snap
+#define DB_COL_SUFFIX    ".col"             //column store, student.db.col
+#define DB_SOCK_SUFFIX   ".sock"            //server socket, student.db.sock
+
+//write-ahead log and group commit policy, SDB_WAL=records[,milliseconds]
+//for example SDB_WAL=256,20 commits every 256 changes or 20ms
+#define DB_WAL_ENV      "SDB_WAL"
+
+//threads used by full scans, default is one per cpu once the database is
+//big enough to be worth it, for example SDB_THREADS=1 ./sdbsc -p
+#define DB_THREADS_ENV  "SDB_THREADS"
+
+//layout of a database when it is created, SDB_LAYOUT=paged ./sdbsc -a ...
+//lets ids go up to MAX_PAGED_STD_ID with a file that grows with the number
+//of students instead of the largest id
+#define DB_LAYOUT_ENV   "SDB_LAYOUT"
+#define DB_LAYOUT_PAGED_NAME "paged"
+
+//memory budget of the page cache, in bytes or with a K, M or G suffix, 0
+//turns it off, for example SDB_CACHE=64M ./sdbsc -b ops.txt
+#define DB_CACHE_ENV    "SDB_CACHE"
+
+//the column store that gpa reports read is kept up to date unless this
+//is off, for example SDB_COLUMNS=off ./sdbsc -i roster.csv
+#define DB_COLUMNS_ENV  "SDB_COLUMNS"
+#define DB_COLUMNS_OFF  "off"
+
+//storage backend selection, for example SDB_BACKEND=mmap ./sdbsc -p
+#define DB_BACKEND_ENV  "SDB_BACKEND"
+#define DB_BACKEND_MMAP "mmap"
+#define DB_BACKEND_URING "uring"    //read/write with batches through io_uring
 
 #endif
\ No newline at end of file
@@ -1,399 +1,5295 @@
+#define _GNU_SOURCE  //mremap(), and the linux specific file APIs used below
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h> //c library for system call file routines
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h> //SSE4.2 crc32 instruction
+#endif
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "sdbsc_cache.h"
+#include "sdbsc_col.h"
+#include "sdbsc_snap.h"
+#include "sdbsc_uring.h"
+#include "sdbsc_wal.h"
 
 /*
- *  open_db
- *      dbFile:  name of the database file
- *      should_truncate:  indicates if opening the file also empties it
+ *  Storage backends
  *
- *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *  By default every record operation is a pread()/pwrite() against the
+ *  database file.  Setting SDB_BACKEND=mmap in the environment switches
+ *  open_db() to the mmap backend, which maps the whole file MAP_SHARED and
+ *  serves lookups, updates and scans straight out of the mapping.  Writes
+ *  are pushed to the kernel with msync(MS_ASYNC) as they happen, and
+ *  sync_db() (called from close_db()) is the MS_SYNC durability point.
+ *  SDB_BACKEND=uring keeps pread()/pwrite() and adds batched transfers,
+ *  see Batched I/O below.
  *
- *  console:  Does not produce any console I/O on success
- *            M_ERR_DB_OPEN on error
+ *  Only one database is ever open per process, so the mapping is kept in a
+ *  single file level structure tagged with the fd it belongs to.
+ */
+static db_map_t db_map = {-1, NULL, 0};
+
+/*
+ *  Occupancy tracking
  *
+ *  Slot 0 of the database is never used by a student (id 0 means deleted),
+ *  so it holds a db_header_t with the number of live records.  A side file
+ *  (dbFile + DB_BITMAP_SUFFIX) holds one bit per possible student id.  Both
+ *  carry a generation number: an update first stamps the bitmap file with
+ *  the next generation, then writes the record and its bitmap word, and
+ *  commits by writing the header with that generation.  If the two ever
+ *  disagree an update was interrupted, and open_db() rebuilds both with a
+ *  full scan.
  */
-int open_db(char *dbFile, bool should_truncate)
-{
-    // Set permissions: rw-rw----
-    // see sys/stat.h for constants
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+static db_occ_t db_occ = {-1, -1};
 
-    // open the file if it exists for Read and Write,
-    // create it if it does not exist
-    int flags = O_RDWR | O_CREAT;
+/*
+ *  Paged layout
+ *
+ *  A database created with SDB_LAYOUT=paged does not keep student id at
+ *  offset id * 64.  Its file is a heap of 4KB pages of 64 slots, and a two
+ *  level page directory in a side file (dbFile + DB_DIR_SUFFIX) says which
+ *  page of the file holds logical page id / 64: a root entry for every
+ *  DB_DIR_LEAF_IDS ids names a leaf, and the leaf entry of the page names
+ *  its page in the file and carries its 64 occupancy bits, so the directory
+ *  is also the occupancy bitmap.  Logical page 0 (the header and ids 1 to
+ *  63) is always page 0 of the file.  A lookup is two array reads in the
+ *  mapped directory, and the file only grows when a page gets its first
+ *  student, so ids up to MAX_PAGED_STD_ID cost nothing until they are used.
+ *
+ *  Pages and leaves are only allocated under the header write lock.  A new
+ *  page is written before the entry naming it, so a reader never follows an
+ *  entry to a page that is not there yet.
+ */
+static db_dir_t db_dir = {-1, -1, NULL, 0};
 
-    if (should_truncate)
-        flags += O_TRUNC;
+/*
+ *  Page checksums
+ *
+ *  A side file (dbFile + DB_CRC_SUFFIX) holds a CRC32C of every 4KB page of
+ *  the database file.  Every write to the file goes through
+ *  db_phys_write(), which sums the pages it touched again, so the checksums
+ *  follow adds, deletes, imports and compression one page at a time.  A
+ *  header write commits each change and also stamps the checksum file with
+ *  the database generation.  open_db() rebuilds the sums if that generation
+ *  is behind, like it does for the index.  sdbsc -v reads the whole file
+ *  back and reports every page whose sum no longer matches, which catches
+ *  torn writes and corruption of the data at rest.
+ *
+ *  The sums are seeded with 0 and not inverted, so a page of zeros (a hole
+ *  or a page never written) sums to 0 and needs no entry in the file.
+ */
+static db_crc_t db_crc = {-1, -1};
 
-    // Now open file
-    int fd = open(dbFile, flags, mode);
+/*
+ *  Last name index
+ *
+ *  Lookups by last name use a secondary index file (dbFile + DB_INDEX_SUFFIX)
+ *  holding one db_idx_entry_t per student sorted by last name, first name
+ *  and id, so finding a name is a binary search.  The file is created by
+ *  the first lookup by last name, and from then on add_student() and
+ *  del_student() insert and remove entries in place, import_db() rebuilds
+ *  the whole file once.  The index header is stamped with the database
+ *  generation after every change, and the index is rebuilt with a scan
+ *  when a process opens it behind the database.
+ */
+static db_idx_t db_idx = {-1, -1};
 
-    if (fd == -1)
-    {
-        // Handle the error
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
-    }
+/*
+ *  Side files
+ *
+ *  open_db() creates no side file, it only opens the ones that are there
+ *  already.  The bitmap, the checksums and the snapshot file are created
+ *  by the first change to the database (see lock_change()), and every
+ *  change opens the ones another process created since this one opened the
+ *  database.  So a lookup in a database that was never written leaves no
+ *  file behind.  A database with records but no bitmap, written by an older
+ *  sdbsc, gets one on open since its count can not be trusted without it.
+ *
+ *  An empty database has no side files: any open_db() finds are left over
+ *  from a database that was removed or emptied, and are deleted.  Only a
+ *  log is kept, unless sdbsc -z emptied the database, and replayed.
+ */
+static char db_path[PATH_MAX];
 
-    return fd;
+/*
+ *  Concurrent access
+ *
+ *  Any number of sdbsc processes may have the same database open.  They
+ *  coordinate with open file description (OFD) byte range locks, never with
+ *  a lock on the whole file:
+ *
+ *    - add_student() and del_student() write lock the 64 bytes of the one
+ *      record they change, from the duplicate check through the write, so
+ *      loaders working on different ids run side by side and two writers of
+ *      the same id take turns.  get_student() read locks the record.
+ *    - the header in slot 0 doubles as the lock on the shared metadata.  It
+ *      is write locked only for the few writes that commit a change (record,
+ *      bitmap word, header, index entry), and for bulk operations (import,
+ *      compress, the checks at open) that rewrite that metadata.
+ *    - reports do not lock the database while they run, they read a
+ *      snapshot pinned under a short header write lock (see snap_pin()).
+ *    - every process using the write-ahead log holds a read lock on its
+ *      byte WAL_LOCK_HOLD, and the log is only emptied under a write lock
+ *      on it, so it is never truncated under a process that still appends
+ *      to it.  Appends, and reads of where the log ends, write lock the
+ *      byte WAL_LOCK_APPEND for a moment.
+ *
+ *  Locks are always taken record first and header second, and the log's
+ *  hold byte before the header before its append byte.  A process never
+ *  waits for a record while it holds the header, and one that has record
+ *  locks held by a queued log group commits the group before it waits for
+ *  another record, so processes can not deadlock.
+ */
+
+// milliseconds elapsed since *start
+double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
 }
 
 /*
- *  get_student
+ *  use_mmap_backend
+ *
+ *  returns:  true if the environment selects the mmap storage backend
+ */
+bool use_mmap_backend(void)
+{
+    char *backend = getenv(DB_BACKEND_ENV);
+
+    return backend != NULL && strcmp(backend, DB_BACKEND_MMAP) == 0;
+}
+
+/*
+ *  db_mapped
  *      fd:  linux file descriptor
- *      id:  the student id we are looking forname of the
- *      *s:  a pointer where the located (if found) student data will be
- *           copied
  *
- *  returns:  NO_ERROR       student located and copied into *s
- *            ERR_DB_FILE    database file I/O issue
- *            SRCH_NOT_FOUND student was not located in the database
+ *  returns:  true if fd is served by the mmap backend
+ */
+bool db_mapped(int fd)
+{
+    return fd >= 0 && db_map.fd == fd;
+}
+
+/*
+ *  db_map_open
+ *      fd:  descriptor returned by open()
  *
- *  console:  Does not produce any console I/O used by other functions
+ *  Maps the current contents of the database file.  An empty file is not
+ *  mapped yet, db_map_grow() creates the mapping on the first write.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the file cant be mapped
  */
-int get_student(int fd, int id, student_t *s)
+int db_map_open(int fd)
 {
-    // id not found if not in range
-    if (id < MIN_STD_ID || id > MAX_STD_ID) {
-        return SRCH_NOT_FOUND;
-    }
+    struct stat st;
 
-    // calculate offset and check if valid
-    off_t offset = id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    if (fstat(fd, &st) == -1)
         return ERR_DB_FILE;
-    }
 
-    // read student record and check for error
-    ssize_t bytesRead = read(fd, s, STUDENT_RECORD_SIZE);
-    if (bytesRead == -1) {
-        return SRCH_NOT_FOUND;
-    }
+    db_map.fd = fd;
+    db_map.base = NULL;
+    db_map.len = st.st_size;
 
-    // ensures record is fully read and student ID isn't 0
-    if (bytesRead != STUDENT_RECORD_SIZE || s->id == DELETED_STUDENT_ID) {
-        return SRCH_NOT_FOUND;
+    if (db_map.len == 0)
+        return NO_ERROR;
+
+    db_map.base = mmap(NULL, db_map.len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (db_map.base == MAP_FAILED)
+    {
+        db_map.fd = -1;
+        db_map.base = NULL;
+        db_map.len = 0;
+        return ERR_DB_FILE;
     }
 
+    // scans walk the mapping front to back
+    madvise(db_map.base, db_map.len, MADV_SEQUENTIAL);
     return NO_ERROR;
 }
 
 /*
- *  add_student
- *      fd:     linux file descriptor
- *      id:     student id (range is defined in db.h )
- *      fname:  student first name
- *      lname:  student last name
- *      gpa:    GPA as an integer (range defined in db.h)
- *
- *  Adds a new student to the database.  After calculating the index for the
- *  student, check if there is another student already at that location.  A good
- *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty.
- *
- *  returns:  NO_ERROR       student added to database
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           already exists)
- *
+ *  db_map_check
  *
- *  console:  M_STD_ADDED       on success
- *            M_ERR_DB_ADD_DUP  student already exists
- *            M_ERR_DB_READ     error reading or seeking the database file
- *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *  sdbsc never shortens a file another process has open (see open_db()),
+ *  but something else can, truncate(1) or an older sdbsc running -z, and
+ *  touching a mapped page past the new end of the file raises SIGBUS.  The
+ *  size is checked before the mapping is used and the mapping cut down to
+ *  match, so the records that are gone read as missing.
  *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
  */
-int add_student(int fd, int id, char *fname, char *lname, int gpa)
+static int db_map_check(void)
 {
-    // validate id and gpa are in range
-    if (id < MIN_STD_ID || id > MAX_STD_ID || gpa < MIN_STD_GPA || gpa > MAX_STD_GPA) {
-        return ERR_DB_OP;
-    }
-
-    // check if student already exists using get_student
-    student_t student;
-    if (get_student(fd, id, &student) == NO_ERROR) {
-        printf(M_ERR_DB_ADD_DUP, id);
-        return ERR_DB_OP;
-    }
+    struct stat st;
+    void *base = NULL;
 
-    // create new student record
-    student_t new_student = {id, "", "", gpa};
-    strncpy(new_student.fname, fname, sizeof(new_student.fname) - 1);
-    strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
+    if (fstat(db_map.fd, &st) == -1)
+        return ERR_DB_FILE;
+    if ((size_t)st.st_size >= db_map.len)
+        return NO_ERROR;
 
-    // calculate offset and write the new student record
-    off_t offset = id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1 || write(fd, &new_student, STUDENT_RECORD_SIZE) == -1) {
-        printf(M_ERR_DB_WRITE);
+    if (st.st_size == 0)
+        munmap(db_map.base, db_map.len);
+    else if ((base = mremap(db_map.base, db_map.len, st.st_size, 0)) == MAP_FAILED)
         return ERR_DB_FILE;
-    }
 
-    // success
-    printf(M_STD_ADDED, id);
+    db_map.base = base;
+    db_map.len = st.st_size;
     return NO_ERROR;
 }
 
 /*
- *  del_student
- *      fd:     linux file descriptor
- *      id:     student id to be deleted
- *
- *  Removes a student to the database.  Use the get_student() function to
- *  locate the student to be deleted. If there is a student at that location
- *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
+ *  db_map_grow
+ *      len:     minimum size in bytes the file and mapping must have
+ *      extend:  extend the file if it is shorter than len
  *
- *  returns:  NO_ERROR       student deleted from database
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)
- *
- *
- *  console:  M_STD_DEL_MSG      on success
- *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
- *            M_ERR_DB_READ      error reading or seeking the database file
- *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *  Extends the file with ftruncate() (the new area is a hole, exactly like
+ *  writing past EOF with the rw backend) and remaps it.  Another process
+ *  may have grown the file already, so the mapping always covers the whole
+ *  file and the file is never shortened.
  *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
  */
-int del_student(int fd, int id)
+static int db_map_grow(size_t len, bool extend)
 {
-    //make sure student exists before attempting to delete
-    student_t student;
-    if (get_student(fd, id, &student) != NO_ERROR) {
-        printf(M_STD_NOT_FND_MSG, id);
-        return ERR_DB_OP;
-    }
+    struct stat st;
+    void *base;
 
-    // write empty record where student was
-    off_t offset = id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == 1 || write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == -1) {
-        printf(M_ERR_DB_WRITE);
+    if (len <= db_map.len)
+        return NO_ERROR;
+
+    if (fstat(db_map.fd, &st) == -1)
+        return ERR_DB_FILE;
+    if ((size_t)st.st_size >= len)
+        len = st.st_size;
+    else if (!extend)
+        len = st.st_size;
+    else if (ftruncate(db_map.fd, len) == -1)
         return ERR_DB_FILE;
-    }
 
-    // success
-    printf(M_STD_DEL_MSG, id);
+    if (len <= db_map.len)
+        return NO_ERROR;
+
+    if (db_map.base == NULL)
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, db_map.fd, 0);
+    else
+        base = mremap(db_map.base, db_map.len, len, MREMAP_MAYMOVE);
+
+    if (base == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    db_map.base = base;
+    db_map.len = len;
     return NO_ERROR;
 }
 
 /*
- *  count_db_records
- *      fd:     linux file descriptor
- *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
+ *  db_phys_read / db_phys_write
+ *      fd:   linux file descriptor
+ *      buf:  source or destination of the transfer
+ *      len:  number of bytes
+ *      off:  file offset
  *
- *  returns:  <number>       returns the number of records in db on success
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)
- *
- *
- *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
- *            M_DB_EMPTY       on success if the record count in db is zero
- *            M_ERR_DB_READ    error reading or seeking the database file
- *            M_ERR_DB_WRITE   error writing to db file (adding student)
+ *  Transfers at an offset of the file itself, with whichever backend is
+ *  active.  Reads past the end of the file are short, just like pread().
+ *  While this process has a snapshot pinned, reads return the file as the
+ *  snapshot saw it.
  *
+ *  returns:  bytes transferred, or -1 on an I/O error
  */
-int count_db_records(int fd)
+ssize_t db_phys_read(int fd, void *buf, size_t len, off_t off)
 {
-    student_t student;
-    int count = 0;
+    size_t n = len;
 
-    // iterating through database, increasing counter for every non-empty/deleted student record
-    while (read(fd, &student, STUDENT_RECORD_SIZE) == STUDENT_RECORD_SIZE) {
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            count++;
-        }
+    if (!db_mapped(fd))
+        return snap_overlay(fd, buf, len, off, cache_read(fd, buf, len, off));
+
+    // pick up records other processes wrote past the end of our mapping
+    if (db_map_check() != NO_ERROR ||
+        (off + len > db_map.len && db_map_grow(off + len, false) != NO_ERROR))
+        return -1;
+
+    if ((size_t)off >= db_map.len)
+        n = 0;
+    else if (n > db_map.len - off)
+        n = db_map.len - off;
+
+    memcpy(buf, db_map.base + off, n);
+    return snap_overlay(fd, buf, len, off, n);
+}
+
+// pread() of the file for scan threads, see db_pread_at()
+static ssize_t db_phys_pread(int fd, void *buf, size_t len, off_t off)
+{
+    return snap_overlay(fd, buf, len, off, pread(fd, buf, len, off));
+}
+
+static ssize_t db_phys_write(int fd, const void *buf, size_t len, off_t off)
+{
+    ssize_t n = len;
+
+    // a pinned snapshot keeps a copy of the pages about to change
+    if (snap_save(fd, len, off) != NO_ERROR)
+        return -1;
+
+    cache_begin_write(fd);
+    if (!db_mapped(fd))
+    {
+        n = pwrite(fd, buf, len, off);
     }
+    else if (db_map_check() != NO_ERROR || db_map_grow(off + len, true) != NO_ERROR)
+    {
+        n = -1;
+    }
+    else
+    {
+        memcpy(db_map.base + off, buf, len);
 
-    // reset file position
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
+        // start writeback now, sync_db() waits for it
+        long pg = sysconf(_SC_PAGESIZE);
+        off_t start = off & ~(pg - 1);
+        msync(db_map.base + start, off + len - start, MS_ASYNC);
     }
+    cache_end_write(fd, buf, n, off);
 
-    if (count == 0) {
-        printf(M_DB_EMPTY);
-    } else {
-        printf(M_DB_RECORD_CNT, count);
+    if (n > 0 && crc_update(fd, buf, n, off) != NO_ERROR)
+        return -1;
+    return n;
+}
+
+// CRC32C (Castagnoli) tables for the portable version, slicing by 8
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        crc32c_table[0][i] = c;
     }
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (int t = 1; t < 8; t++)
+            crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^
+                                 crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+    }
+}
 
-    // success
-    return count;
+// portable CRC32C, eight bytes per step through the tables
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xff] ^ crc32c_table[6][(v >> 8) & 0xff] ^
+              crc32c_table[5][(v >> 16) & 0xff] ^ crc32c_table[4][(v >> 24) & 0xff] ^
+              crc32c_table[3][(v >> 32) & 0xff] ^ crc32c_table[2][(v >> 40) & 0xff] ^
+              crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__)
+// CRC32C with the SSE4.2 crc32 instruction, eight bytes per instruction
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c = crc;
+
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    return (uint32_t)c;
 }
+#endif
 
 /*
- *  print_db
- *      fd:     linux file descriptor
- *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
- *
- *     printf(STUDENT_PRINT_HDR_STRING, "ID",
- *                  "FIRST_NAME", "LAST_NAME", "GPA");
- *
- *  then for each valid record encountered print the required output:
+ *  crc32c
+ *      crc:  sum of the bytes before buf, 0 to start
+ *      buf:  bytes to add
+ *      len:  number of bytes
  *
- *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
- *                    student.lname, calculated_gpa_from_student);
- *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
- *
- *  returns:  NO_ERROR       on success
- *            ERR_DB_FILE    database file I/O issue
- *
- *
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_DB_READ    error reading or seeking the database file
+ *  Uses the crc32 instruction when the cpu has SSE4.2 and a table driven
+ *  version otherwise, chosen the first time it is called.
  *
+ *  returns:  the updated sum
  */
-int print_db(int fd)
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
 {
-    student_t student;
-    bool firstRow = true;
+    static uint32_t (*impl)(uint32_t, const unsigned char *, size_t);
 
-    while (read(fd, &student, STUDENT_RECORD_SIZE) == STUDENT_RECORD_SIZE) {
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            if (firstRow) {
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-                firstRow = false; 
-            }
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, student.gpa / 100.0);
+    if (impl == NULL)
+    {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("sse4.2"))
+            impl = crc32c_hw;
+#endif
+        if (impl == NULL)
+        {
+            crc32c_init_table();
+            impl = crc32c_sw;
         }
     }
+    return impl(crc, buf, len);
+}
 
-    // reset file position
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
+// offset of the checksum of page p in the checksum file
+static off_t crc_entry_off(off_t p)
+{
+    return sizeof(db_crc_hdr_t) + p * sizeof(uint32_t);
+}
 
-    // database is empty if first row is never read
-    if (firstRow) {
-        printf(M_DB_EMPTY);
-    }
+// stamp the checksum file with a generation number
+static int write_crc_gen(unsigned long long generation)
+{
+    db_crc_hdr_t ch = {DB_CRC_MAGIC, generation, {0}};
 
+    if (pwrite(db_crc.crc_fd, &ch, sizeof(ch), 0) != sizeof(ch))
+        return ERR_DB_FILE;
     return NO_ERROR;
-    
 }
 
 /*
- *  print_student
+ *  crc_update
+ *      fd:   linux file descriptor
+ *      buf:  the bytes just written at off, or NULL if they have to be read
+ *            back (after a hole was punched)
+ *      len:  number of bytes
+ *      off:  file offset
+ *
+ *  Sums the pages a write touched again.  A page the write covers whole is
+ *  summed straight from buf, the others are read back from the page cache
+ *  the write just went through.  A write of the header is the commit point
+ *  of a change, so it also stamps the checksum file with its generation.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int crc_update(int fd, const void *buf, size_t len, off_t off)
+{
+    unsigned char page[DB_PAGE_SIZE];
+    struct {
+        db_crc_hdr_t ch;
+        uint32_t     sums[CRC_BATCH_PAGES];
+    } out;
+    int n = 0;
+
+    if (fd < 0 || db_crc.fd != fd || len == 0)
+        return NO_ERROR;
+
+    // the stamp goes out with the sum of page 0, they are next to each other
+    const db_header_t *hdr = buf;
+    bool stamp = buf != NULL && off == 0 && len >= sizeof(db_header_t) &&
+                 memcmp(hdr->magic, DB_HEADER_MAGIC, sizeof(hdr->magic)) == 0;
+    if (stamp)
+    {
+        memset(&out.ch, 0, sizeof(out.ch));
+        memcpy(out.ch.magic, DB_CRC_MAGIC, sizeof(out.ch.magic));
+        out.ch.generation = hdr->generation;
+    }
+
+    off_t first = off / DB_PAGE_SIZE;
+    off_t last = (off + len - 1) / DB_PAGE_SIZE;
+    for (off_t p = first; p <= last; p++)
+    {
+        off_t start = p * DB_PAGE_SIZE;
+        const unsigned char *src = page;
+
+        if (buf != NULL && start >= off && start + DB_PAGE_SIZE <= off + (off_t)len)
+        {
+            src = (const unsigned char *)buf + (start - off);
+        }
+        else
+        {
+            ssize_t got = db_phys_read(fd, page, DB_PAGE_SIZE, start);
+            if (got == -1)
+                return ERR_DB_FILE;
+            memset(page + got, 0, DB_PAGE_SIZE - got);
+        }
+
+        out.sums[n++] = crc32c(0, src, DB_PAGE_SIZE);
+        if (n < CRC_BATCH_PAGES && p < last)
+            continue;
+
+        off_t batch = p - n + 1;
+        size_t bytes = n * sizeof(uint32_t);
+        ssize_t done = batch == 0 && stamp
+            ? pwrite(db_crc.crc_fd, &out, sizeof(out.ch) + bytes, 0) - (ssize_t)sizeof(out.ch)
+            : pwrite(db_crc.crc_fd, out.sums, bytes, crc_entry_off(batch));
+        if (done != (ssize_t)bytes)
+            return ERR_DB_FILE;
+        n = 0;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_paged
+ *      fd:  linux file descriptor
+ *
+ *  returns:  true if fd is a database with the paged layout
+ */
+bool db_paged(int fd)
+{
+    return fd >= 0 && db_dir.fd == fd;
+}
+
+/*
+ *  max_std_id
+ *
+ *  returns:  the largest student id the open database can hold
+ */
+int max_std_id(void)
+{
+    return db_dir.base != NULL ? MAX_PAGED_STD_ID : MAX_STD_ID;
+}
+
+// header of the mapped directory
+static db_dir_hdr_t *dir_hdr(void)
+{
+    return (db_dir_hdr_t *)db_dir.base;
+}
+
+// root entry r, the number of its leaf counting from 1
+static unsigned int *dir_root(unsigned int r)
+{
+    return (unsigned int *)(db_dir.base + DIR_ROOT_OFF) + r;
+}
+
+/*
+ *  dir_map_grow
+ *      len:  minimum size in bytes the directory file and mapping must have
+ *
+ *  Extends the directory file if it is shorter than len and remaps it, also
+ *  picking up leaves other processes added.  Like db_map_grow() the mapping
+ *  always covers the whole file.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int dir_map_grow(size_t len)
+{
+    struct stat st;
+    void *base;
+
+    if (fstat(db_dir.dir_fd, &st) == -1)
+        return ERR_DB_FILE;
+    if ((size_t)st.st_size > len)
+        len = st.st_size;
+    else if ((size_t)st.st_size < len && ftruncate(db_dir.dir_fd, len) == -1)
+        return ERR_DB_FILE;
+
+    if (len <= db_dir.len)
+        return NO_ERROR;
+
+    if (db_dir.base == NULL)
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, db_dir.dir_fd, 0);
+    else
+        base = mremap(db_dir.base, db_dir.len, len, MREMAP_MAYMOVE);
+
+    if (base == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    db_dir.base = base;
+    db_dir.len = len;
+    return NO_ERROR;
+}
+
+/*
+ *  dir_entry
+ *      page:    logical page, id / DB_PAGE_RECS
+ *      create:  give the page a leaf if it has none
+ *
+ *  The entries of a leaf are contiguous, so the entry of the first page of
+ *  a leaf is also the whole leaf.  Creating a leaf may move the mapping,
+ *  entries returned earlier must not be used after it.
+ *
+ *  returns:  the directory entry of page, NULL if it has no leaf and create
+ *            is false, or the leaf could not be created
+ */
+static db_dir_entry_t *dir_entry(unsigned int page, bool create)
+{
+    unsigned int r = page / DB_DIR_LEAF_ENTRIES;
+    unsigned int leaf = *dir_root(r);
+
+    if (leaf == 0)
+    {
+        if (!create)
+            return NULL;
+
+        // the new leaf is zero filled by ftruncate() before the root names it
+        leaf = dir_hdr()->nleaves + 1;
+        if (dir_map_grow(DIR_LEAF_OFF + (size_t)leaf * DB_PAGE_SIZE) != NO_ERROR)
+            return NULL;
+        dir_hdr()->nleaves = leaf;
+        *dir_root(r) = leaf;
+    }
+
+    size_t off = DIR_LEAF_OFF + (size_t)(leaf - 1) * DB_PAGE_SIZE;
+    if (off + DB_PAGE_SIZE > db_dir.len && dir_map_grow(off + DB_PAGE_SIZE) != NO_ERROR)
+        return NULL;
+
+    return (db_dir_entry_t *)(db_dir.base + off) + page % DB_DIR_LEAF_ENTRIES;
+}
+
+// file offset of logical offset off, -1 if its page has not been allocated
+off_t dir_phys(off_t off)
+{
+    unsigned int page = off / DB_PAGE_SIZE;
+
+    if (page == 0)
+        return off;
+
+    db_dir_entry_t *e = dir_entry(page, false);
+    if (e == NULL || e->page == 0)
+        return -1;
+    return (off_t)e->page * DB_PAGE_SIZE + off % DB_PAGE_SIZE;
+}
+
+/*
+ *  dir_next_page
+ *      page:  first logical page to consider
+ *
+ *  Missing leaves are skipped whole.
+ *
+ *  returns:  the first allocated logical page >= page, -1 if there is none
+ */
+static long long dir_next_page(long long page)
+{
+    if (page == 0)
+        return 0;
+
+    while (page / DB_DIR_LEAF_ENTRIES < DB_DIR_ROOT_ENTRIES)
+    {
+        db_dir_entry_t *e = dir_entry(page, false);
+
+        if (e == NULL)
+            page = (page / DB_DIR_LEAF_ENTRIES + 1) * DB_DIR_LEAF_ENTRIES;
+        else if (e->page != 0)
+            return page;
+        else
+            page++;
+    }
+    return -1;
+}
+
+/*
+ *  dir_read
+ *      fd, buf, len, off:  as for db_read_at(), off is a logical offset
+ *      threaded:           called from a scan thread, see db_pread_at()
+ *
+ *  Pages that follow each other in the file too are read with one call.
+ *  Pages that were never allocated, and the part of a page past the end
+ *  of the file, read as zeros.
+ *
+ *  returns:  bytes read, or -1 on an I/O error
+ */
+static ssize_t dir_read(int fd, void *buf, size_t len, off_t off, bool threaded)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        off_t pos = off + done;
+        off_t phys = dir_phys(pos);
+        size_t n = DB_PAGE_SIZE - pos % DB_PAGE_SIZE;
+
+        while (phys != -1 && n < len - done && dir_phys(pos + n) == phys + (off_t)n)
+            n += DB_PAGE_SIZE;
+        if (n > len - done)
+            n = len - done;
+
+        if (phys == -1)
+        {
+            memset((char *)buf + done, 0, n);
+            done += n;
+            continue;
+        }
+
+        ssize_t got = threaded ? db_phys_pread(fd, (char *)buf + done, n, phys)
+                               : db_phys_read(fd, (char *)buf + done, n, phys);
+        if (got == -1)
+            return -1;
+
+        // the last page of the file may be short, and logical pages after
+        // this one can live at earlier pages of the file
+        memset((char *)buf + done + got, 0, n - got);
+        done += n;
+    }
+    return done;
+}
+
+/*
+ *  dir_write
+ *      fd, buf, len, off:  as for db_write_at(), off is a logical offset
+ *
+ *  A logical page written for the first time is given the next page at
+ *  the end of the file, and its entry is only set once the data is there.
+ *
+ *  returns:  bytes written, or -1 on an I/O error
+ */
+static ssize_t dir_write(int fd, const void *buf, size_t len, off_t off)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        off_t pos = off + done;
+        off_t phys = dir_phys(pos);
+        size_t n = DB_PAGE_SIZE - pos % DB_PAGE_SIZE;
+
+        if (n > len - done)
+            n = len - done;
+
+        if (phys != -1)
+        {
+            if (db_phys_write(fd, (const char *)buf + done, n, phys) != (ssize_t)n)
+                return -1;
+        }
+        else
+        {
+            unsigned int page = dir_hdr()->npages;
+            db_dir_entry_t *e;
+
+            dir_hdr()->npages = page + 1;
+            phys = (off_t)page * DB_PAGE_SIZE + pos % DB_PAGE_SIZE;
+            if (db_phys_write(fd, (const char *)buf + done, n, phys) != (ssize_t)n)
+                return -1;
+            if ((e = dir_entry(pos / DB_PAGE_SIZE, true)) == NULL)
+                return -1;
+            e->page = page;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/*
+ *  dir_open
+ *      fd:      descriptor of the database just opened
+ *      dbFile:  name of the database file
+ *
+ *  Finds the layout of the database, the one in its header, or for a new
+ *  (empty) database the one SDB_LAYOUT asks for.  A paged database gets its
+ *  directory mapped, and a new one has its header written at once so the
+ *  layout is known from then on.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int dir_open(int fd, char *dbFile)
+{
+    char path[PATH_MAX];
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    char *layout = getenv(DB_LAYOUT_ENV);
+    db_header_t hdr;
+    struct stat st;
+
+    int rc = read_db_header(fd, &hdr);
+    if (rc == ERR_DB_FILE || fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    bool fresh = st.st_size == 0;
+    if (fresh ? layout == NULL || strcmp(layout, DB_LAYOUT_PAGED_NAME) != 0
+              : rc != NO_ERROR || hdr.layout != DB_LAYOUT_PAGED)
+        return NO_ERROR;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_DIR_SUFFIX);
+    db_dir.dir_fd = open(path, O_RDWR | O_CREAT | (fresh ? O_TRUNC : 0), mode);
+    if (db_dir.dir_fd == -1)
+        return ERR_DB_FILE;
+    db_dir.fd = fd;
+
+    // the root is a hole until leaves are added
+    if (dir_map_grow(DIR_LEAF_OFF) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_dir_hdr_t *dh = dir_hdr();
+    if (memcmp(dh->magic, DB_DIR_MAGIC, sizeof(dh->magic)) != 0)
+    {
+        // the pages of a paged database can not be found without it
+        if (!fresh)
+            return ERR_DB_FILE;
+        memcpy(dh->magic, DB_DIR_MAGIC, sizeof(dh->magic));
+        dh->npages = 1;
+    }
+
+    // pages written by an update that never reached the directory are
+    // not handed out again
+    if (st.st_size > (off_t)dh->npages * DB_PAGE_SIZE)
+        dh->npages = (st.st_size + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE;
+
+    if (!fresh)
+        return NO_ERROR;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DB_HEADER_MAGIC, sizeof(hdr.magic));
+    hdr.version = DB_HEADER_VERSION;
+    hdr.generation = dh->generation;
+    hdr.layout = DB_LAYOUT_PAGED;
+    return db_write_at(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  dir_close
+ *      fd:  database file descriptor
+ *
+ *  Unmaps and closes the directory that belongs to fd.
+ */
+void dir_close(int fd)
+{
+    if (!db_paged(fd))
+        return;
+
+    if (db_dir.base != NULL)
+        munmap(db_dir.base, db_dir.len);
+    close(db_dir.dir_fd);
+    db_dir.fd = -1;
+    db_dir.dir_fd = -1;
+    db_dir.base = NULL;
+    db_dir.len = 0;
+}
+
+/*
+ *  db_read_at / db_write_at
+ *      fd:   linux file descriptor
+ *      buf:  source or destination of the transfer
+ *      len:  number of bytes
+ *      off:  offset of the slots, id * STUDENT_RECORD_SIZE
+ *
+ *  Low level transfer routines every record operation goes through, so the
+ *  rest of the file does not care which backend or layout is active.  Reads
+ *  past the end of the file are short, just like pread().
+ *
+ *  returns:  bytes transferred, or -1 on an I/O error
+ */
+ssize_t db_read_at(int fd, void *buf, size_t len, off_t off)
+{
+    if (db_paged(fd))
+        return dir_read(fd, buf, len, off, false);
+    return db_phys_read(fd, buf, len, off);
+}
+
+ssize_t db_write_at(int fd, const void *buf, size_t len, off_t off)
+{
+    if (db_paged(fd))
+        return dir_write(fd, buf, len, off);
+    return db_phys_write(fd, buf, len, off);
+}
+
+/*
+ *  db_peek_at
+ *      fd, buf, len, off:  as for db_read_at()
+ *
+ *  db_read_at() served by the page cache alone, see cache_peek().
+ *
+ *  returns:  bytes read, or -1 if the page is not cached
+ */
+static ssize_t db_peek_at(int fd, void *buf, size_t len, off_t off)
+{
+    off_t phys = db_paged(fd) ? dir_phys(off) : off;
+
+    return phys == -1 ? -1 : cache_peek(fd, buf, len, phys);
+}
+
+/*
+ *  db_pread_at
+ *      fd, buf, len, off:  as for db_read_at()
+ *
+ *  db_read_at() for scan threads: it reads with pread() and never moves a
+ *  mapping, so threads can call it side by side.  The directory leaves of
+ *  the slots read must be mapped already, load_occupancy() maps them all.
+ *
+ *  returns:  bytes read, or -1 on an I/O error
+ */
+ssize_t db_pread_at(int fd, void *buf, size_t len, off_t off)
+{
+    if (db_paged(fd))
+        return dir_read(fd, buf, len, off, true);
+    return db_phys_pread(fd, buf, len, off);
+}
+
+/*
+ *  sync_db
+ *      fd:  linux file descriptor
+ *
+ *  Durability point: returns once all updates made through fd are on disk.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int sync_db(int fd)
+{
+    if (db_paged(fd) && msync(db_dir.base, db_dir.len, MS_SYNC) == -1)
+        return ERR_DB_FILE;
+
+    if (db_mapped(fd))
+    {
+        if (db_map_check() != NO_ERROR)
+            return ERR_DB_FILE;
+        if (db_map.base != NULL && msync(db_map.base, db_map.len, MS_SYNC) == -1)
+            return ERR_DB_FILE;
+        return NO_ERROR;
+    }
+
+    return fsync(fd) == -1 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  close_db
+ *      fd:  descriptor returned by open_db()
+ *
+ *  Flushes and tears down the mmap backend (if it is active) then closes
+ *  the file.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the final sync failed
+ */
+int close_db(int fd)
+{
+    int rc = NO_ERROR;
+
+    if (wal_close(fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    occ_close(fd);
+    idx_close(fd);
+    col_close(fd);
+    crc_close(fd);
+
+    if (db_mapped(fd))
+    {
+        if (sync_db(fd) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        if (db_map.base != NULL)
+            munmap(db_map.base, db_map.len);
+        db_map.fd = -1;
+        db_map.base = NULL;
+        db_map.len = 0;
+    }
+    cache_close(fd);
+    snap_close(fd);
+    dir_close(fd);
+    uring_close(fd);
+
+    close(fd);
+    return rc;
+}
+
+/*
+ *  Sequential scans
+ *
+ *  A database file is mostly holes when ids are sparse, for example the five
+ *  students of testload.sh give a 6.4MB file with a few KB of data.  The scan
+ *  iterator asks the file system where the data is with lseek(SEEK_DATA) and
+ *  lseek(SEEK_HOLE), and reads each data extent in blocks of OCC_SCAN_RECS
+ *  records, so a scan costs time in proportion to the allocated data and not
+ *  to the id range.  With the mmap backend the blocks point straight into
+ *  the mapping instead of being copied.
+ *
+ *      db_scan_t scan;
+ *      student_t *s;
+ *
+ *      db_scan_open(&scan, fd);
+ *      while ((s = db_scan_next(&scan)) != NULL)
+ *          ...
+ *      db_scan_close(&scan);   // scan.err tells an error from the end
+ */
+
+/*
+ *  db_scan_open
+ *      *sc:  iterator to initialize
+ *      fd:   linux file descriptor
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the block buffer cant be
+ *            allocated
+ */
+int db_scan_open(db_scan_t *sc, int fd)
+{
+    memset(sc, 0, sizeof(*sc));
+    sc->fd = fd;
+
+    // slot 0 is the header, the scan starts at the first student slot
+    sc->pos = STUDENT_RECORD_SIZE;
+    sc->extent_end = sc->pos;
+    sc->err = NO_ERROR;
+
+    sc->buf = malloc(OCC_SCAN_RECS * STUDENT_RECORD_SIZE);
+    return sc->buf == NULL ? ERR_DB_FILE : NO_ERROR;
+}
+
+// db_scan_block() of a paged database, reads runs of allocated pages
+static int dir_scan_block(db_scan_t *sc)
+{
+    off_t max = (off_t)OCC_SCAN_RECS * STUDENT_RECORD_SIZE;
+    long long page = dir_next_page(sc->pos / DB_PAGE_SIZE);
+
+    if (page < 0)
+        return 0;
+
+    off_t start = page * DB_PAGE_SIZE > sc->pos ? page * DB_PAGE_SIZE : sc->pos;
+    off_t end = (page + 1) * DB_PAGE_SIZE;
+    while (end - start < max && dir_phys(end) != -1)
+        end += DB_PAGE_SIZE;
+    if (end - start > max)
+        end = start + max;
+
+    ssize_t n = dir_read(sc->fd, sc->buf, end - start, start, false);
+    if (n == -1)
+        return ERR_DB_FILE;
+    n = n / STUDENT_RECORD_SIZE * STUDENT_RECORD_SIZE;
+    if (n == 0)
+        return 0;
+
+    sc->blk = sc->buf;
+    sc->first_id = start / STUDENT_RECORD_SIZE;
+    sc->nrecs = n / STUDENT_RECORD_SIZE;
+    sc->next = 0;
+    sc->pos = start + n;
+    return sc->nrecs;
+}
+
+/*
+ *  db_scan_block
+ *      *sc:  scan iterator
+ *
+ *  Loads the next block of slots, moving on to the next data extent when
+ *  the current one is used up.  The block is sc->blk[0 .. sc->nrecs-1] and
+ *  its first slot is id sc->first_id; it can include empty slots.
+ *
+ *  returns:  number of slots in the block, 0 at the end of the file,
+ *            ERR_DB_FILE on I/O errors
+ */
+int db_scan_block(db_scan_t *sc)
+{
+    if (db_paged(sc->fd))
+        return dir_scan_block(sc);
+
+    if (sc->pos >= sc->extent_end)
+    {
+        off_t data = lseek(sc->fd, sc->pos, SEEK_DATA);
+        if (data == -1)
+            return errno == ENXIO ? 0 : ERR_DB_FILE;
+
+        off_t hole = lseek(sc->fd, data, SEEK_HOLE);
+        if (hole == -1)
+            return ERR_DB_FILE;
+
+        sc->pos = data / STUDENT_RECORD_SIZE * STUDENT_RECORD_SIZE;
+        sc->extent_end = hole;
+    }
+
+    off_t len = sc->extent_end - sc->pos;
+    if (len > OCC_SCAN_RECS * STUDENT_RECORD_SIZE)
+        len = OCC_SCAN_RECS * STUDENT_RECORD_SIZE;
+    len = len / STUDENT_RECORD_SIZE * STUDENT_RECORD_SIZE;
+    if (len == 0)
+        return 0;
+
+    if (db_mapped(sc->fd) && db_map_check() == NO_ERROR && sc->pos + len <= (off_t)db_map.len)
+    {
+        sc->blk = (student_t *)(db_map.base + sc->pos);
+    }
+    else
+    {
+        ssize_t n = db_read_at(sc->fd, sc->buf, len, sc->pos);
+        if (n == -1)
+            return ERR_DB_FILE;
+        len = n / STUDENT_RECORD_SIZE * STUDENT_RECORD_SIZE;
+        if (len == 0)
+            return 0;
+        sc->blk = sc->buf;
+    }
+
+    sc->first_id = sc->pos / STUDENT_RECORD_SIZE;
+    sc->nrecs = len / STUDENT_RECORD_SIZE;
+    sc->next = 0;
+    sc->pos += len;
+    return sc->nrecs;
+}
+
+/*
+ *  db_scan_next
+ *      *sc:  scan iterator
+ *
+ *  returns:  the next slot holding a student, in id order, or NULL at the
+ *            end of the database or on error (sc->err is set to ERR_DB_FILE)
+ */
+student_t *db_scan_next(db_scan_t *sc)
+{
+    for (;;)
+    {
+        while (sc->next < sc->nrecs)
+        {
+            student_t *s = &sc->blk[sc->next++];
+            if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
+                return s;
+        }
+
+        int rc = db_scan_block(sc);
+        if (rc <= 0)
+        {
+            sc->err = rc < 0 ? rc : NO_ERROR;
+            sc->nrecs = 0;
+            return NULL;
+        }
+    }
+}
+
+/*
+ *  db_scan_id
+ *      *sc:  scan iterator
+ *
+ *  returns:  the slot (student id) of the record db_scan_next() returned last
+ */
+int db_scan_id(db_scan_t *sc)
+{
+    return sc->first_id + sc->next - 1;
+}
+
+// releases the block buffer of a scan
+void db_scan_close(db_scan_t *sc)
+{
+    free(sc->buf);
+    sc->buf = NULL;
+    sc->blk = NULL;
+}
+
+/*
+ *  Parallel scans
+ *
+ *  A scan of a big database splits the id range into parts holding about
+ *  the same number of students, by counting bits of the occupancy bitmap.
+ *  A pool of threads takes the parts in turn and reads the occupied runs of
+ *  each with pread(), which keeps no file position so the threads can share
+ *  the descriptor.  A part's block callback formats its rows into the
+ *  part's own buffer or adds to its own statistics, so threads never share
+ *  output.  The caller then merges the parts in id order, giving the same
+ *  output a sequential scan would.
+ *
+ *      db_pscan_t *ps;
+ *
+ *      pscan_open(fd, &ps);        // NULL if one thread will do
+ *      ps->block = pscan_print_block;
+ *      db_pscan(ps);
+ *      db_pscan_output(ps, &out);
+ *      db_pscan_free(ps);
+ */
+
+/*
+ *  pscan_threads
+ *      count:  number of students the scan will read
+ *
+ *  One thread per cpu, but no more than one per PSCAN_MIN_RECS students so
+ *  small databases are scanned without starting threads.  SDB_THREADS
+ *  overrides both.
+ *
+ *  returns:  threads to use, 1 means scan sequentially
+ */
+int pscan_threads(int count)
+{
+    char *env = getenv(DB_THREADS_ENV);
+    long n;
+
+    if (env != NULL) {
+        n = atol(env);
+    } else {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n > count / PSCAN_MIN_RECS)
+            n = count / PSCAN_MIN_RECS;
+    }
+    if (n > PSCAN_MAX_THREADS)
+        n = PSCAN_MAX_THREADS;
+    return n < 1 ? 1 : (int)n;
+}
+
+/*
+ *  pscan_open
+ *      fd:     linux file descriptor
+ *      **pps:  set to a new scan, or NULL if the scan should be sequential
+ *
+ *  Pins a snapshot for a parallel scan and loads its occupancy bitmap, see
+ *  snap_pin().  The snapshot stays pinned until db_pscan_free().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the bitmap could not be read
+ */
+int pscan_open(int fd, db_pscan_t **pps)
+{
+    db_header_t hdr;
+    db_pscan_t *ps;
+
+    *pps = NULL;
+    if (pscan_threads(INT_MAX) == 1)
+        return NO_ERROR;
+
+    ps = calloc(1, sizeof(*ps));
+    if (ps == NULL || (ps->occ = occ_map_new()) == NULL) {
+        db_pscan_free(ps);
+        return ERR_DB_FILE;
+    }
+
+    ps->fd = fd;
+    if (snap_pin(fd, &hdr, ps->occ) != NO_ERROR) {
+        db_pscan_free(ps);
+        return ERR_DB_FILE;
+    }
+
+    ps->count = hdr.count;
+    ps->nthreads = pscan_threads(hdr.count);
+    if (ps->nthreads == 1)
+        db_pscan_free(ps);
+    else
+        *pps = ps;
+    return NO_ERROR;
+}
+
+// reads the occupied runs of one part and hands them to the block callback
+static int pscan_part(db_pscan_t *ps, db_pscan_part_t *part, student_t *blk)
+{
+    int id = next_occupied(ps->occ, part->first_id);
+
+    while (id < part->end_id) {
+        int n = occupied_run(ps->occ, id, OCC_SCAN_RECS);
+        if (n > part->end_id - id)
+            n = part->end_id - id;
+        size_t len = (size_t)n * STUDENT_RECORD_SIZE;
+
+        if (db_pread_at(ps->fd, blk, len, (off_t)id * STUDENT_RECORD_SIZE) != (ssize_t)len)
+            return ERR_DB_FILE;
+        if (ps->block(ps, part, blk, n) != NO_ERROR)
+            return ERR_DB_FILE;
+        id = next_occupied(ps->occ, id + n);
+    }
+    return NO_ERROR;
+}
+
+// thread body, takes parts until there are none left
+static void *pscan_worker(void *arg)
+{
+    db_pscan_t *ps = arg;
+    student_t *blk = malloc(OCC_SCAN_RECS * STUDENT_RECORD_SIZE);
+    int i;
+
+    while ((i = __atomic_fetch_add(&ps->next, 1, __ATOMIC_RELAXED)) < ps->nparts) {
+        ps->parts[i].rc = blk != NULL ? pscan_part(ps, &ps->parts[i], blk) : ERR_DB_FILE;
+    }
+    free(blk);
+    return NULL;
+}
+
+/*
+ *  db_pscan
+ *      *ps:    scan from pscan_open() with its block callback set
+ *
+ *  Splits the ids into parts and runs them on ps->nthreads threads, the
+ *  calling thread being one of them.  If a thread cant be started the ones
+ *  that did take its share.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a part could not be read or ran out of memory
+ */
+int db_pscan(db_pscan_t *ps)
+{
+    pthread_t tids[PSCAN_MAX_THREADS];
+    int nparts = ps->nthreads * PSCAN_PARTS_PER_THREAD;
+    int per = ps->count / nparts + 1;
+    int started = 0;
+    int k = 0, seen = 0;
+
+    // cut a part every per students, on bitmap word boundaries
+    ps->parts[0].first_id = MIN_STD_ID;
+    for (int c = 0; c < ps->occ->nchunks && k < nparts - 1; c++) {
+        const uint64_t *chunk = ps->occ->chunks[c];
+
+        for (int w = 0; chunk != NULL && w < OCC_CHUNK_WORDS && k < nparts - 1; w++) {
+            long long cut = ((long long)c * OCC_CHUNK_WORDS + w + 1) * 64;
+
+            seen += __builtin_popcountll(chunk[w]);
+            if (cut > MAX_PAGED_STD_ID)
+                break;
+            if (seen >= per * (k + 1)) {
+                ps->parts[k].end_id = cut;
+                ps->parts[++k].first_id = cut;
+            }
+        }
+    }
+    ps->parts[k].end_id = OCC_END;
+    ps->nparts = k + 1;
+    for (int i = 0; i < ps->nparts; i++) {
+        ps->parts[i].st.min = MAX_STD_GPA;
+        ps->parts[i].st.max = MIN_STD_GPA;
+    }
+    ps->next = 0;
+
+    while (started < ps->nthreads - 1 &&
+           pthread_create(&tids[started], NULL, pscan_worker, ps) == 0)
+        started++;
+    pscan_worker(ps);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    for (int i = 0; i < ps->nparts; i++) {
+        if (ps->parts[i].rc != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_pscan_output
+ *      *ps:    finished scan
+ *      *out:   output buffer from db_out_open()
+ *
+ *  Writes the rows the parts formatted, in id order, preceded by the
+ *  table header if there are any.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the output could not be written
+ */
+int db_pscan_output(db_pscan_t *ps, db_out_t *out)
+{
+    for (int i = 0; i < ps->nparts; i++) {
+        db_pscan_part_t *part = &ps->parts[i];
+
+        if (part->found == 0)
+            continue;
+        if (out->firstRow && db_out_header(out) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (db_out_write(out, part->out, part->len) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_pscan_free
+ *      *ps:    scan from pscan_open(), may be NULL
+ *
+ *  Unpins the snapshot of the scan and frees it.
+ */
+void db_pscan_free(db_pscan_t *ps)
+{
+    if (ps == NULL)
+        return;
+    if (ps->occ != NULL)
+        snap_unpin(ps->fd);
+    for (int i = 0; i < ps->nparts; i++)
+        free(ps->parts[i].out);
+    occ_map_free(ps->occ);
+    free(ps);
+}
+
+// makes room in a part's output for one more row
+static int pscan_reserve(db_pscan_part_t *part)
+{
+    if (part->len + DB_ROW_MAX <= part->cap)
+        return NO_ERROR;
+
+    size_t cap = part->cap ? part->cap * 2 : DB_OUT_BUF_SZ / 16;
+    char *grown = realloc(part->out, cap);
+    if (grown == NULL)
+        return ERR_DB_FILE;
+    part->out = grown;
+    part->cap = cap;
+    return NO_ERROR;
+}
+
+// print_db() block callback, formats every student of the block
+static int pscan_print_block(db_pscan_t *ps, db_pscan_part_t *part, const student_t *blk, int n)
+{
+    (void)ps;
+    for (int i = 0; i < n; i++) {
+        if (memcmp(&blk[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+            continue;
+        if (pscan_reserve(part) != NO_ERROR)
+            return ERR_DB_FILE;
+        part->len += format_db_row(part->out + part->len, &blk[i]);
+        part->found++;
+    }
+    return NO_ERROR;
+}
+
+// query_gpa_range() block callback, formats the students in the gpa range
+static int pscan_gpa_block(db_pscan_t *ps, db_pscan_part_t *part, const student_t *blk, int n)
+{
+    unsigned char match[OCC_SCAN_RECS];
+
+    if (gpa_filter_block(blk, n, ps->min, ps->max, match) == 0)
+        return NO_ERROR;
+    for (int i = 0; i < n; i++) {
+        if (!match[i])
+            continue;
+        if (pscan_reserve(part) != NO_ERROR)
+            return ERR_DB_FILE;
+        part->len += format_db_row(part->out + part->len, &blk[i]);
+        part->found++;
+    }
+    return NO_ERROR;
+}
+
+// print_gpa_stats() block callback, adds the block to the part's statistics
+static int pscan_stats_block(db_pscan_t *ps, db_pscan_part_t *part, const student_t *blk, int n)
+{
+    (void)ps;
+    gpa_stats_block(blk, n, &part->st);
+    return NO_ERROR;
+}
+
+/*
+ *  occ_map_new / occ_map_free
+ *
+ *  An occupancy map starts empty, chunks are allocated as ids are set.
+ *
+ *  returns:  the new map, NULL if out of memory
+ */
+db_occmap_t *occ_map_new(void)
+{
+    return calloc(1, sizeof(db_occmap_t));
+}
+
+void occ_map_free(db_occmap_t *occ)
+{
+    if (occ == NULL)
+        return;
+    for (int c = 0; c < occ->nchunks; c++)
+        free(occ->chunks[c]);
+    free(occ->chunks);
+    free(occ);
+}
+
+// empties a map so it can be loaded again
+static void occ_map_clear(db_occmap_t *occ)
+{
+    for (int c = 0; c < occ->nchunks; c++)
+    {
+        free(occ->chunks[c]);
+        occ->chunks[c] = NULL;
+    }
+}
+
+/*
+ *  occ_map_word
+ *      *occ:    occupancy map
+ *      page:    id / 64
+ *      create:  allocate the word's chunk if it is missing
+ *
+ *  returns:  the word holding ids page * 64 .. page * 64 + 63, NULL if its
+ *            chunk is missing and create is false, or out of memory
+ */
+uint64_t *occ_map_word(db_occmap_t *occ, int page, bool create)
+{
+    int c = page / OCC_CHUNK_WORDS;
+
+    if (c >= occ->nchunks)
+    {
+        if (!create)
+            return NULL;
+
+        int n = occ->nchunks > 0 ? occ->nchunks : 8;
+        while (n <= c)
+            n *= 2;
+        uint64_t **grown = realloc(occ->chunks, n * sizeof(uint64_t *));
+        if (grown == NULL)
+            return NULL;
+        memset(grown + occ->nchunks, 0, (n - occ->nchunks) * sizeof(uint64_t *));
+        occ->chunks = grown;
+        occ->nchunks = n;
+    }
+
+    if (occ->chunks[c] == NULL)
+    {
+        if (!create)
+            return NULL;
+        occ->chunks[c] = calloc(OCC_CHUNK_WORDS, sizeof(uint64_t));
+        if (occ->chunks[c] == NULL)
+            return NULL;
+    }
+    return &occ->chunks[c][page % OCC_CHUNK_WORDS];
+}
+
+/*
+ *  occ_map_set
+ *      *occ:  occupancy map
+ *      id:    student id to mark occupied
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if out of memory
+ */
+int occ_map_set(db_occmap_t *occ, int id)
+{
+    uint64_t *word = occ_map_word(occ, id / 64, true);
+
+    if (word == NULL)
+        return ERR_DB_FILE;
+    *word |= 1ULL << (id % 64);
+    return NO_ERROR;
+}
+
+/*
+ *  occ_map_test
+ *      *occ:  occupancy map
+ *      id:    student id
+ *
+ *  returns:  true if id is occupied
+ */
+bool occ_map_test(const db_occmap_t *occ, int id)
+{
+    int c = id / 64 / OCC_CHUNK_WORDS;
+
+    if (c >= occ->nchunks || occ->chunks[c] == NULL)
+        return false;
+    return (occ->chunks[c][id / 64 % OCC_CHUNK_WORDS] >> (id % 64)) & 1;
+}
+
+/*
+ *  next_occupied
+ *      *occ:  occupancy map
+ *      id:    first id to consider
+ *
+ *  Missing chunks are skipped whole, so a sparse map is walked in time
+ *  proportional to its chunks.
+ *
+ *  returns:  the first occupied id >= id, or OCC_END if there is none
+ */
+int next_occupied(const db_occmap_t *occ, int id)
+{
+    int page = id / 64;
+    int bit = id % 64;
+
+    while (page / OCC_CHUNK_WORDS < occ->nchunks) {
+        const uint64_t *chunk = occ->chunks[page / OCC_CHUNK_WORDS];
+
+        if (chunk == NULL) {
+            page = (page / OCC_CHUNK_WORDS + 1) * OCC_CHUNK_WORDS;
+            bit = 0;
+            continue;
+        }
+
+        uint64_t word = chunk[page % OCC_CHUNK_WORDS] >> bit;
+        if (word != 0)
+            return page * 64 + bit + __builtin_ctzll(word);
+        page++;
+        bit = 0;
+    }
+    return OCC_END;
+}
+
+/*
+ *  occupied_run
+ *      *occ:  occupancy map
+ *      id:    an occupied id
+ *      max:   longest run wanted
+ *
+ *  returns:  number of consecutive occupied ids starting at id, up to max
+ */
+int occupied_run(const db_occmap_t *occ, int id, int max)
+{
+    int n = 0;
+
+    while (n < max) {
+        int page = (id + n) / 64;
+        int bit = (id + n) % 64;
+        int c = page / OCC_CHUNK_WORDS;
+
+        if (c >= occ->nchunks || occ->chunks[c] == NULL)
+            break;
+
+        uint64_t clear = ~occ->chunks[c][page % OCC_CHUNK_WORDS] >> bit;
+        int len = clear != 0 ? __builtin_ctzll(clear) : 64 - bit;
+        n += len;
+        if (bit + len < 64)
+            break;
+    }
+    return n > max ? max : n;
+}
+
+/*
+ *  read_occupied
+ *      fd:    linux file descriptor
+ *      *occ:  occupancy bitmap of the scan
+ *      *id:   first id to look at, moved past the run that was read
+ *      blk:   room for OCC_SCAN_RECS records
+ *
+ *  Reads the next run of occupied slots with one call, so the scans the
+ *  bitmap drives never read holes or deleted slots.
+ *
+ *  returns:  records read into blk, 0 past the last student, or
+ *            ERR_DB_FILE on I/O errors
+ */
+int read_occupied(int fd, const db_occmap_t *occ, int *id, student_t *blk)
+{
+    int first = next_occupied(occ, *id);
+
+    if (first >= OCC_END)
+        return 0;
+
+    int n = occupied_run(occ, first, OCC_SCAN_RECS);
+    size_t len = (size_t)n * STUDENT_RECORD_SIZE;
+
+    if (db_read_at(fd, blk, len, (off_t)first * STUDENT_RECORD_SIZE) != (ssize_t)len)
+        return ERR_DB_FILE;
+    *id = first + n;
+    return n;
+}
+
+/*
+ *  read_db_header
+ *      fd:    linux file descriptor
+ *      *hdr:  where the header from slot 0 is copied
+ *
+ *  returns:  NO_ERROR       header found
+ *            SRCH_NOT_FOUND slot 0 does not hold a header (empty or old file)
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int read_db_header(int fd, db_header_t *hdr)
+{
+    ssize_t n = db_read_at(fd, hdr, sizeof(db_header_t), 0);
+
+    if (n == -1)
+        return ERR_DB_FILE;
+    if (n != sizeof(db_header_t) || memcmp(hdr->magic, DB_HEADER_MAGIC, sizeof(hdr->magic)) != 0)
+        return SRCH_NOT_FOUND;
+
+    return NO_ERROR;
+}
+
+// stamp the bitmap file with a generation number
+static int write_bitmap_gen(unsigned long long generation)
+{
+    db_bitmap_hdr_t bh = {DB_BITMAP_MAGIC, generation};
+
+    if (pwrite(db_occ.bmp_fd, &bh, sizeof(bh), 0) != sizeof(bh))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  load_occupancy
+ *      fd:    linux file descriptor
+ *      *hdr:  receives the database header
+ *      *occ:  map that receives the occupancy bitmap, or NULL if only the
+ *             header is wanted
+ *
+ *  A database that has never been written has no header yet, it is
+ *  reported as empty.  The bitmap of a paged database is collected from
+ *  its directory.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int load_occupancy(int fd, db_header_t *hdr, db_occmap_t *occ)
+{
+    int rc = read_db_header(fd, hdr);
+
+    if (rc == ERR_DB_FILE)
+        return rc;
+    if (rc == SRCH_NOT_FOUND)
+    {
+        memset(hdr, 0, sizeof(*hdr));
+        memcpy(hdr->magic, DB_HEADER_MAGIC, sizeof(hdr->magic));
+        hdr->version = DB_HEADER_VERSION;
+        hdr->layout = db_paged(fd) ? DB_LAYOUT_PAGED : DB_LAYOUT_DIRECT;
+    }
+
+    if (occ == NULL)
+        return NO_ERROR;
+    occ_map_clear(occ);
+
+    if (db_paged(fd))
+    {
+        for (unsigned int r = 0; r < DB_DIR_ROOT_ENTRIES; r++)
+        {
+            if (*dir_root(r) == 0)
+                continue;
+
+            db_dir_entry_t *leaf = dir_entry(r * DB_DIR_LEAF_ENTRIES, false);
+            if (leaf == NULL)
+                return ERR_DB_FILE;
+            for (int i = 0; i < DB_DIR_LEAF_ENTRIES; i++)
+            {
+                if (leaf[i].occupied == 0)
+                    continue;
+                uint64_t *word = occ_map_word(occ, r * DB_DIR_LEAF_ENTRIES + i, true);
+                if (word == NULL)
+                    return ERR_DB_FILE;
+                *word = leaf[i].occupied;
+            }
+        }
+        return NO_ERROR;
+    }
+
+    // a database without a bitmap file has no students yet
+    if (db_occ.fd != fd)
+        return NO_ERROR;
+
+    // read a chunk at a time, a short read means the tail of the bitmap
+    // was never written
+    for (int w = 0; w < DB_BITMAP_WORDS; w += OCC_CHUNK_WORDS)
+    {
+        uint64_t words[OCC_CHUNK_WORDS];
+        size_t len = sizeof(words);
+        if (w + OCC_CHUNK_WORDS > DB_BITMAP_WORDS)
+            len = (DB_BITMAP_WORDS - w) * sizeof(uint64_t);
+
+        ssize_t n = pread(db_occ.bmp_fd, words, len, sizeof(db_bitmap_hdr_t) + w * sizeof(uint64_t));
+        if (n == -1)
+            return ERR_DB_FILE;
+        if (n == 0)
+            break;
+
+        for (int i = 0; i < (int)(n / sizeof(uint64_t)); i++)
+        {
+            if (words[i] == 0)
+                continue;
+            uint64_t *word = occ_map_word(occ, w + i, true);
+            if (word == NULL)
+                return ERR_DB_FILE;
+            *word = words[i];
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  begin_occupancy_update
+ *      *hdr:  current header, its generation is advanced
+ *
+ *  Stamps the bitmap file (or the directory of a paged database) with the
+ *  next generation so an update that does not reach store_occupancy() or
+ *  the header write is detected on open.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int begin_occupancy_update(db_header_t *hdr)
+{
+    hdr->generation++;
+    if (db_dir.base != NULL)
+    {
+        dir_hdr()->generation = hdr->generation;
+        return NO_ERROR;
+    }
+    return write_bitmap_gen(hdr->generation);
+}
+
+/*
+ *  store_occupancy
+ *      fd:    linux file descriptor
+ *      *hdr:  header to commit
+ *      *occ:  complete bitmap to write
+ *
+ *  Writes a whole bitmap and then commits the header, used after bulk
+ *  changes started with begin_occupancy_update().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int store_occupancy(int fd, db_header_t *hdr, db_occmap_t *occ)
+{
+    if (db_paged(fd))
+    {
+        // the bits go in the entries of the pages, page 0 may not have a
+        // leaf yet since it is never allocated
+        for (unsigned int r = 0; r < DB_DIR_ROOT_ENTRIES; r++)
+        {
+            bool bits = (int)r < occ->nchunks && occ->chunks[r] != NULL;
+            if (*dir_root(r) == 0 && !bits)
+                continue;
+
+            db_dir_entry_t *leaf = dir_entry(r * DB_DIR_LEAF_ENTRIES, bits);
+            if (leaf == NULL)
+                return ERR_DB_FILE;
+            for (int i = 0; i < DB_DIR_LEAF_ENTRIES; i++)
+            {
+                uint64_t *word = occ_map_word(occ, r * DB_DIR_LEAF_ENTRIES + i, false);
+                leaf[i].occupied = word != NULL ? *word : 0;
+            }
+        }
+    }
+    else
+    {
+        for (int w = 0; w < DB_BITMAP_WORDS; w += OCC_CHUNK_WORDS)
+        {
+            static const uint64_t zeros[OCC_CHUNK_WORDS];
+            const uint64_t *words = occ_map_word(occ, w, false);
+            size_t len = OCC_CHUNK_WORDS * sizeof(uint64_t);
+            if (w + OCC_CHUNK_WORDS > DB_BITMAP_WORDS)
+                len = (DB_BITMAP_WORDS - w) * sizeof(uint64_t);
+
+            if (pwrite(db_occ.bmp_fd, words != NULL ? words : zeros, len,
+                       sizeof(db_bitmap_hdr_t) + w * sizeof(uint64_t)) != (ssize_t)len)
+                return ERR_DB_FILE;
+        }
+    }
+
+    if (db_write_at(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr))
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  rebuild_occupancy
+ *      fd:  linux file descriptor
+ *
+ *  Recomputes the header count and the bitmap from the records themselves.
+ *
+ *  returns:  number of live records, or ERR_DB_FILE on I/O errors
+ */
+int rebuild_occupancy(int fd)
+{
+    db_header_t hdr;
+    db_scan_t scan;
+    db_occmap_t *occ = occ_map_new();
+    int rc = ERR_DB_FILE;
+
+    if (db_scan_open(&scan, fd) != NO_ERROR)
+    {
+        occ_map_free(occ);
+        return ERR_DB_FILE;
+    }
+    if (occ == NULL)
+        goto done;
+    if (read_db_header(fd, &hdr) == ERR_DB_FILE)
+        goto done;
+
+    // keep the generation, the log state and the side files across rebuilds
+    db_header_t old = {0};
+    if (memcmp(hdr.magic, DB_HEADER_MAGIC, sizeof(hdr.magic)) == 0)
+        old = hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DB_HEADER_MAGIC, sizeof(hdr.magic));
+    hdr.version = DB_HEADER_VERSION;
+    hdr.generation = old.generation;
+    hdr.wal_log = old.wal_log;
+    hdr.wal_floor = old.wal_floor;
+    hdr.side_files = old.side_files;
+    hdr.layout = db_paged(fd) ? DB_LAYOUT_PAGED : DB_LAYOUT_DIRECT;
+
+    // only the allocated extents of the file are read
+    student_t *s;
+    while ((s = db_scan_next(&scan)) != NULL)
+    {
+        int id = db_scan_id(&scan);
+        if (id >= MIN_STD_ID && id <= max_std_id())
+        {
+            if (occ_map_set(occ, id) != NO_ERROR)
+                goto done;
+            hdr.count++;
+        }
+    }
+    if (scan.err != NO_ERROR)
+        goto done;
+
+    if (begin_occupancy_update(&hdr) == NO_ERROR &&
+        store_occupancy(fd, &hdr, occ) == NO_ERROR)
+        rc = hdr.count;
+
+done:
+    occ_map_free(occ);
+    db_scan_close(&scan);
+    return rc;
+}
+
+/*
+ *  update_occupancy
+ *      fd:        linux file descriptor
+ *      id:        student whose slot changed
+ *      occupied:  true if the slot now holds a student
+ *      *rec:      record to write into the slot
+ *
+ *  Writes a record and keeps the bitmap and the header count in step with
+ *  it, following the generation protocol described above.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int update_occupancy(int fd, int id, bool occupied, const student_t *rec)
+{
+    db_header_t hdr;
+    uint64_t word = 0;
+    off_t word_off = sizeof(db_bitmap_hdr_t) + (off_t)(id / 64) * sizeof(uint64_t);
+
+    if (load_occupancy(fd, &hdr, NULL) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // mark the update as in progress
+    if (begin_occupancy_update(&hdr) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (db_write_at(fd, rec, STUDENT_RECORD_SIZE, (off_t)id * STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+
+    // the word of a paged database is in the page's directory entry
+    db_dir_entry_t *e = NULL;
+    if (db_paged(fd))
+    {
+        if ((e = dir_entry(id / DB_PAGE_RECS, true)) == NULL)
+            return ERR_DB_FILE;
+        word = e->occupied;
+    }
+    else if (pread(db_occ.bmp_fd, &word, sizeof(word), word_off) == -1)
+        return ERR_DB_FILE;
+
+    bool was_occupied = (word >> (id % 64)) & 1;
+    if (occupied)
+        word |= 1ULL << (id % 64);
+    else
+        word &= ~(1ULL << (id % 64));
+
+    if (e != NULL)
+        e->occupied = word;
+    else if (pwrite(db_occ.bmp_fd, &word, sizeof(word), word_off) != sizeof(word))
+        return ERR_DB_FILE;
+
+    hdr.count += (int)occupied - (int)was_occupied;
+
+    // commit
+    if (db_write_at(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  occ_open
+ *      fd:      linux file descriptor, the caller holds the header write lock
+ *      dbFile:  name of the database file
+ *      create:  create the bitmap even if the database is still empty
+ *
+ *  Opens the bitmap side file and checks it against the header, rebuilding
+ *  both if the database was written by an older sdbsc or an update was
+ *  interrupted.  A database with records always gets a bitmap.  A paged
+ *  database keeps its bitmap and generation in the directory instead,
+ *  dir_open() must have run first.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int occ_open(int fd, char *dbFile, bool create)
+{
+    char path[PATH_MAX];
+    db_header_t hdr;
+    db_bitmap_hdr_t bh;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    struct stat st;
+
+    if (db_paged(fd))
+    {
+        int rc = read_db_header(fd, &hdr);
+        if (rc == ERR_DB_FILE)
+            return rc;
+        if ((rc != NO_ERROR || hdr.generation != dir_hdr()->generation) &&
+            rebuild_occupancy(fd) < 0)
+            return ERR_DB_FILE;
+
+        // checked, there is no bitmap file to open
+        db_occ.fd = fd;
+        return NO_ERROR;
+    }
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_BITMAP_SUFFIX);
+    db_occ.bmp_fd = open(path, O_RDWR | (create || st.st_size > 0 ? O_CREAT : 0), mode);
+    if (db_occ.bmp_fd == -1)
+        return errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+    db_occ.fd = fd;
+
+    // nothing to check until the first student is written
+    if (st.st_size == 0)
+        return NO_ERROR;
+
+    int rc = read_db_header(fd, &hdr);
+    if (rc == ERR_DB_FILE)
+        return rc;
+
+    ssize_t n = pread(db_occ.bmp_fd, &bh, sizeof(bh), 0);
+    if (rc == NO_ERROR && n == sizeof(bh) &&
+        memcmp(bh.magic, DB_BITMAP_MAGIC, sizeof(bh.magic)) == 0 &&
+        bh.generation == hdr.generation)
+        return NO_ERROR;
+
+    return rebuild_occupancy(fd) < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  occ_close
+ *      fd:  database file descriptor
+ *
+ *  Closes the bitmap side file that belongs to fd.
+ */
+void occ_close(int fd)
+{
+    if (db_occ.fd != fd)
+        return;
+
+    if (db_occ.bmp_fd != -1)
+        close(db_occ.bmp_fd);
+    db_occ.fd = -1;
+    db_occ.bmp_fd = -1;
+}
+
+// orders index entries by last name, first name, then id
+static int cmp_idx_entry(const void *a, const void *b)
+{
+    const db_idx_entry_t *ea = a;
+    const db_idx_entry_t *eb = b;
+    int rc = strncmp(ea->lname, eb->lname, sizeof(ea->lname));
+
+    if (rc == 0)
+        rc = strncmp(ea->fname, eb->fname, sizeof(ea->fname));
+    if (rc == 0 && ea->id != eb->id)
+        rc = ea->id < eb->id ? -1 : 1;
+    return rc;
+}
+
+// builds the index entry of a student
+static void make_idx_entry(const student_t *s, db_idx_entry_t *e)
+{
+    memset(e, 0, sizeof(*e));
+    memcpy(e->lname, s->lname, sizeof(e->lname));
+    memcpy(e->fname, s->fname, sizeof(e->fname));
+    e->id = s->id;
+}
+
+// offset of entry i in the index file
+static off_t idx_entry_off(int i)
+{
+    return sizeof(db_idx_hdr_t) + (off_t)i * sizeof(db_idx_entry_t);
+}
+
+/*
+ *  read_idx_hdr / write_idx_hdr
+ *      *ih:  index file header
+ *
+ *  returns:  NO_ERROR on success, SRCH_NOT_FOUND if the index file has no
+ *            valid header (read only), ERR_DB_FILE on I/O errors
+ */
+static int read_idx_hdr(db_idx_hdr_t *ih)
+{
+    ssize_t n = pread(db_idx.idx_fd, ih, sizeof(*ih), 0);
+
+    if (n == -1)
+        return ERR_DB_FILE;
+    if (n != sizeof(*ih) || memcmp(ih->magic, DB_INDEX_MAGIC, sizeof(ih->magic)) != 0)
+        return SRCH_NOT_FOUND;
+    return NO_ERROR;
+}
+
+static int write_idx_hdr(db_idx_hdr_t *ih)
+{
+    memcpy(ih->magic, DB_INDEX_MAGIC, sizeof(ih->magic));
+    return pwrite(db_idx.idx_fd, ih, sizeof(*ih), 0) == sizeof(*ih) ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  idx_search
+ *      *key:   entry to look for, only the last name is compared if
+ *              lname_only is set
+ *      count:  number of entries in the index
+ *      *pos:   receives the position of the first entry >= key
+ *
+ *  Binary search over the index file, one pread() per probe.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int idx_search(const db_idx_entry_t *key, bool lname_only, int count, int *pos)
+{
+    db_idx_entry_t e;
+    int lo = 0, hi = count;
+
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (pread(db_idx.idx_fd, &e, sizeof(e), idx_entry_off(mid)) != sizeof(e))
+            return ERR_DB_FILE;
+
+        int rc = lname_only ? strncmp(e.lname, key->lname, sizeof(e.lname))
+                            : cmp_idx_entry(&e, key);
+        if (rc < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *pos = lo;
+    return NO_ERROR;
+}
+
+/*
+ *  idx_shift
+ *      from:   first entry to move
+ *      count:  number of entries in the index
+ *      delta:  +1 to open a gap at from, -1 to close the gap before from
+ *
+ *  Moves entries from..count-1 by one position.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int idx_shift(int from, int count, int delta)
+{
+    size_t len = (size_t)(count - from) * sizeof(db_idx_entry_t);
+    char *tail;
+    int rc = NO_ERROR;
+
+    if (len == 0)
+        return NO_ERROR;
+
+    tail = malloc(len);
+    if (tail == NULL)
+        return ERR_DB_FILE;
+
+    if (pread(db_idx.idx_fd, tail, len, idx_entry_off(from)) != (ssize_t)len ||
+        pwrite(db_idx.idx_fd, tail, len, idx_entry_off(from + delta)) != (ssize_t)len)
+        rc = ERR_DB_FILE;
+
+    free(tail);
+    return rc;
+}
+
+/*
+ *  idx_update
+ *      fd:      linux file descriptor
+ *      *s:      student added to or removed from the database
+ *      insert:  true to add the entry of s, false to remove it
+ *
+ *  Keeps the index in step with a change add_student() or del_student()
+ *  has just committed, then stamps it with the database generation.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int idx_update(int fd, const student_t *s, bool insert)
+{
+    db_header_t hdr;
+    db_idx_hdr_t ih;
+    db_idx_entry_t key;
+    int pos;
+
+    if (db_idx.fd != fd)
+        return NO_ERROR;
+    if (read_db_header(fd, &hdr) != NO_ERROR || read_idx_hdr(&ih) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    make_idx_entry(s, &key);
+    if (idx_search(&key, false, ih.count, &pos) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (insert)
+    {
+        // a replayed log record may already be indexed
+        db_idx_entry_t e;
+        if (pos < ih.count &&
+            pread(db_idx.idx_fd, &e, sizeof(e), idx_entry_off(pos)) == sizeof(e) &&
+            cmp_idx_entry(&e, &key) == 0)
+            return NO_ERROR;
+
+        if (idx_shift(pos, ih.count, 1) != NO_ERROR ||
+            pwrite(db_idx.idx_fd, &key, sizeof(key), idx_entry_off(pos)) != sizeof(key))
+            return ERR_DB_FILE;
+        ih.count++;
+    }
+    else if (pos < ih.count)
+    {
+        // and a replayed delete may already be gone from it
+        db_idx_entry_t e;
+        if (pread(db_idx.idx_fd, &e, sizeof(e), idx_entry_off(pos)) != sizeof(e))
+            return ERR_DB_FILE;
+        if (cmp_idx_entry(&e, &key) == 0)
+        {
+            if (idx_shift(pos + 1, ih.count, -1) != NO_ERROR)
+                return ERR_DB_FILE;
+            ih.count--;
+            if (ftruncate(db_idx.idx_fd, idx_entry_off(ih.count)) == -1)
+                return ERR_DB_FILE;
+        }
+    }
+
+    ih.generation = hdr.generation;
+    return write_idx_hdr(&ih);
+}
+
+/*
+ *  rebuild_name_index
+ *      fd:  linux file descriptor
+ *
+ *  Rebuilds the whole index from a scan of the database: the entries are
+ *  collected, sorted and written with a single write.
+ *
+ *  returns:  number of entries on success, ERR_DB_FILE on failure
+ */
+int rebuild_name_index(int fd)
+{
+    db_header_t hdr;
+    db_idx_hdr_t ih = {0};
+    db_scan_t scan;
+    db_idx_entry_t *entries = NULL;
+    student_t *s;
+    int count = 0, cap = 0;
+    int rc = ERR_DB_FILE;
+
+    if (db_idx.fd != fd)
+        return NO_ERROR;
+    if (read_db_header(fd, &hdr) != NO_ERROR)
+        memset(&hdr, 0, sizeof(hdr));
+    if (db_scan_open(&scan, fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    while ((s = db_scan_next(&scan)) != NULL)
+    {
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : IMPORT_INIT_ROWS;
+            db_idx_entry_t *grown = realloc(entries, cap * sizeof(db_idx_entry_t));
+            if (grown == NULL)
+                goto done;
+            entries = grown;
+        }
+        make_idx_entry(s, &entries[count++]);
+    }
+    if (scan.err != NO_ERROR)
+        goto done;
+
+    qsort(entries, count, sizeof(db_idx_entry_t), cmp_idx_entry);
+
+    size_t len = (size_t)count * sizeof(db_idx_entry_t);
+    ih.count = count;
+    ih.generation = hdr.generation;
+    if (ftruncate(db_idx.idx_fd, idx_entry_off(count)) == -1 ||
+        (len > 0 && pwrite(db_idx.idx_fd, entries, len, idx_entry_off(0)) != (ssize_t)len) ||
+        write_idx_hdr(&ih) != NO_ERROR)
+        goto done;
+
+    rc = count;
+
+done:
+    free(entries);
+    db_scan_close(&scan);
+    return rc;
+}
+
+/*
+ *  idx_open
+ *      fd:      linux file descriptor, the caller holds the header write lock
+ *      dbFile:  name of the database file
+ *
+ *  Opens the index file, creating it if it is missing, and rebuilds it if
+ *  it is behind the database.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int idx_open(int fd, char *dbFile)
+{
+    char path[PATH_MAX];
+    db_header_t hdr;
+    db_idx_hdr_t ih;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_INDEX_SUFFIX);
+    db_idx.idx_fd = open(path, O_RDWR | O_CREAT, mode);
+    if (db_idx.idx_fd == -1)
+        return ERR_DB_FILE;
+    db_idx.fd = fd;
+
+    int rc = read_db_header(fd, &hdr);
+    if (rc == ERR_DB_FILE)
+        return rc;
+    if (rc == SRCH_NOT_FOUND)
+        memset(&hdr, 0, sizeof(hdr));
+
+    rc = read_idx_hdr(&ih);
+    if (rc == NO_ERROR && ih.generation == hdr.generation)
+        return NO_ERROR;
+    if (rc == ERR_DB_FILE)
+        return rc;
+
+    return rebuild_name_index(fd) < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+// closes the index file that belongs to fd
+void idx_close(int fd)
+{
+    if (db_idx.fd != fd)
+        return;
+
+    close(db_idx.idx_fd);
+    db_idx.fd = -1;
+    db_idx.idx_fd = -1;
+}
+
+/*
+ *  rebuild_page_crcs
+ *      fd:  linux file descriptor
+ *
+ *  Sums every page of the database file again.  The checksum file is
+ *  emptied first and only the allocated extents are read, the pages of the
+ *  holes are left without a sum.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int rebuild_page_crcs(int fd)
+{
+    db_header_t hdr;
+    int rc = read_db_header(fd, &hdr);
+
+    if (rc == ERR_DB_FILE || ftruncate(db_crc.crc_fd, 0) == -1)
+        return ERR_DB_FILE;
+    if (rc == SRCH_NOT_FOUND)
+        hdr.generation = 0;
+
+    off_t data = lseek(fd, 0, SEEK_DATA);
+    while (data != -1)
+    {
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1 || crc_update(fd, NULL, hole - data, data) != NO_ERROR)
+            return ERR_DB_FILE;
+        data = lseek(fd, hole, SEEK_DATA);
+    }
+    if (errno != ENXIO)
+        return ERR_DB_FILE;
+
+    return write_crc_gen(hdr.generation);
+}
+
+/*
+ *  crc_open
+ *      fd:      linux file descriptor, the caller holds the header write lock
+ *      dbFile:  name of the database file
+ *
+ *  Opens the checksum file, creating it if it is missing, and sums the
+ *  database again if the file is new or behind the database.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int crc_open(int fd, char *dbFile)
+{
+    char path[PATH_MAX];
+    db_header_t hdr;
+    db_crc_hdr_t ch;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_CRC_SUFFIX);
+    db_crc.crc_fd = open(path, O_RDWR | O_CREAT, mode);
+    if (db_crc.crc_fd == -1)
+        return ERR_DB_FILE;
+    db_crc.fd = fd;
+
+    int rc = read_db_header(fd, &hdr);
+    if (rc == ERR_DB_FILE)
+        return rc;
+    if (rc == SRCH_NOT_FOUND)
+        memset(&hdr, 0, sizeof(hdr));
+
+    ssize_t n = pread(db_crc.crc_fd, &ch, sizeof(ch), 0);
+    if (n == -1)
+        return ERR_DB_FILE;
+    if (n == sizeof(ch) && memcmp(ch.magic, DB_CRC_MAGIC, sizeof(ch.magic)) == 0 &&
+        ch.generation == hdr.generation)
+        return NO_ERROR;
+
+    return rebuild_page_crcs(fd);
+}
+
+// closes the checksum file that belongs to fd
+void crc_close(int fd)
+{
+    if (db_crc.fd != fd)
+        return;
+
+    close(db_crc.crc_fd);
+    db_crc.fd = -1;
+    db_crc.crc_fd = -1;
+}
+
+/*
+ *  verify_db
+ *      fd:  linux file descriptor
+ *
+ *  Reads the whole database file back a megabyte at a time and checks
+ *  every page against its checksum.  Holes are not read, their pages must
+ *  not have a sum.  Writers are kept out by the header lock while the file
+ *  is checked.
+ *
+ *  returns:  number of pages that failed, or ERR_DB_FILE on I/O errors
+ *
+ *  console:  M_ERR_PAGE_CRC  for every page that fails its checksum
+ *            M_DB_VERIFIED   on success, if every page checks out
+ *            M_ERR_VERIFY    on success, number of pages that failed
+ *            M_ERR_DB_READ   error reading the database or checksum file
+ */
+int verify_db(int fd)
+{
+    struct timespec start;
+    struct stat st;
+    uint32_t *sums = NULL;
+    unsigned char *blk = NULL;
+    int bad = 0;
+    int rc = ERR_DB_FILE;
+
+    if (wal_flush(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (lock_header(fd, F_WRLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // a database with records has checksums, summed now if nothing ever
+    // kept them, then the lock is traded for a read lock
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size > 0 && side_attach(fd, true) != NO_ERROR) ||
+        lock_header(fd, F_RDLCK) != NO_ERROR)
+        goto done;
+
+    long long npages = (st.st_size + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE;
+    sums = calloc(npages + 1, sizeof(uint32_t));
+    blk = malloc(CRC_BATCH_PAGES * DB_PAGE_SIZE);
+    if (sums == NULL || blk == NULL)
+        goto done;
+
+    // a short read leaves the pages past the end of the file without a sum
+    if (db_crc.fd == fd && pread(db_crc.crc_fd, sums, npages * sizeof(uint32_t), crc_entry_off(0)) == -1)
+        goto done;
+
+    long long p = 0;
+    off_t data = lseek(fd, 0, SEEK_DATA);
+    while (p < npages)
+    {
+        if (data == -1 && errno != ENXIO)
+            goto done;
+
+        // the pages of a hole read as zeros
+        long long hole_end = data == -1 ? npages : data / DB_PAGE_SIZE;
+        for (; p < hole_end; p++)
+        {
+            if (sums[p] != 0)
+            {
+                printf(M_ERR_PAGE_CRC, p);
+                bad++;
+            }
+        }
+        if (data == -1)
+            break;
+
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1)
+            goto done;
+
+        long long end = (hole + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE;
+        while (p < end)
+        {
+            long long n = end - p < CRC_BATCH_PAGES ? end - p : CRC_BATCH_PAGES;
+            ssize_t got = pread(fd, blk, n * DB_PAGE_SIZE, p * DB_PAGE_SIZE);
+            if (got == -1)
+                goto done;
+            memset(blk + got, 0, n * DB_PAGE_SIZE - got);
+
+            for (long long i = 0; i < n; i++)
+            {
+                if (crc32c(0, blk + i * DB_PAGE_SIZE, DB_PAGE_SIZE) != sums[p + i])
+                {
+                    printf(M_ERR_PAGE_CRC, p + i);
+                    bad++;
+                }
+            }
+            p += n;
+        }
+        data = lseek(fd, p * DB_PAGE_SIZE, SEEK_DATA);
+    }
+
+    if (bad == 0)
+        printf(M_DB_VERIFIED, npages, elapsed_ms(&start));
+    else
+        printf(M_ERR_VERIFY, bad, npages);
+    rc = bad;
+
+done:
+    if (rc == ERR_DB_FILE)
+        printf(M_ERR_DB_READ);
+    lock_header(fd, F_UNLCK);
+    free(sums);
+    free(blk);
+    return rc;
+}
+
+/*
+ *  find_students_by_lname
+ *      fd:     linux file descriptor
+ *      lname:  last name to look up
+ *
+ *  Binary searches the last name index for the first entry with lname and
+ *  prints every student from there on that has the same last name, ordered
+ *  by first name.  The run of entries is read IDX_READ_ENTRIES at a time,
+ *  and a record whose last name changed since the index was read (deleted
+ *  and added again in between) is not printed.
+ *
+ *  returns:  number of students found
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the print_db() table of the students found
+ *            M_STD_LNAME_NOT_FND  no student has that last name
+ *            M_ERR_DB_READ        error reading the database or index
+ */
+int find_students_by_lname(int fd, char *lname)
+{
+    db_idx_hdr_t ih;
+    db_idx_entry_t key = {0};
+    db_idx_entry_t run[IDX_READ_ENTRIES];
+    student_t student;
+    bool firstRow = true;
+    int *ids = NULL;
+    int pos = 0, nids = 0, cap = 0, found = 0;
+    int rc = NO_ERROR;
+
+    if (wal_flush(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // the first lookup creates the index, a database without students has none
+    if (db_idx.fd != fd && side_use(fd, DB_SIDE_INDEX) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // names are stored truncated the same way add_student() does it
+    strncpy(key.lname, lname, sizeof(key.lname) - 1);
+
+    // collect the matching ids under the header lock, the records are read
+    // after it is released since record locks are never taken under it
+    if (lock_header(fd, F_RDLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    ih.count = 0;
+    if (db_idx.fd == fd &&
+        (read_idx_hdr(&ih) != NO_ERROR || idx_search(&key, true, ih.count, &pos) != NO_ERROR))
+        rc = ERR_DB_FILE;
+
+    while (rc == NO_ERROR && pos < ih.count)
+    {
+        int n = ih.count - pos < IDX_READ_ENTRIES ? ih.count - pos : IDX_READ_ENTRIES;
+        ssize_t len = n * sizeof(db_idx_entry_t);
+        int i = 0;
+
+        if (pread(db_idx.idx_fd, run, len, idx_entry_off(pos)) != len)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        for (; i < n && strncmp(run[i].lname, key.lname, sizeof(key.lname)) == 0; i++)
+        {
+            if (nids == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                int *grown = realloc(ids, cap * sizeof(int));
+                if (grown == NULL)
+                {
+                    rc = ERR_DB_FILE;
+                    break;
+                }
+                ids = grown;
+            }
+            ids[nids++] = run[i].id;
+        }
+        // the run ended inside this block
+        if (i < n)
+            break;
+        pos += n;
+    }
+
+    if (lock_header(fd, F_UNLCK) != NO_ERROR || rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        free(ids);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < nids; i++)
+    {
+        // the id may have been deleted and added under another name since
+        if (get_student(fd, ids[i], &student) == NO_ERROR &&
+            strncmp(student.lname, key.lname, sizeof(student.lname)) == 0)
+        {
+            print_db_row(&student, &firstRow);
+            found++;
+        }
+    }
+    free(ids);
+
+    if (found == 0)
+        printf(M_STD_LNAME_NOT_FND, key.lname);
+    return found;
+}
+
+/*
+ *  lock_range
+ *      fd:    linux file descriptor
+ *      type:  F_RDLCK, F_WRLCK or F_UNLCK
+ *      off:   first byte of the range
+ *      len:   length of the range in bytes
+ *      wait:  block until the lock is granted
+ *
+ *  Sets an OFD byte range lock, or a classic POSIX record lock on kernels
+ *  without OFD locks.  Both work the same here since a process only opens
+ *  each file once.
+ *
+ *  returns:  NO_ERROR       lock set (or released)
+ *            ERR_DB_OP      wait is false and another process holds the range
+ *            ERR_DB_FILE    fcntl failure
+ */
+int lock_range(int fd, short type, off_t off, off_t len, bool wait)
+{
+    static bool no_ofd = false;
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = off;
+    fl.l_len = len;
+
+    for (;;)
+    {
+        int cmd = no_ofd ? (wait ? F_SETLKW : F_SETLK) : (wait ? F_OFD_SETLKW : F_OFD_SETLK);
+
+        if (fcntl(fd, cmd, &fl) == 0)
+            return NO_ERROR;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EACCES)
+            return ERR_DB_OP;
+        if (errno == EINVAL && !no_ofd)
+        {
+            no_ofd = true;
+            continue;
+        }
+        return ERR_DB_FILE;
+    }
+}
+
+/*
+ *  lock_header
+ *      fd:    linux file descriptor
+ *      type:  F_RDLCK, F_WRLCK or F_UNLCK
+ *
+ *  Locks the header slot, which guards the bitmap, the header itself and
+ *  the last name index.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int lock_header(int fd, short type)
+{
+    return lock_range(fd, type, 0, sizeof(db_header_t), true);
+}
+
+/*
+ *  lock_change
+ *      fd:  linux file descriptor
+ *
+ *  Write locks the header for a change to the database, then opens the
+ *  side files every change keeps current, creating them on the first one
+ *  (see side_attach()).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure, with the header
+ *            unlocked
+ */
+int lock_change(int fd)
+{
+    if (lock_header(fd, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (side_attach(fd, true) != NO_ERROR)
+    {
+        lock_header(fd, F_UNLCK);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  lock_student
+ *      fd:    linux file descriptor
+ *      id:    student whose record is locked
+ *      type:  F_RDLCK or F_WRLCK
+ *
+ *  Locks one record.  If another process has it, the queued log group is
+ *  committed first, which releases the record locks it holds, so nobody
+ *  waits on us while we wait.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int lock_student(int fd, int id, short type)
+{
+    off_t off = (off_t)id * STUDENT_RECORD_SIZE;
+    int rc = lock_range(fd, type, off, STUDENT_RECORD_SIZE, false);
+
+    if (rc != ERR_DB_OP)
+        return rc;
+    if (wal_flush(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    return lock_range(fd, type, off, STUDENT_RECORD_SIZE, true);
+}
+
+/*
+ *  unlock_student
+ *      fd:  linux file descriptor
+ *      id:  student whose record is unlocked
+ *
+ *  Releases a record lock, unless a change to the record is still queued
+ *  in the log.  wal_flush() releases those once the group is applied.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int unlock_student(int fd, int id)
+{
+    student_t s;
+
+    if (wal_enabled(fd) && wal_lookup(id, &s) != ERR_DB_OP)
+        return NO_ERROR;
+    return lock_range(fd, F_UNLCK, (off_t)id * STUDENT_RECORD_SIZE, STUDENT_RECORD_SIZE, false);
+}
+
+/*
+ *  side_unlink
+ *      dbFile:     name of the database file
+ *      truncated:  the database was just emptied
+ *
+ *  Deletes the side files of an empty database, see Side files above.  A
+ *  log is kept unless the database was emptied, open_db() replays it.
+ *  Called with the header write locked.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int side_unlink(char *dbFile, bool truncated)
+{
+    static const char *suffixes[] = {DB_BITMAP_SUFFIX, DB_INDEX_SUFFIX, DB_DIR_SUFFIX,
+                                     DB_CRC_SUFFIX, DB_SNAP_SUFFIX, DB_COL_SUFFIX,
+                                     DB_WAL_SUFFIX};
+    size_t n = sizeof(suffixes) / sizeof(suffixes[0]) - !truncated;
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < n; i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", dbFile, suffixes[i]);
+        if (unlink(path) == -1 && errno != ENOENT)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  side_attach
+ *      fd:      linux file descriptor, the caller holds the header write lock
+ *      change:  the caller is about to change the database
+ *
+ *  Opens the side files this process does not have open yet, which another
+ *  process may have created since open_db().  Before a change the snapshot
+ *  file, the bitmap and the checksums are created if they are missing, so
+ *  every change saves pages for pinned snapshots, bumps the changes count
+ *  the page caches watch and keeps the bitmap and the sums current.  The
+ *  index and the column store are opened too once a lookup or a report
+ *  created them (see side_use()).
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int side_attach(int fd, bool change)
+{
+    db_header_t hdr;
+
+    if (snap_hdr(fd) == NULL)
+    {
+        if (snap_open(fd, db_path, change) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (snap_hdr(fd) != NULL && cache_open(fd) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    if (db_occ.fd != fd && occ_open(fd, db_path, change) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (!change)
+        return NO_ERROR;
+    if (db_crc.fd != fd && crc_open(fd, db_path) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // and the files of side_use() once some process created them
+    if (load_occupancy(fd, &hdr, NULL) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_idx.fd != fd && (hdr.side_files & DB_SIDE_INDEX) && idx_open(fd, db_path) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (!col_attached(fd) && (hdr.side_files & DB_SIDE_COLUMNS) && col_open(fd, db_path) != NO_ERROR)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  side_use
+ *      fd:   linux file descriptor
+ *      bit:  DB_SIDE_INDEX or DB_SIDE_COLUMNS, the side file a lookup or
+ *            report is about to use
+ *
+ *  Opens a side file only some lookups and reports use, creating it the
+ *  first time one runs on a database that has students.  The header
+ *  records that it was created, so from then on every change keeps it
+ *  current.
+ *
+ *  returns:  NO_ERROR on success, even if there was nothing to create,
+ *            ERR_DB_FILE on failure
+ */
+int side_use(int fd, unsigned int bit)
+{
+    db_header_t hdr;
+    int rc = lock_header(fd, F_WRLCK);
+
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // side_attach() opens it if it is there, and may rebuild the header
+    rc = load_occupancy(fd, &hdr, NULL);
+    if (rc == NO_ERROR && hdr.count > 0 &&
+        (rc = side_attach(fd, true)) == NO_ERROR &&
+        (rc = load_occupancy(fd, &hdr, NULL)) == NO_ERROR && !(hdr.side_files & bit))
+    {
+        bool index = bit == DB_SIDE_INDEX;
+        rc = index ? idx_open(fd, db_path) : col_open(fd, db_path);
+        if (rc == NO_ERROR && (index ? db_idx.fd == fd : col_attached(fd)))
+        {
+            hdr.side_files |= bit;
+            if (db_write_at(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+                rc = ERR_DB_FILE;
+        }
+    }
+
+    if (lock_header(fd, F_UNLCK) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+/*
+ *  open_db
+ *      dbFile:  name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ *
+ *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *
+ *  console:  Does not produce any console I/O on success
+ *            M_ERR_DB_OPEN on error
+ *            M_ERR_DB_BUSY if asked to empty a database another process
+ *                          has open
+ *
+ */
+int open_db(char *dbFile, bool should_truncate)
+{
+    // Set permissions: rw-rw----
+    // see sys/stat.h for constants
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    // open the file if it exists for Read and Write,
+    // create it if it does not exist
+    int flags = O_RDWR | O_CREAT;
+
+    // Now open file
+    int fd = open(dbFile, flags, mode);
+
+    // hold the file shared while it is open, a compress_db() that renamed a
+    // rewritten copy over it while we waited for that leaves us the old one.
+    // Emptying it takes the file to ourselves: the mappings and side files
+    // other processes use would be cut from under them.
+    struct stat st, named;
+    short hold = should_truncate ? F_WRLCK : F_RDLCK;
+    while (fd != -1)
+    {
+        int rc = lock_range(fd, hold, DB_LOCK_OPEN, 1, !should_truncate);
+        if (rc != NO_ERROR || fstat(fd, &st) == -1)
+        {
+            printf(rc == ERR_DB_OP ? M_ERR_DB_BUSY : M_ERR_DB_OPEN);
+            close(fd);
+            return ERR_DB_FILE;
+        }
+        if (stat(dbFile, &named) == 0 && named.st_ino == st.st_ino && named.st_dev == st.st_dev)
+            break;
+        close(fd);
+        fd = open(dbFile, flags, mode);
+    }
+
+    if (fd == -1 || (should_truncate && ftruncate(fd, 0) == -1))
+    {
+        // Handle the error
+        printf(M_ERR_DB_OPEN);
+        if (fd != -1)
+            close(fd);
+        return ERR_DB_FILE;
+    }
+
+    // serve the file out of a shared mapping if the mmap backend was asked for
+    if (use_mmap_backend() && db_map_open(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_OPEN);
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    uring_open(fd);
+
+    // the side files are checked (and rebuilt) against a header nobody
+    // else is changing
+    snprintf(db_path, sizeof(db_path), "%s", dbFile);
+    bool opened = lock_header(fd, F_WRLCK) == NO_ERROR &&
+                  ((!should_truncate && st.st_size > 0) || side_unlink(dbFile, should_truncate) == NO_ERROR) &&
+                  dir_open(fd, dbFile) == NO_ERROR &&
+                  side_attach(fd, false) == NO_ERROR;
+
+    if (lock_header(fd, F_UNLCK) != NO_ERROR || !opened ||
+        wal_open(fd, dbFile) != NO_ERROR ||
+        lock_range(fd, F_RDLCK, DB_LOCK_OPEN, 1, true) != NO_ERROR)
+    {
+        printf(M_ERR_DB_OPEN);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    return fd;
+}
+
+/*
+ *  read_student
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking for
+ *      *s:  receives the record of id
+ *
+ *  Reads a record without locking it, for callers that already hold the
+ *  record lock.
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            SRCH_NOT_FOUND student was not located in the database
+ */
+static int read_student(int fd, int id, student_t *s)
+{
+    // read student record at its offset and check for error
+    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+    ssize_t bytesRead = db_read_at(fd, s, STUDENT_RECORD_SIZE, offset);
+    if (bytesRead == -1) {
+        return SRCH_NOT_FOUND;
+    }
+
+    // ensures record is fully read and student ID isn't 0
+    if (bytesRead != STUDENT_RECORD_SIZE || s->id == DELETED_STUDENT_ID) {
+        return SRCH_NOT_FOUND;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  get_student
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking forname of the
+ *      *s:  a pointer where the located (if found) student data will be
+ *           copied
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_student(int fd, int id, student_t *s)
+{
+    // id not found if not in range
+    if (id < MIN_STD_ID || id > max_std_id()) {
+        return SRCH_NOT_FOUND;
+    }
+
+    // changes queued in the write-ahead log are newer than the file
+    int rc = wal_lookup(id, s);
+    if (rc != ERR_DB_OP) {
+        return rc;
+    }
+
+    // a cached page is never half written, so it is read without the lock
+    ssize_t n = db_peek_at(fd, s, STUDENT_RECORD_SIZE, (off_t)id * STUDENT_RECORD_SIZE);
+    if (n != -1) {
+        return n == STUDENT_RECORD_SIZE && s->id != DELETED_STUDENT_ID ? NO_ERROR : SRCH_NOT_FOUND;
+    }
+
+    // don't read a record another process is halfway through writing
+    if (lock_student(fd, id, F_RDLCK) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    rc = read_student(fd, id, s);
+    if (unlock_student(fd, id) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    return rc;
+}
+
+/*
+ *  get_students
+ *      fd:   linux file descriptor
+ *      ids:  the student ids we are looking for
+ *      s:    receives the student of each id, if found
+ *      rcs:  receives what get_student() would return for each id
+ *      n:    number of ids
+ *
+ *  get_student() of every id, with the records that are neither queued
+ *  in the write-ahead log nor cached read by one db_read_many().  They
+ *  are read under a single header read lock rather than a lock per
+ *  record, records only change under the header write lock.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the reads could not be made (rcs
+ *            then holds ERR_DB_FILE for the ids not yet found)
+ */
+int get_students(int fd, const int *ids, student_t *s, int *rcs, int n)
+{
+    db_io_t *io = malloc((n > 0 ? n : 1) * sizeof(db_io_t));
+    int nio = 0;
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < n; i++) {
+        rcs[i] = SRCH_NOT_FOUND;
+        if (ids[i] < MIN_STD_ID || ids[i] > max_std_id()) {
+            continue;
+        }
+
+        rcs[i] = wal_lookup(ids[i], &s[i]);
+        if (rcs[i] != ERR_DB_OP) {
+            continue;
+        }
+
+        off_t off = (off_t)ids[i] * STUDENT_RECORD_SIZE;
+        ssize_t got = db_peek_at(fd, &s[i], STUDENT_RECORD_SIZE, off);
+        if (got != -1) {
+            rcs[i] = got == STUDENT_RECORD_SIZE && s[i].id != DELETED_STUDENT_ID ? NO_ERROR : SRCH_NOT_FOUND;
+            continue;
+        }
+
+        rcs[i] = ERR_DB_FILE;
+        if (io != NULL) {
+            io[nio++] = (db_io_t){&s[i], STUDENT_RECORD_SIZE, off, -1};
+        }
+    }
+
+    if (io == NULL) {
+        return ERR_DB_FILE;
+    }
+    if (nio > 0) {
+        if (lock_header(fd, F_RDLCK) != NO_ERROR) {
+            free(io);
+            return ERR_DB_FILE;
+        }
+        rc = db_read_many(fd, io, nio);
+        if (lock_header(fd, F_UNLCK) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+        }
+    }
+
+    for (int k = 0; k < nio && rc == NO_ERROR; k++) {
+        student_t *found = io[k].buf;
+        rcs[found - s] = io[k].res == STUDENT_RECORD_SIZE && found->id != DELETED_STUDENT_ID
+                       ? NO_ERROR : SRCH_NOT_FOUND;
+    }
+
+    free(io);
+    return rc;
+}
+
+// console output of add_student() for the result of put_student()
+static void report_add(int rc, int id)
+{
+    if (rc == NO_ERROR)
+        printf(M_STD_ADDED, id);
+    else if (rc == ERR_DB_OP)
+        printf(M_ERR_DB_ADD_DUP, id);
+    else
+        printf(M_ERR_DB_WRITE);
+}
+
+// console output of del_student() for the result of clear_student()
+static void report_del(int rc, int id)
+{
+    if (rc == NO_ERROR)
+        printf(M_STD_DEL_MSG, id);
+    else if (rc == ERR_DB_OP)
+        printf(M_STD_NOT_FND_MSG, id);
+    else
+        printf(M_ERR_DB_WRITE);
+}
+
+/*
+ *  add_student
+ *      fd:     linux file descriptor
+ *      id:     student id (range is defined in db.h )
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer (range defined in db.h)
+ *
+ *  Adds a new student to the database.  After calculating the index for the
+ *  student, check if there is another student already at that location.  A good
+ *  way is to use something like memcmp() to ensure that the location for this
+ *  student contains all zero byes indicating the space is empty.
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           already exists, or a name has a comma, tab or
+ *                           line break)
+ *
+ *
+ *  console:  M_STD_ADDED       on success
+ *            M_ERR_DB_ADD_DUP  student already exists
+ *            M_ERR_DB_READ     error reading or seeking the database file
+ *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *
+ */
+int add_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    // validate id and gpa are in range, and the names can be exported
+    if (id < MIN_STD_ID || id > max_std_id() || gpa < MIN_STD_GPA || gpa > MAX_STD_GPA ||
+        validate_name(fname) != NO_ERROR || validate_name(lname) != NO_ERROR) {
+        return ERR_DB_OP;
+    }
+
+    int rc = put_student(fd, id, fname, lname, gpa);
+    report_add(rc, id);
+    return rc;
+}
+
+/*
+ *  put_student
+ *      fd, id, fname, lname, gpa:  same as add_student()
+ *
+ *  The work of add_student() without the console output, so batch_db()
+ *  can run adds in a different order than it reports them.
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      student already exists, is out of range or has
+ *                           a name validate_name() rejects
+ */
+int put_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    if (id < MIN_STD_ID || id > max_std_id() || gpa < MIN_STD_GPA || gpa > MAX_STD_GPA ||
+        validate_name(fname) != NO_ERROR || validate_name(lname) != NO_ERROR) {
+        return ERR_DB_OP;
+    }
+
+    // hold the record from the duplicate check until it is written, so two
+    // processes adding the same id can't both succeed
+    if (lock_student(fd, id, F_WRLCK) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    // check if student already exists, including a queued add of our own
+    student_t student;
+    int rc = wal_lookup(id, &student);
+    if (rc == ERR_DB_OP) {
+        rc = read_student(fd, id, &student);
+    }
+    if (rc == NO_ERROR) {
+        unlock_student(fd, id);
+        return ERR_DB_OP;
+    }
+
+    // create new student record
+    student_t new_student = {id, "", "", gpa};
+    strncpy(new_student.fname, fname, sizeof(new_student.fname) - 1);
+    strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
+
+    // write the new student record, mark its slot occupied and index it
+    rc = commit_change(fd, WAL_OP_ADD, &new_student);
+    if (unlock_student(fd, id) != NO_ERROR || rc != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  del_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ *
+ *  Removes a student to the database.  Use the get_student() function to
+ *  locate the student to be deleted. If there is a student at that location
+ *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
+ *  that location.
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           not in database)
+ *
+ *
+ *  console:  M_STD_DEL_MSG      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
+ *            M_ERR_DB_READ      error reading or seeking the database file
+ *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *
+ */
+int del_student(int fd, int id)
+{
+    int rc = clear_student(fd, id);
+
+    report_del(rc, id);
+    return rc;
+}
+
+/*
+ *  clear_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ *
+ *  The work of del_student() without the console output.
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      student not in database
+ */
+int clear_student(int fd, int id)
+{
+    // id not found if not in range
+    if (id < MIN_STD_ID || id > max_std_id()) {
+        return ERR_DB_OP;
+    }
+
+    // hold the record from the existence check until it is cleared
+    if (lock_student(fd, id, F_WRLCK) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    //make sure student exists before attempting to delete
+    student_t student;
+    int rc = wal_lookup(id, &student);
+    if (rc == ERR_DB_OP) {
+        rc = read_student(fd, id, &student);
+    }
+    if (rc != NO_ERROR) {
+        unlock_student(fd, id);
+        return ERR_DB_OP;
+    }
+
+    // write empty record where student was, free the slot and unindex it
+    rc = commit_change(fd, WAL_OP_DEL, &student);
+    if (unlock_student(fd, id) != NO_ERROR || rc != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  count_db_records
+ *      fd:     linux file descriptor
+ *
+ *  Reports the number of records in the database.  The live record count is
+ *  kept in the header in slot 0 by add_student() and del_student(), so this
+ *  is a single read no matter how large the database is.
+ *
+ *  returns:  <number>       returns the number of records in db on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
+ *            M_DB_EMPTY       on success if the record count in db is zero
+ *            M_ERR_DB_READ    error reading the database file
+ *
+ */
+int count_db_records(int fd)
+{
+    db_header_t hdr;
+
+    // scans and bulk writes go to the file, so queued log records go first
+    if (wal_flush(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // read the header between, not during, other processes' updates
+    int rc = lock_header(fd, F_RDLCK);
+    if (rc == NO_ERROR) {
+        rc = load_occupancy(fd, &hdr, NULL);
+    }
+    if (lock_header(fd, F_UNLCK) != NO_ERROR || rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (hdr.count == 0) {
+        printf(M_DB_EMPTY);
+    } else {
+        printf(M_DB_RECORD_CNT, hdr.count);
+    }
+
+    // success
+    return hdr.count;
+}
+
+/*
+ *  fmt_uint
+ *      p:      where to put the digits
+ *      v:      value to format
+ *
+ *  returns:  the char after the last digit
+ */
+static char *fmt_uint(char *p, unsigned long long v)
+{
+    char tmp[20];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+/*
+ *  fmt_field
+ *      p:      where to put the field
+ *      src:    string field of a student, not always nul terminated
+ *      width:  columns of the field
+ *
+ *  Same as printf's "%-<width>.<width>s".
+ *
+ *  returns:  the char after the field
+ */
+static char *fmt_field(char *p, const char *src, size_t width)
+{
+    size_t n = strnlen(src, width);
+
+    memcpy(p, src, n);
+    memset(p + n, ' ', width - n);
+    return p + width;
+}
+
+/*
+ *  format_db_row
+ *      dst:    buffer of at least DB_ROW_MAX bytes
+ *      *s:     student to format
+ *
+ *  Formats s exactly like printf(STUDENT_PRINT_FMT_STRING, ...) would, but
+ *  without parsing the format or going through a double for the gpa: the
+ *  gpa is kept in int form so its two decimals are just gpa % 100.  The
+ *  row is not nul terminated.
+ *
+ *  returns:  length of the row
+ */
+int format_db_row(char *dst, const student_t *s)
+{
+    char *p = dst;
+    long long v;
+
+    // "%-6d"
+    v = s->id;
+    if (v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    p = fmt_uint(p, (unsigned long long)v);
+    while (p - dst < 6)
+        *p++ = ' ';
+    *p++ = ' ';
+
+    // "%-24.24s %-32.32s "
+    p = fmt_field(p, s->fname, sizeof(s->fname));
+    *p++ = ' ';
+    p = fmt_field(p, s->lname, sizeof(s->lname));
+    *p++ = ' ';
+
+    // "%-3.2f" of gpa / 100.0, never shorter than "0.00" so never padded
+    v = s->gpa;
+    if (v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    p = fmt_uint(p, (unsigned long long)(v / 100));
+    *p++ = '.';
+    *p++ = '0' + (v % 100) / 10;
+    *p++ = '0' + v % 10;
+    *p++ = '\n';
+
+    return p - dst;
+}
+
+/*
+ *  print_db_row
+ *      *s:        record read from the database
+ *      *firstRow: true until the table header has been printed
+ *
+ *  Prints one print_db() table row if the slot holds a student, preceded by
+ *  the header the first time a student is found.  Goes through stdio, for
+ *  the few rows of a lookup, see db_out_row() for whole tables.
+ */
+void print_db_row(const student_t *s, bool *firstRow)
+{
+    char row[DB_ROW_MAX];
+
+    if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0) {
+        return;
+    }
+
+    if (*firstRow) {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        *firstRow = false;
+    }
+    fwrite(row, 1, format_db_row(row, s), stdout);
+}
+
+/*
+ *  db_out_open
+ *      *out:   output buffer to set up
+ *      fd:     descriptor the output goes to
+ *
+ *  Starts buffered output to fd.  For stdout, whatever stdio still holds
+ *  is flushed first so the output comes after it.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    out of memory
+ */
+int db_out_open(db_out_t *out, int fd)
+{
+    if (fd == STDOUT_FILENO)
+        fflush(stdout);
+    out->fd = fd;
+    out->len = 0;
+    out->firstRow = true;
+    out->buf = malloc(DB_OUT_BUF_SZ);
+    return out->buf != NULL ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  db_out_flush
+ *      *out:   output buffer
+ *
+ *  Writes everything in the buffer, retrying short writes.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the output could not be written
+ */
+int db_out_flush(db_out_t *out)
+{
+    size_t done = 0;
+
+    while (done < out->len) {
+        ssize_t n = write(out->fd, out->buf + done, out->len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        done += n;
+    }
+    out->len = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  db_out_write
+ *      *out:   output buffer from db_out_open()
+ *      data:   bytes to output
+ *      len:    number of bytes
+ *
+ *  Adds raw bytes to the buffer, writing it out each time it fills.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the output could not be written
+ */
+int db_out_write(db_out_t *out, const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0) {
+        size_t n = DB_OUT_BUF_SZ - out->len;
+        if (n > len)
+            n = len;
+        memcpy(out->buf + out->len, p, n);
+        out->len += n;
+        p += n;
+        len -= n;
+        if (out->len == DB_OUT_BUF_SZ && db_out_flush(out) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_out_header
+ *      *out:   output buffer from db_out_open()
+ *
+ *  Adds the table header, which goes before the first row.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the output could not be written
+ */
+int db_out_header(db_out_t *out)
+{
+    if (out->len + DB_ROW_MAX > DB_OUT_BUF_SZ && db_out_flush(out) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    out->len += snprintf(out->buf + out->len, DB_ROW_MAX, STUDENT_PRINT_HDR_STRING,
+                         "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+    out->firstRow = false;
+    return NO_ERROR;
+}
+
+/*
+ *  db_out_row
+ *      *out:   output buffer from db_out_open()
+ *      *s:     record read from the database
+ *
+ *  Buffered print_db_row(): adds the row, and the header before the first
+ *  one, to the buffer and writes the buffer out when it is full.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the output could not be written
+ */
+int db_out_row(db_out_t *out, const student_t *s)
+{
+    if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0) {
+        return NO_ERROR;
+    }
+
+    if (out->len + 2 * DB_ROW_MAX > DB_OUT_BUF_SZ && db_out_flush(out) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    if (out->firstRow && db_out_header(out) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    out->len += format_db_row(out->buf + out->len, s);
+    return NO_ERROR;
+}
+
+/*
+ *  db_out_close
+ *      *out:   output buffer from db_out_open()
+ *
+ *  Writes what is left in the buffer and frees it.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the output could not be written
+ */
+int db_out_close(db_out_t *out)
+{
+    int rc = db_out_flush(out);
+
+    free(out->buf);
+    out->buf = NULL;
+    return rc;
+}
+
+/*
+ *  print_db
+ *      fd:     linux file descriptor
+ *
+ *  Prints all records in the database.  Start by reading the
+ *  database at the beginning, and continue reading individual records
+ *  until you it EOF.  EOF is when the read() syscall returns 0. Check
+ *  if a slot is empty or previously deleted by investigating if all of
+ *  the bytes in the record read are zeros - I would suggest using memory
+ *  compare memcmp() for this. Be careful as the database might be empty.
+ *  on the first real row encountered print the header for the required output:
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *                  "FIRST_NAME", "LAST_NAME", "GPA");
+ *
+ *  then for each valid record encountered print the required output:
+ *
+ *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
+ *                    student.lname, calculated_gpa_from_student);
+ *
+ *  Rows are built by format_db_row() into a db_out_t buffer and written
+ *  to stdout a megabyte at a time, the bytes are the same as the printf()
+ *  above would print.  A big database is read and formatted by a pool of
+ *  threads, see db_pscan().  Either way the rows come from a snapshot
+ *  pinned when the table starts, so writers carry on while it is printed.
+ *
+ *  The code above assumes you are reading student records into a local
+ *  variable named student that is of type student_t. Also dont forget that
+ *  the GPA in the student structure is an int, to convert it into a real
+ *  gpa divide by 100.0 and store in a float variable.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue, or stdout failed
+ *
+ *
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *
+ */
+int print_db(int fd)
+{
+    db_header_t hdr;
+    db_occmap_t *occ;
+    student_t *blk;
+    db_out_t out = {0};
+    db_pscan_t *ps = NULL;
+    int rc = NO_ERROR;
+
+    if (wal_flush(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    occ = occ_map_new();
+    blk = malloc(OCC_SCAN_RECS * STUDENT_RECORD_SIZE);
+
+    if (pscan_open(fd, &ps) != NO_ERROR || occ == NULL || blk == NULL ||
+        db_out_open(&out, STDOUT_FILENO) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    // a big database is read and formatted by several threads
+    if (ps != NULL) {
+        ps->block = pscan_print_block;
+        if (db_pscan(ps) != NO_ERROR) {
+            printf(M_ERR_DB_READ);
+            rc = ERR_DB_FILE;
+            goto done;
+        }
+        if (db_pscan_output(ps, &out) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            goto done;
+        }
+    } else if (snap_pin(fd, &hdr, occ) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+        goto done;
+    } else {
+        // the bitmap says where the students are, so holes and deleted slots
+        // are never read and each run of occupied slots is one read
+        int id = MIN_STD_ID;
+        int n;
+
+        while ((n = read_occupied(fd, occ, &id, blk)) > 0) {
+            for (int i = 0; i < n; i++) {
+                if (db_out_row(&out, &blk[i]) != NO_ERROR) {
+                    rc = ERR_DB_FILE;
+                    goto done;
+                }
+            }
+        }
+        if (n < 0) {
+            printf(M_ERR_DB_READ);
+            rc = ERR_DB_FILE;
+            goto done;
+        }
+    }
+
+    if (db_out_flush(&out) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    // database is empty if first row is never read
+    if (out.firstRow) {
+        printf(M_DB_EMPTY);
+    }
+
+done:
+    snap_unpin(fd);
+    db_pscan_free(ps);
+    free(out.buf);
+    occ_map_free(occ);
+    free(blk);
+    return rc;
+}
+
+/*
+ *  gpa_filter_block
+ *      blk:    block of slots from db_scan_block()
+ *      n:      number of slots in the block
+ *      min:    lowest gpa wanted (int form, like 345)
+ *      max:    highest gpa wanted
+ *      match:  n flags, set to 1 for every student in the range
+ *
+ *  The filter is branch free: empty slots (id 0) and out of range gpas are
+ *  folded into a single unsigned compare per slot, so the loop runs
+ *  straight through a block without mispredicting on the data.
+ *
+ *  returns:  number of students that matched
+ */
+int gpa_filter_block(const student_t *blk, int n, int min, int max, unsigned char *match)
+{
+    unsigned span = (unsigned)(max - min);
+    int hits = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned char m = ((unsigned)(blk[i].gpa - min) <= span) & (blk[i].id != DELETED_STUDENT_ID);
+        match[i] = m;
+        hits += m;
+    }
+    return hits;
+}
+
+/*
+ *  query_gpa_range
+ *      fd:     linux file descriptor
+ *      min:    lowest gpa wanted (int form, like 345)
+ *      max:    highest gpa wanted
+ *
+ *  Prints every student whose gpa is in [min, max] in id order.  The gpa
+ *  column of the column store is filtered if it is up to date, otherwise
+ *  the occupied runs of a pinned snapshot are read in blocks.  Blocks
+ *  without a match cost only the filter pass.  A big database is split
+ *  among threads, db_pscan().
+ *
+ *  returns:  number of students printed
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the print_db() table of the matching students
+ *            M_DB_GPA_NONE   no student is in the range
+ *            M_ERR_DB_READ   error reading the database file
+ */
+int query_gpa_range(int fd, int min, int max)
+{
+    unsigned char match[OCC_SCAN_RECS];
+    db_header_t hdr;
+    db_occmap_t *occ;
+    student_t *blk;
+    db_pscan_t *ps;
+    db_out_t out;
+    int id = MIN_STD_ID;
+    int found = 0;
+    int n;
+
+    if (wal_flush(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // only the students in the range are read when the columns are current
+    char *text;
+    size_t len;
+    found = col_gpa_range(fd, min, max, &text, &len);
+    if (found != SRCH_NOT_FOUND)
+    {
+        n = found < 0 ? ERR_DB_FILE : db_out_open(&out, STDOUT_FILENO);
+        if (n == NO_ERROR && found > 0 &&
+            (db_out_header(&out) != NO_ERROR || db_out_write(&out, text, len) != NO_ERROR))
+            n = ERR_DB_FILE;
+        free(text);
+        if (found >= 0 && db_out_close(&out) != NO_ERROR)
+            n = ERR_DB_FILE;
+        if (n != NO_ERROR)
+        {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        if (found == 0)
+            printf(M_DB_GPA_NONE, min / 100.0, max / 100.0);
+        return found;
+    }
+    found = 0;
+
+    if (pscan_open(fd, &ps) != NO_ERROR || db_out_open(&out, STDOUT_FILENO) != NO_ERROR)
+    {
+        db_pscan_free(ps);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // a big database is filtered by several threads
+    if (ps != NULL)
+    {
+        ps->block = pscan_gpa_block;
+        ps->min = min;
+        ps->max = max;
+        n = db_pscan(ps);
+        if (n == NO_ERROR && db_pscan_output(ps, &out) != NO_ERROR)
+            n = ERR_DB_FILE;
+        for (int i = 0; i < ps->nparts; i++)
+            found += ps->parts[i].found;
+        db_pscan_free(ps);
+        if (db_out_close(&out) != NO_ERROR || n < 0)
+        {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        if (found == 0)
+            printf(M_DB_GPA_NONE, min / 100.0, max / 100.0);
+        return found;
+    }
+
+    occ = occ_map_new();
+    blk = malloc(OCC_SCAN_RECS * STUDENT_RECORD_SIZE);
+    n = occ != NULL && blk != NULL ? snap_pin(fd, &hdr, occ) : ERR_DB_FILE;
+
+    while (n >= 0 && (n = read_occupied(fd, occ, &id, blk)) > 0)
+    {
+        if (gpa_filter_block(blk, n, min, max, match) == 0)
+            continue;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (match[i])
+            {
+                if (db_out_row(&out, &blk[i]) != NO_ERROR)
+                    n = ERR_DB_FILE;
+                found++;
+            }
+        }
+    }
+    snap_unpin(fd);
+    occ_map_free(occ);
+    free(blk);
+    if (db_out_close(&out) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (n < 0)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (found == 0)
+        printf(M_DB_GPA_NONE, min / 100.0, max / 100.0);
+    return found;
+}
+
+/*
+ *  gpa_stats_block
+ *      blk:   block of slots from db_scan_block()
+ *      n:     number of slots in the block
+ *      *st:   running statistics to update
+ *
+ *  Folds a block into the running statistics.  Empty slots are masked out
+ *  arithmetically rather than skipped with a branch.
+ */
+void gpa_stats_block(const student_t *blk, int n, gpa_stats_t *st)
+{
+    for (int i = 0; i < n; i++)
+    {
+        int valid = blk[i].id != DELETED_STUDENT_ID;
+        int gpa = blk[i].gpa;
+        int bucket = gpa / GPA_HIST_WIDTH;
+
+        if (bucket >= GPA_HIST_BUCKETS)
+            bucket = GPA_HIST_BUCKETS - 1;
+
+        st->count += valid;
+        st->sum += valid * gpa;
+        st->hist[bucket] += valid;
+        st->min = valid && gpa < st->min ? gpa : st->min;
+        st->max = valid && gpa > st->max ? gpa : st->max;
+    }
+}
+
+/*
+ *  print_gpa_stats
+ *      fd:     linux file descriptor
+ *
+ *  Computes the count, minimum, maximum, mean and a histogram of the gpas
+ *  of every student with integer arithmetic only.  The gpa column of the
+ *  column store has them all, if it is behind they come from one block
+ *  scan of a pinned snapshot.
+ *
+ *  returns:  number of students included
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_GPA_STATS and M_DB_GPA_HIST_ROW lines on success
+ *            M_DB_EMPTY      if there are no students
+ *            M_ERR_DB_READ   error reading the database file
+ */
+int print_gpa_stats(int fd)
+{
+    gpa_stats_t st = {0};
+    db_pscan_t *ps;
+    int n;
+
+    if (wal_flush(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    st.min = MAX_STD_GPA;
+    st.max = MIN_STD_GPA;
+
+    n = col_gpa_stats(fd, &st);
+    if (n != SRCH_NOT_FOUND)
+    {
+        if (n != NO_ERROR)
+        {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        return report_gpa_stats(&st);
+    }
+
+    if (pscan_open(fd, &ps) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // a big database is split among threads, each with its own statistics
+    if (ps != NULL)
+    {
+        ps->block = pscan_stats_block;
+        n = db_pscan(ps);
+        for (int i = 0; i < ps->nparts; i++)
+        {
+            const gpa_stats_t *part = &ps->parts[i].st;
+
+            st.count += part->count;
+            st.sum += part->sum;
+            st.min = part->min < st.min ? part->min : st.min;
+            st.max = part->max > st.max ? part->max : st.max;
+            for (int b = 0; b < GPA_HIST_BUCKETS; b++)
+                st.hist[b] += part->hist[b];
+        }
+        db_pscan_free(ps);
+    }
+    else
+    {
+        db_occmap_t *occ = occ_map_new();
+        student_t *blk = malloc(OCC_SCAN_RECS * STUDENT_RECORD_SIZE);
+        db_header_t hdr;
+        int id = MIN_STD_ID;
+
+        n = occ != NULL && blk != NULL ? snap_pin(fd, &hdr, occ) : ERR_DB_FILE;
+        while (n >= 0 && (n = read_occupied(fd, occ, &id, blk)) > 0)
+            gpa_stats_block(blk, n, &st);
+        snap_unpin(fd);
+        occ_map_free(occ);
+        free(blk);
+    }
+
+    if (n < 0)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    return report_gpa_stats(&st);
+}
+
+/*
+ *  report_gpa_stats
+ *      *st:  statistics gathered by gpa_stats_block()
+ *
+ *  Prints the statistics and a histogram whose longest bar is
+ *  GPA_HIST_BAR_MAX characters.
+ *
+ *  returns:  number of students included
+ */
+int report_gpa_stats(const gpa_stats_t *st)
+{
+    char bar[GPA_HIST_BAR_MAX + 1];
+    int peak = 1;
+
+    if (st->count == 0)
+    {
+        printf(M_DB_EMPTY);
+        return 0;
+    }
+
+    printf(M_DB_GPA_STATS, st->count, st->min / 100.0, st->max / 100.0,
+           st->sum / (double)st->count / 100.0);
+
+    for (int b = 0; b < GPA_HIST_BUCKETS; b++)
+        peak = st->hist[b] > peak ? st->hist[b] : peak;
+
+    for (int b = 0; b < GPA_HIST_BUCKETS; b++)
+    {
+        int len = (int)((long long)st->hist[b] * GPA_HIST_BAR_MAX / peak);
+        int hi = b == GPA_HIST_BUCKETS - 1 ? MAX_STD_GPA : (b + 1) * GPA_HIST_WIDTH - 1;
+
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        printf(M_DB_GPA_HIST_ROW, b * GPA_HIST_WIDTH / 100.0, hi / 100.0, st->hist[b], bar);
+    }
+
+    return st->count;
+}
+
+/*
+ *  print_student
  *      *s:   a pointer to a student_t structure that should
  *            contain a valid student to be printed
  *
- *  Start by ensuring that provided student pointer is valid.  To do this
- *  make sure it is not NULL and that s->id is not zero.  After ensuring
- *  that the student is valid, print it the exact way that is described
- *  in the print_db() function by first printing the header then the
- *  student data:
+ *  Start by ensuring that provided student pointer is valid.  To do this
+ *  make sure it is not NULL and that s->id is not zero.  After ensuring
+ *  that the student is valid, print it the exact way that is described
+ *  in the print_db() function by first printing the header then the
+ *  student data:
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *                  "FIRST NAME", "LAST_NAME", "GPA");
+ *
+ *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
+ *                    student.lname, calculated_gpa_from_s);
+ *
+ *  Dont forget that  the GPA in the student structure is an int, to convert
+ *  it into a real gpa divide by 100.0 and store in a float variable.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_STD_PRINT  if the function argument s is NULL or if
+ *                             s->id is zero
+ *
+ */
+void print_student(student_t *s)
+{
+    // ensuring provided pointer is valid
+    if (s == NULL || s->id == DELETED_STUDENT_ID) {
+        printf(M_ERR_STD_PRINT);
+        return;
+    }
+
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+}
+
+/*
+ *  punch_free_slots
+ *      fd:           linux file descriptor
+ *      *occ:         occupancy bitmap
+ *      blksize:      file system block size
+ *      *unsupported: set if the file system cannot punch holes
+ *
+ *  Walks the allocated extents of the file with lseek(SEEK_DATA/SEEK_HOLE)
+ *  and punches every whole block that only holds free (deleted) slots, so
+ *  the work done follows the allocated data and not the id range.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int punch_free_slots(int fd, const db_occmap_t *occ, off_t blksize, bool *unsupported)
+{
+    // slot 0 holds the header and is never punched
+    off_t data = lseek(fd, STUDENT_RECORD_SIZE, SEEK_DATA);
+
+    while (data != -1)
+    {
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1)
+            return ERR_DB_FILE;
+
+        int id = (data + STUDENT_RECORD_SIZE - 1) / STUDENT_RECORD_SIZE;
+        int end = hole / STUDENT_RECORD_SIZE;   // first id past the extent
+        if (id < MIN_STD_ID)
+            id = MIN_STD_ID;
+        if (end > MAX_STD_ID + 1)
+            end = MAX_STD_ID + 1;
+
+        while (id < end)
+        {
+            if (occ_map_test(occ, id))
+            {
+                id += occupied_run(occ, id, end - id);
+                continue;
+            }
+
+            int next = next_occupied(occ, id);
+            off_t start = ((off_t)id * STUDENT_RECORD_SIZE + blksize - 1) / blksize * blksize;
+            off_t stop = (off_t)(next < end ? next : end) * STUDENT_RECORD_SIZE;
+            if (stop > hole)
+                stop = hole;
+            stop = stop / blksize * blksize;
+
+            if (stop > start)
+            {
+                cache_begin_write(fd);
+                int punched = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, stop - start);
+                cache_end_write(fd, NULL, punched == -1 ? -1 : stop - start, start);
+                if (punched == -1)
+                {
+                    if (errno == EOPNOTSUPP)
+                        *unsupported = true;
+                    return ERR_DB_FILE;
+                }
+            }
+            if (stop > start && crc_update(fd, NULL, stop - start, start) != NO_ERROR)
+                return ERR_DB_FILE;
+            id = next;
+        }
+
+        data = lseek(fd, hole, SEEK_DATA);
+    }
+
+    // ENXIO just means there is no data past the last hole
+    return errno == ENXIO ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  punch_free_pages
+ *      fd:  linux file descriptor of a paged database
+ *
+ *  compress_db() for the paged layout: every page left without students is
+ *  punched out of the file and dropped from the directory, a page written
+ *  again later gets a new one.  Without hole punching the page is only
+ *  dropped, which still keeps scans from reading it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int punch_free_pages(int fd)
+{
+    db_snap_hdr_t *sh = snap_hdr(fd);
+
+    // a pinned snapshot may still read the pages, a later compress frees them
+    if (sh != NULL && __atomic_load_n(&sh->active, __ATOMIC_ACQUIRE) != 0)
+        return NO_ERROR;
+
+    for (unsigned int r = 0; r < DB_DIR_ROOT_ENTRIES; r++)
+    {
+        if (*dir_root(r) == 0)
+            continue;
+
+        db_dir_entry_t *leaf = dir_entry(r * DB_DIR_LEAF_ENTRIES, false);
+        if (leaf == NULL)
+            return ERR_DB_FILE;
+
+        for (int i = 0; i < DB_DIR_LEAF_ENTRIES; i++)
+        {
+            // page 0 holds the header and is never punched
+            if (leaf[i].page == 0 || leaf[i].occupied != 0)
+                continue;
+
+            off_t off = (off_t)leaf[i].page * DB_PAGE_SIZE;
+            cache_begin_write(fd);
+            int punched = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, DB_PAGE_SIZE);
+            cache_end_write(fd, NULL, punched == -1 ? -1 : DB_PAGE_SIZE, off);
+            if (punched == -1 && errno != EOPNOTSUPP)
+                return ERR_DB_FILE;
+            if (crc_update(fd, NULL, DB_PAGE_SIZE, off) != NO_ERROR)
+                return ERR_DB_FILE;
+            leaf[i].page = 0;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  rewrite_db
+ *      fd:    linux file descriptor
+ *      *occ:  occupancy bitmap
+ *
+ *  Fallback for file systems without hole punching: copies the header and
+ *  every occupied run into a temporary file next to the open database
+ *  (.tmp_student.db for student.db, as TMP_DB_FILE) and renames it over
+ *  the database, which is then reopened under the same path.  Other
+ *  processes that have the old file open would keep writing to it, so the
+ *  rewrite is refused unless the write lock on DB_LOCK_OPEN shows nobody
+ *  else has the database open.  That lock is held until the old file is
+ *  closed, and open_db() checks it did not get the old file while waiting.
+ *
+ *  returns:  fd of the reopened database, or ERR_DB_FILE (fd stays open)
+ */
+static int rewrite_db(int fd, const db_occmap_t *occ)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    student_t *blk = NULL;
+    db_header_t hdr;
+    struct stat st;
+    int tmp = -1;
+
+    // open_db() rewrites db_path, so it gets a copy; the temporary file is
+    // in the same directory so the rename stays on one file system
+    const char *base = strrchr(db_path, '/');
+    base = base != NULL ? base + 1 : db_path;
+    snprintf(path, sizeof(path), "%s", db_path);
+    if (snprintf(tmp_path, sizeof(tmp_path), "%.*s.tmp_%s", (int)(base - db_path), db_path, base) >=
+        (int)sizeof(tmp_path))
+    {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    int rc = lock_range(fd, F_WRLCK, DB_LOCK_OPEN, 1, false);
+    if (rc != NO_ERROR)
+    {
+        printf(rc == ERR_DB_OP ? M_ERR_DB_BUSY : M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    blk = malloc(OCC_SCAN_RECS * STUDENT_RECORD_SIZE);
+    if (blk == NULL || fstat(fd, &st) == -1)
+        goto fail;
+
+    tmp = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, mode);
+    if (tmp == -1)
+    {
+        printf(M_ERR_DB_OPEN);
+        goto fail;
+    }
+
+    if (read_db_header(fd, &hdr) != NO_ERROR ||
+        pwrite(tmp, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        goto fail_write;
+
+    for (int id = next_occupied(occ, MIN_STD_ID); id < OCC_END; )
+    {
+        int n = occupied_run(occ, id, OCC_SCAN_RECS);
+        size_t len = (size_t)n * STUDENT_RECORD_SIZE;
+        off_t off = (off_t)id * STUDENT_RECORD_SIZE;
+
+        if (db_read_at(fd, blk, len, off) != (ssize_t)len)
+        {
+            printf(M_ERR_DB_READ);
+            goto fail;
+        }
+        if (pwrite(tmp, blk, len, off) != (ssize_t)len)
+            goto fail_write;
+        id = next_occupied(occ, id + n);
+    }
+
+    // ids keep their offsets, so the logical size stays the same
+    if (ftruncate(tmp, st.st_size) == -1 || fsync(tmp) == -1)
+        goto fail_write;
+    close(tmp);
+    free(blk);
+
+    if (rename(tmp_path, path) == -1)
+    {
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+
+    close_db(fd);
+    return open_db(path, false);
+
+fail_write:
+    printf(M_ERR_DB_WRITE);
+fail:
+    if (tmp != -1)
+        close(tmp);
+    free(blk);
+    lock_range(fd, F_RDLCK, DB_LOCK_OPEN, 1, false);
+    return ERR_DB_FILE;
+}
+
+/*
+ *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
+ *
+ *  compress_db
+ *      fd:     linux file descriptor
+ *
+ *  This assignment takes advantage of the way Linux handles sparse files
+ *  on disk. Thus if there is a large hole between student records, Linux
+ *  will not use any physical storage.  However, when a database record is
+ *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
+ *  db.h - record.
+ *
+ *  Linux can in fact deallocate the middle of a file: fallocate() with
+ *  FALLOC_FL_PUNCH_HOLE turns a range back into a hole.  So the database is
+ *  compressed in place.  The occupancy bitmap says which slots are free and
+ *  lseek(SEEK_DATA/SEEK_HOLE) says which parts of the file are allocated,
+ *  so only blocks that hold deleted records are visited and punched.  The
+ *  cost follows the amount of deleted data rather than the size of the file.
+ *
+ *  If the file system does not support hole punching, the original plan is
+ *  used instead: every valid student is copied to a temporary database file
+ *  which is then renamed to the name of the real database file:
+ *
+ *         #define DB_FILE     "student.db"        //name of database file
+ *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *
+ *  In that case the fd passed in is closed and the fd of the new compressed
+ *  file is returned, so callers must always use the returned fd.  The copy
+ *  is only made while no other process has the database open, otherwise
+ *  M_ERR_DB_BUSY is printed and nothing changes.
+ *
+ *  returns:  <number>       returns the fd of the compressed database file
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
+ *            M_DB_RECLAIMED   on success, bytes of storage freed and time taken
+ *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
+ *                             this error should also be returned after you
+ *                             compressed the database file and if you are unable
+ *                             to open it to pass the fd back to the caller
+ *            M_ERR_DB_CREATE  error creating the db file. For instance the
+ *                             inability to copy the temporary file back as
+ *                             the primary database file.
+ *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
+ *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *            M_ERR_DB_BUSY    no hole punching and another process has the
+ *                             database open
+ *
+ */
+int compress_db(int fd)
+{
+    struct timespec start;
+    struct stat before, after;
+    db_header_t hdr;
+    bool unsupported = false;
+    db_occmap_t *occ;
+
+    if (wal_flush(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    occ = occ_map_new();
+
+    // a slot must not be filled between reading the bitmap and punching it
+    if (occ == NULL || lock_change(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        occ_map_free(occ);
+        return ERR_DB_FILE;
+    }
+
+    if (fstat(fd, &before) == -1 || load_occupancy(fd, &hdr, occ) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        lock_header(fd, F_UNLCK);
+        occ_map_free(occ);
+        return ERR_DB_FILE;
+    }
+
+    int rc = db_paged(fd) ? punch_free_pages(fd)
+                          : punch_free_slots(fd, occ, before.st_blksize, &unsupported);
+    if (rc != NO_ERROR)
+    {
+        if (!unsupported)
+        {
+            printf(M_ERR_DB_WRITE);
+            lock_header(fd, F_UNLCK);
+            occ_map_free(occ);
+            return ERR_DB_FILE;
+        }
+
+        // closing the old file drops its locks
+        int nfd = rewrite_db(fd, occ);
+        if (nfd < 0)
+        {
+            lock_header(fd, F_UNLCK);
+            occ_map_free(occ);
+            return ERR_DB_FILE;
+        }
+        fd = nfd;
+    }
+    else if (lock_header(fd, F_UNLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        occ_map_free(occ);
+        return ERR_DB_FILE;
+    }
+    occ_map_free(occ);
+
+    if (fstat(fd, &after) == -1)
+    {
+        printf(M_ERR_DB_READ);
+        return fd;
+    }
+
+    long long reclaimed = ((long long)before.st_blocks - after.st_blocks) * 512;
+    printf(M_DB_COMPRESSED_OK);
+    printf(M_DB_RECLAIMED, reclaimed > 0 ? reclaimed : 0, elapsed_ms(&start));
+    return fd;
+}
+
+/*
+ *  parse_import_line
+ *      line:  one line of import input, modified in place
+ *      *s:    record built from the line
  *
- *     printf(STUDENT_PRINT_HDR_STRING, "ID",
- *                  "FIRST NAME", "LAST_NAME", "GPA");
+ *  Accepts "id,first_name,last_name,gpa" with fields separated by commas or
+ *  tabs.  The gpa may be given either as the 3 digit int used by -a or as a
+ *  real gpa with a decimal point (3.45), which is converted to an int.
+ *  The id and gpa are range checked before they are narrowed to an int,
+ *  and a line with more than 4 fields is refused rather than cut short.
  *
- *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
- *                    student.lname, calculated_gpa_from_s);
+ *  returns:  NO_ERROR if the line holds a valid student
+ *            EXIT_FAIL_ARGS if the line is malformed or out of range
+ */
+static int parse_import_line(char *line, student_t *s)
+{
+    char *fields[4];
+    char *end;
+    int nfields = 0;
+    char *p = line;
+
+    // split into exactly 4 fields, a separator after the 4th is a 5th field
+    while (1) {
+        fields[nfields++] = p;
+        p += strcspn(p, ",\t\r\n");
+        if (*p != ',' && *p != '\t')
+            break;
+        if (nfields == 4)
+            return EXIT_FAIL_ARGS;
+        *p++ = '\0';
+    }
+    if (nfields != 4)
+        return EXIT_FAIL_ARGS;
+    *p = '\0';
+
+    memset(s, 0, STUDENT_RECORD_SIZE);
+
+    long id = strtol(fields[0], &end, 10);
+    if (end == fields[0] || *end != '\0' || id < MIN_STD_ID || id > max_std_id())
+        return EXIT_FAIL_ARGS;
+
+    double gpa = strtod(fields[3], &end);
+    if (end == fields[3] || *end != '\0')
+        return EXIT_FAIL_ARGS;
+    if (strchr(fields[3], '.') != NULL)
+        gpa = gpa * 100.0 + 0.5;
+    // the cast below truncates, so anything under MAX_STD_GPA + 1 fits
+    if (!isfinite(gpa) || gpa < MIN_STD_GPA || gpa >= MAX_STD_GPA + 1)
+        return EXIT_FAIL_ARGS;
+
+    s->id = (int)id;
+    s->gpa = (int)gpa;
+    if (validate_range(s->id, s->gpa) != NO_ERROR)
+        return EXIT_FAIL_ARGS;
+
+    strncpy(s->fname, fields[1], sizeof(s->fname) - 1);
+    strncpy(s->lname, fields[2], sizeof(s->lname) - 1);
+    return NO_ERROR;
+}
+
+// sort rows by id, ties keep their input order so the first row of an id wins
+static int cmp_import_row(const void *a, const void *b)
+{
+    const import_row_t *ra = a;
+    const import_row_t *rb = b;
+
+    if (ra->rec.id != rb->rec.id)
+        return ra->rec.id < rb->rec.id ? -1 : 1;
+    return ra->line - rb->line;
+}
+
+/*
+ *  import_runs
+ *      fd:     linux file descriptor
+ *      rows:   sorted rows with unique ids
+ *      n:      number of rows
+ *      buf:    scratch space for n records
+ *      io:     scratch space for n transfers
+ *      *occ:   occupancy bitmap, updated for the students written
  *
- *  Dont forget that  the GPA in the student structure is an int, to convert
- *  it into a real gpa divide by 100.0 and store in a float variable.
+ *  Writes each run of consecutive ids with a single write, and hands all
+ *  the runs to db_read_many() and db_write_many() at once.  The existing
+ *  slots are read first so students that are already in the database are
+ *  kept rather than overwritten.
  *
- *  returns:  nothing, this is a void function
+ *  returns:  number of duplicate rows skipped, or ERR_DB_FILE
+ */
+static int import_runs(int fd, import_row_t *rows, int n, student_t *buf, db_io_t *io, db_occmap_t *occ)
+{
+    int nio = 0, nwrite = 0;
+    int dups = 0;
+
+    // slots past the end of the file read as empty
+    memset(buf, 0, (size_t)n * STUDENT_RECORD_SIZE);
+    for (int start = 0, len; start < n; start += len) {
+        len = 1;
+        while (start + len < n && rows[start + len].rec.id == rows[start].rec.id + len)
+            len++;
+        io[nio++] = (db_io_t){&buf[start], (size_t)len * STUDENT_RECORD_SIZE,
+                              (off_t)rows[start].rec.id * STUDENT_RECORD_SIZE, -1};
+    }
+    if (db_read_many(fd, io, nio) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (int k = 0; k < nio; k++) {
+        student_t *run = io[k].buf;
+        int first = run - buf;
+        int len = io[k].len / STUDENT_RECORD_SIZE;
+        int run_dups = 0;
+
+        if (io[k].res == -1)
+            return ERR_DB_FILE;
+        for (int i = first; i < first + len; i++) {
+            if (memcmp(&buf[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
+                run_dups++;
+            } else {
+                buf[i] = rows[i].rec;
+                if (occ_map_set(occ, rows[i].rec.id) != NO_ERROR)
+                    return ERR_DB_FILE;
+            }
+        }
+
+        dups += run_dups;
+        if (run_dups < len)
+            io[nwrite++] = io[k];
+    }
+
+    if (db_write_many(fd, io, nwrite) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int k = 0; k < nwrite; k++) {
+        if (io[k].res != (ssize_t)io[k].len)
+            return ERR_DB_FILE;
+    }
+
+    return dups;
+}
+
+// next free row of the import array, grown as needed, NULL if out of memory
+static import_row_t *import_next_row(import_row_t **rows, int nrows, int *cap)
+{
+    if (nrows == *cap) {
+        int grown_cap = *cap ? *cap * 2 : IMPORT_INIT_ROWS;
+        import_row_t *grown = realloc(*rows, grown_cap * sizeof(import_row_t));
+        if (grown == NULL)
+            return NULL;
+        *rows = grown;
+        *cap = grown_cap;
+    }
+    return &(*rows)[nrows];
+}
+
+/*
+ *  import_read_csv
+ *      in:        import input
+ *      **rows:    row array to fill, grown as needed
+ *      *invalid:  incremented for every invalid line
+ *
+ *  returns:  number of rows read
+ *            ERR_DB_FILE    out of memory
+ *
+ *  console:  M_ERR_IMPORT_LINE  for every malformed or out of range line
+ */
+static int import_read_csv(FILE *in, import_row_t **rows, int *invalid)
+{
+    char *line = NULL;
+    size_t line_cap = 0;
+    int nrows = 0, cap = 0, lineno = 0;
+
+    while (getline(&line, &line_cap, in) != -1) {
+        lineno++;
+
+        // blank lines and a leading header row are not errors
+        if (line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if (lineno == 1 && (line[0] < '0' || line[0] > '9'))
+            continue;
+
+        import_row_t *row = import_next_row(rows, nrows, &cap);
+        if (row == NULL) {
+            nrows = ERR_DB_FILE;
+            break;
+        }
+
+        if (parse_import_line(line, &row->rec) != NO_ERROR) {
+            printf(M_ERR_IMPORT_LINE, lineno);
+            (*invalid)++;
+            continue;
+        }
+        row->line = lineno;
+        nrows++;
+    }
+    free(line);
+    return nrows;
+}
+
+/*
+ *  import_read_bin
+ *      in:        import input, positioned at a db_export_hdr_t
+ *      name:      name of the input for messages
+ *      **rows:    row array to fill, grown as needed
+ *      *invalid:  incremented for every invalid record
+ *
+ *  Reads an export_db() binary stream in large blocks, the record number
+ *  standing in for the line number.  The whole stream is rejected if its
+ *  header is wrong or it does not hold the records the header promises.
+ *
+ *  returns:  number of rows read
+ *            ERR_DB_FILE    bad or truncated stream, or out of memory
+ *
+ *  console:  M_ERR_IMPORT_FORMAT  the stream is not a valid export
+ *            M_ERR_IMPORT_LINE    for every out of range record, or one
+ *                                 with a name validate_name() rejects
+ */
+static int import_read_bin(FILE *in, char *name, import_row_t **rows, int *invalid)
+{
+    db_export_hdr_t xh;
+    student_t *blk;
+    int nrows = 0, cap = 0, nread = 0;
+    size_t n;
+
+    if (fread(&xh, sizeof(xh), 1, in) != 1 ||
+        memcmp(xh.magic, DB_EXPORT_MAGIC, sizeof(xh.magic)) != 0 ||
+        xh.version != DB_EXPORT_VERSION || xh.rec_size != STUDENT_RECORD_SIZE ||
+        xh.count < 0) {
+        printf(M_ERR_IMPORT_FORMAT, name);
+        return ERR_DB_FILE;
+    }
+
+    blk = malloc((size_t)IMPORT_RUN_MAX * STUDENT_RECORD_SIZE);
+    if (blk == NULL)
+        return ERR_DB_FILE;
+
+    while ((n = fread(blk, 1, (size_t)IMPORT_RUN_MAX * STUDENT_RECORD_SIZE, in)) > 0) {
+        // only a cut off stream ends in the middle of a record
+        if (n % STUDENT_RECORD_SIZE != 0) {
+            nread = -1;
+            break;
+        }
+        for (size_t i = 0; i < n / STUDENT_RECORD_SIZE; i++) {
+            student_t *s = &blk[i];
+
+            nread++;
+            s->fname[sizeof(s->fname) - 1] = '\0';
+            s->lname[sizeof(s->lname) - 1] = '\0';
+            if (validate_range(s->id, s->gpa) != NO_ERROR ||
+                validate_name(s->fname) != NO_ERROR || validate_name(s->lname) != NO_ERROR) {
+                printf(M_ERR_IMPORT_LINE, nread);
+                (*invalid)++;
+                continue;
+            }
+
+            import_row_t *row = import_next_row(rows, nrows, &cap);
+            if (row == NULL) {
+                free(blk);
+                return ERR_DB_FILE;
+            }
+            row->rec = *s;
+            row->line = nread;
+            nrows++;
+        }
+    }
+    free(blk);
+
+    if (ferror(in) || nread != xh.count) {
+        printf(M_ERR_IMPORT_FORMAT, name);
+        return ERR_DB_FILE;
+    }
+    return nrows;
+}
+
+/*
+ *  import_db
+ *      fd:     linux file descriptor
+ *      path:   file of records to load, NULL or "-" for stdin
+ *
+ *  Bulk loads a roster in one process.  The input is either csv lines or an
+ *  export_db() binary stream, told apart by its first byte.  Every row is
+ *  checked with validate_range() and validate_name(), the rows are sorted
+ *  by id and runs of consecutive ids are written with one large write each
+ *  instead of one add_student() per row.  Students already in the database,
+ *  and repeated ids in the input after their first occurrence, are skipped.
+ *  The span of ids being loaded and the header stay locked until the load
+ *  is committed.
+ *
+ *  returns:  number of students imported on success
+ *            ERR_DB_OP      invalid rows were skipped, the valid ones are
+ *                           imported all the same
+ *            ERR_DB_FILE    database or import file I/O issue
+ *
+ *  console:  M_DB_IMPORTED      number of students loaded
+ *            M_DB_IMPORT_SKIP   if any rows were skipped
+ *            M_ERR_IMPORT_LINE  for every malformed or out of range line
+ *            M_ERR_IMPORT_OPEN  the import file could not be opened
+ *            M_ERR_IMPORT_FORMAT  a binary stream is bad or truncated
+ *            M_ERR_DB_WRITE     error writing the database file
+ */
+int import_db(int fd, char *path)
+{
+    FILE *in = stdin;
+    import_row_t *rows = NULL;
+    student_t *buf = NULL;
+    db_io_t *io = NULL;
+    db_occmap_t *occ = NULL;
+    db_header_t hdr;
+    int nrows = 0;
+    int imported = 0, skipped = 0, invalid = 0;
+    int rc = NO_ERROR;
+    off_t lock_off = 0, lock_len = STUDENT_RECORD_SIZE;
+    bool locked = false;
+
+    if (wal_flush(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    if (path != NULL && strcmp(path, "-") != 0) {
+        in = fopen(path, "rb");
+        if (in == NULL) {
+            printf(M_ERR_IMPORT_OPEN, path);
+            return ERR_DB_FILE;
+        }
+    }
+
+    int c = getc(in);
+    if (c != EOF)
+        ungetc(c, in);
+    if (c == (unsigned char)DB_EXPORT_MAGIC[0])
+        nrows = import_read_bin(in, in == stdin ? "-" : path, &rows, &invalid);
+    else
+        nrows = import_read_csv(in, &rows, &invalid);
+    if (nrows < 0) {
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    // an export is already in id order, only sort input that is not
+    for (int i = 1; i < nrows; i++) {
+        if (cmp_import_row(&rows[i - 1], &rows[i]) > 0) {
+            qsort(rows, nrows, sizeof(import_row_t), cmp_import_row);
+            break;
+        }
+    }
+
+    // drop repeated ids, keeping the first occurrence in the input
+    int nuniq = 0;
+    for (int i = 0; i < nrows; i++) {
+        if (nuniq > 0 && rows[nuniq - 1].rec.id == rows[i].rec.id) {
+            skipped++;
+            continue;
+        }
+        rows[nuniq++] = rows[i];
+    }
+
+    buf = malloc((size_t)IMPORT_RUN_MAX * STUDENT_RECORD_SIZE);
+    io = malloc(IMPORT_RUN_MAX * sizeof(db_io_t));
+    occ = occ_map_new();
+    if (buf == NULL || io == NULL || occ == NULL) {
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    // lock the id range being loaded, then the header, in the same order
+    // add_student() takes them
+    if (nuniq > 0) {
+        lock_off = (off_t)rows[0].rec.id * STUDENT_RECORD_SIZE;
+        lock_len = (off_t)(rows[nuniq - 1].rec.id - rows[0].rec.id + 1) * STUDENT_RECORD_SIZE;
+    }
+    if (lock_range(fd, F_WRLCK, lock_off, lock_len, true) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+    locked = true;
+    if (lock_change(fd) != NO_ERROR || wal_catch_up(fd, false, NULL) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    // the bitmap and header are written once, after all the runs
+    if (load_occupancy(fd, &hdr, occ) != NO_ERROR ||
+        begin_occupancy_update(&hdr) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    // write IMPORT_RUN_MAX rows at a time, each run of consecutive ids in one go
+    for (int start = 0; start < nuniq; start += IMPORT_RUN_MAX) {
+        int n = nuniq - start < IMPORT_RUN_MAX ? nuniq - start : IMPORT_RUN_MAX;
+
+        int dups = import_runs(fd, &rows[start], n, buf, io, occ);
+        if (dups < 0) {
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+            goto done;
+        }
+        imported += n - dups;
+        skipped += dups;
+    }
+
+    hdr.count += imported;
+    if (store_occupancy(fd, &hdr, occ) != NO_ERROR || rebuild_name_index(fd) < 0 ||
+        rebuild_columns(fd) < 0) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    printf(M_DB_IMPORTED, imported);
+    if (skipped + invalid > 0)
+        printf(M_DB_IMPORT_SKIP, skipped + invalid);
+    rc = invalid > 0 ? ERR_DB_OP : imported;
+
+done:
+    if (locked) {
+        lock_header(fd, F_UNLCK);
+        lock_range(fd, F_UNLCK, lock_off, lock_len, false);
+    }
+    if (in != stdin)
+        fclose(in);
+    free(rows);
+    free(buf);
+    free(io);
+    occ_map_free(occ);
+    return rc;
+}
+
+/*
+ *  format_csv_row
+ *      dst:    buffer of at least DB_ROW_MAX bytes
+ *      *s:     student to format
+ *
+ *  Formats s as an "id,first_name,last_name,gpa" line import_db() reads
+ *  back, with the gpa as the 3 digit int used by -a.
+ *
+ *  returns:  length of the line
+ */
+static int format_csv_row(char *dst, const student_t *s)
+{
+    char *p = dst;
+    size_t n;
+
+    p = fmt_uint(p, (unsigned)s->id);
+    *p++ = ',';
+    n = strnlen(s->fname, sizeof(s->fname));
+    memcpy(p, s->fname, n);
+    p += n;
+    *p++ = ',';
+    n = strnlen(s->lname, sizeof(s->lname));
+    memcpy(p, s->lname, n);
+    p += n;
+    *p++ = ',';
+    p = fmt_uint(p, (unsigned)s->gpa);
+    *p++ = '\n';
+    return p - dst;
+}
+
+/*
+ *  export_db
+ *      fd:       linux file descriptor
+ *      format:   "csv" or "bin"
+ *      path:     file to write, NULL or "-" for stdout
+ *
+ *  Writes every student in id order so the roster can be copied or backed
+ *  up, and loaded again with import_db().  bin is a db_export_hdr_t
+ *  followed by the student records exactly as they sit in the database,
+ *  so each run of occupied slots is copied without looking at the records.
+ *  csv is one line per student.  Names holding a comma or tab do not
+ *  survive csv, bin keeps every byte.
+ *
+ *  Like print_db() the bitmap says where the runs are.  The export reads a
+ *  snapshot pinned when it starts, so the copy is consistent and writers
+ *  do not wait for it to finish.
+ *
+ *  returns:  number of students exported
+ *            ERR_DB_FILE    database or export file I/O issue
+ *
+ *  console:  the export itself when writing to stdout
+ *            M_DB_EXPORTED      number of students written to a file
+ *            M_ERR_EXPORT_OPEN  the export file could not be created
+ *            M_ERR_DB_READ      error reading the database file
+ *            M_ERR_DB_WRITE     error writing the export
+ */
+int export_db(int fd, char *format, char *path)
+{
+    bool binary = strcmp(format, "bin") == 0;
+    int out_fd = STDOUT_FILENO;
+    db_out_t out = {0};
+    db_header_t hdr;
+    db_occmap_t *occ = NULL;
+    student_t *blk = NULL;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    int exported = 0;
+    int rc = NO_ERROR;
+
+    if (wal_flush(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    if (path != NULL && strcmp(path, "-") != 0) {
+        out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+        if (out_fd == -1) {
+            printf(M_ERR_EXPORT_OPEN, path);
+            return ERR_DB_FILE;
+        }
+    }
+
+    occ = occ_map_new();
+    blk = malloc(OCC_SCAN_RECS * STUDENT_RECORD_SIZE);
+    if (occ == NULL || blk == NULL || db_out_open(&out, out_fd) != NO_ERROR ||
+        snap_pin(fd, &hdr, occ) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    if (binary) {
+        db_export_hdr_t xh = {0};
+
+        memcpy(xh.magic, DB_EXPORT_MAGIC, sizeof(xh.magic));
+        xh.version = DB_EXPORT_VERSION;
+        xh.rec_size = STUDENT_RECORD_SIZE;
+        xh.count = hdr.count;
+        rc = db_out_write(&out, &xh, sizeof(xh));
+    } else {
+        static const char csv_hdr[] = "id,first_name,last_name,gpa\n";
+        rc = db_out_write(&out, csv_hdr, sizeof(csv_hdr) - 1);
+    }
+
+    int id = MIN_STD_ID;
+    int n;
+    while (rc == NO_ERROR && (n = read_occupied(fd, occ, &id, blk)) != 0) {
+        if (n < 0) {
+            printf(M_ERR_DB_READ);
+            rc = ERR_DB_FILE;
+            goto done;
+        }
+        if (binary) {
+            rc = db_out_write(&out, blk, (size_t)n * STUDENT_RECORD_SIZE);
+        } else {
+            for (int i = 0; i < n; i++) {
+                if (out.len + DB_ROW_MAX > DB_OUT_BUF_SZ &&
+                    (rc = db_out_flush(&out)) != NO_ERROR)
+                    break;
+                out.len += format_csv_row(out.buf + out.len, &blk[i]);
+            }
+        }
+        exported += n;
+    }
+
+    if (rc == NO_ERROR)
+        rc = db_out_flush(&out);
+    if (rc == NO_ERROR && out_fd != STDOUT_FILENO && fsync(out_fd) == -1)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        goto done;
+    }
+
+    if (out_fd != STDOUT_FILENO)
+        printf(M_DB_EXPORTED, exported, path);
+    rc = exported;
+
+done:
+    snap_unpin(fd);
+    if (out_fd != STDOUT_FILENO)
+        close(out_fd);
+    free(out.buf);
+    occ_map_free(occ);
+    free(blk);
+    return rc;
+}
+
+/*
+ *  report_find
+ *      rc:   what get_student() returned
+ *      id:   student looked up
+ *      *s:   the student found
+ *
+ *  Console output and exit code of -f for a get_student() result.
+ *
+ *  returns:  EXIT_OK if the student was found, EXIT_FAIL_DB otherwise
+ */
+static int report_find(int rc, int id, student_t *s)
+{
+    switch (rc)
+    {
+    case NO_ERROR:
+        print_student(s);
+        return EXIT_OK;
+    case SRCH_NOT_FOUND:
+        printf(M_STD_NOT_FND_MSG, id);
+        return EXIT_FAIL_DB;
+    default:
+        printf(M_ERR_DB_READ);
+        return EXIT_FAIL_DB;
+    }
+}
+
+/*
+ *  parse_db_command
+ *      line:     one command, modified in place
+ *      exename:  program name, becomes argv[0]
+ *      argv:     receives the words, SDB_CMD_MAX_ARGS + 2 entries
+ *      opt:      3 bytes of storage for the option if it has no dash
  *
+ *  Splits a command line such as "-a 1 john doe 345" into the argv layout
+ *  exec_db_command() takes.  The dash of a single letter option is
+ *  optional, "a 1 john doe 345" works too.
+ *
+ *  returns:  argc (1 for a blank line), or -1 if there are too many words
+ */
+int parse_db_command(char *line, char *exename, char *argv[], char *opt)
+{
+    char *save = NULL;
+    int argc = 1;
+
+    argv[0] = exename;
+    for (char *w = strtok_r(line, " \t\r\n", &save); w != NULL; w = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (argc > SDB_CMD_MAX_ARGS)
+            return -1;
+        argv[argc++] = w;
+    }
+
+    if (argc > 1 && argv[1][0] != '-' && argv[1][1] == '\0')
+    {
+        opt[0] = '-';
+        opt[1] = argv[1][0];
+        opt[2] = '\0';
+        argv[1] = opt;
+    }
+    return argc;
+}
+
+// batch_db() sorts by id, and keeps same id ops in input order
+static int cmp_batch_id(const void *a, const void *b)
+{
+    const batch_op_t *x = a, *y = b;
+
+    if (x->s.id != y->s.id)
+        return x->s.id < y->s.id ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+static int cmp_batch_seq(const void *a, const void *b)
+{
+    return ((const batch_op_t *)a)->seq - ((const batch_op_t *)b)->seq;
+}
+
+/*
+ *  batch_find
+ *      fd:   linux file descriptor
+ *      ops:  queued ops, the first one is a find
+ *      n:    number of ops
  *
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_STD_PRINT  if the function argument s is NULL or if
- *                             s->id is zero
+ *  Runs the finds at the front of ops with one get_students() call.
  *
+ *  returns:  number of finds run
  */
-void print_student(student_t *s)
+static int batch_find(int fd, batch_op_t *ops, int n)
 {
-    // ensuring provided pointer is valid
-    if (s == NULL || s->id == DELETED_STUDENT_ID) {
-        printf(M_ERR_STD_PRINT);
-        return;
+    int nfind = 0;
+
+    while (nfind < n && ops[nfind].opt == 'f')
+        nfind++;
+
+    int *ids = malloc(nfind * sizeof(int));
+    int *rcs = malloc(nfind * sizeof(int));
+    student_t *found = malloc(nfind * sizeof(student_t));
+    if (ids != NULL && rcs != NULL && found != NULL)
+    {
+        for (int i = 0; i < nfind; i++)
+            ids[i] = ops[i].s.id;
+        get_students(fd, ids, found, rcs, nfind);
     }
 
-    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+    for (int i = 0; i < nfind; i++)
+    {
+        // a miss leaves whatever was read in s, keep the id for the report
+        int id = ops[i].s.id;
+        if (found == NULL || rcs == NULL || ids == NULL)
+            ops[i].rc = get_student(fd, id, &ops[i].s);
+        else if ((ops[i].rc = rcs[i]) == NO_ERROR)
+            ops[i].s = found[i];
+        ops[i].s.id = id;
+    }
+
+    free(ids);
+    free(rcs);
+    free(found);
+    return nfind;
 }
 
 /*
- *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
- *
- *  compress_db
- *      fd:     linux file descriptor
- *
- *  This assignment takes advantage of the way Linux handles sparse files
- *  on disk. Thus if there is a large hole between student records, Linux
- *  will not use any physical storage.  However, when a database record is
- *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
- *  db.h - record.
- *
- *  Since Linux provides no way to delete data in the middle of a file, and
- *  deleted records take up physical storage, this function will compress the
- *  database by rewriting a new database file that only includes valid student
- *  records. There are a number of ways to do this, but since this is extra credit
- *  you need to figure this out on your own.
+ *  batch_run
+ *      fd:    linux file descriptor
+ *      ops:   queued adds, deletes and finds
+ *      n:     number of ops
  *
- *  At a high level create a temporary database file then copy all valid students from
- *  the active database (passed in via fd) to the temporary file. When this is done
- *  rename the temporary database file to the name of the real database file. See
- *  the constants in db.h for required file names:
- *
- *         #define DB_FILE     "student.db"        //name of database file
- *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *  Runs the queued ops in id order, so the database is walked front to
+ *  back, then prints their output in input order.  Ops on different ids
+ *  don't affect each other and ops on the same id keep their order, so
+ *  the output is the same as running them one by one.
  *
- *  Note that you are passed in the fd of the database file to be compressed,
- *  it is very likely you will need to close it to overwrite it with the
- *  compressed version of the file.  To ensure the caller can work with the
- *  compressed file after you create it, it is a good design to return the fd
- *  of the new compressed file from this function
+ *  returns:  highest exit code of the ops
+ */
+static int batch_run(int fd, batch_op_t *ops, int n)
+{
+    int exit_code = EXIT_OK;
+
+    qsort(ops, n, sizeof(batch_op_t), cmp_batch_id);
+    for (int i = 0; i < n; i++)
+    {
+        batch_op_t *op = &ops[i];
+        switch (op->opt)
+        {
+        case 'a':
+            op->rc = put_student(fd, op->s.id, op->s.fname, op->s.lname, op->s.gpa);
+            break;
+        case 'd':
+            op->rc = clear_student(fd, op->s.id);
+            break;
+        default:
+            // finds next to each other don't change anything, look them up
+            // together and carry on after the last one
+            i += batch_find(fd, &ops[i], n - i) - 1;
+            break;
+        }
+    }
+
+    qsort(ops, n, sizeof(batch_op_t), cmp_batch_seq);
+    for (int i = 0; i < n; i++)
+    {
+        batch_op_t *op = &ops[i];
+        int rc = EXIT_OK;
+        switch (op->opt)
+        {
+        case 'a':
+            report_add(op->rc, op->s.id);
+            rc = op->rc < 0 ? EXIT_FAIL_DB : EXIT_OK;
+            break;
+        case 'd':
+            report_del(op->rc, op->s.id);
+            rc = op->rc < 0 ? EXIT_FAIL_DB : EXIT_OK;
+            break;
+        default:
+            rc = report_find(op->rc, op->s.id, &op->s);
+            break;
+        }
+        if (rc > exit_code)
+            exit_code = rc;
+    }
+    return exit_code;
+}
+
+/*
+ *  batch_db
+ *      *pfd:     descriptor of the open database, updated by -x and -z
+ *      exename:  program name, for usage()
+ *      path:     file of commands, NULL or "-" for stdin
  *
- *  returns:  <number>       returns the fd of the compressed database file
- *            ERR_DB_FILE    database file I/O issue
+ *  Runs a stream of sdbsc commands, one per line in the -a/-d/-f/... form
+ *  (see parse_db_command()), against one open database.  Blank lines and
+ *  lines starting with # are skipped.
  *
+ *  Adds, deletes and finds are queued and run in id order by batch_run().
+ *  Any other command (or a malformed add, delete or find) first runs the
+ *  queue, then runs on its own through exec_db_command(), so it sees
+ *  everything before it.  The output is byte for byte what running each
+ *  line as its own sdbsc command prints.  Batches do not nest, a -b line
+ *  is rejected.
  *
- *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
- *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
- *                             this error should also be returned after you
- *                             compressed the database file and if you are unable
- *                             to open it to pass the fd back to the caller
- *            M_ERR_DB_CREATE  error creating the db file. For instance the
- *                             inability to copy the temporary file back as
- *                             the primary database file.
- *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
- *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *  returns:  highest exit code of the commands, EXIT_FAIL_DB if the batch
+ *            file can't be opened
  *
+ *  console:  the output of every command
+ *            M_ERR_BATCH_OPEN    the batch file could not be opened
+ *            M_ERR_BATCH_NESTED  for every -b line
  */
-int compress_db(int fd)
+int batch_db(int *pfd, char *exename, char *path)
 {
-    // TODO
-    printf(M_NOT_IMPL);
-    return fd;
+    FILE *in = stdin;
+    char *line = NULL;
+    size_t line_cap = 0;
+    batch_op_t *ops = NULL;
+    int nops = 0;
+    int exit_code = EXIT_OK;
+
+    if (path != NULL && strcmp(path, "-") != 0) {
+        in = fopen(path, "r");
+        if (in == NULL) {
+            printf(M_ERR_BATCH_OPEN, path);
+            return EXIT_FAIL_DB;
+        }
+    }
+
+    ops = malloc(BATCH_MAX_OPS * sizeof(batch_op_t));
+    if (ops == NULL) {
+        if (in != stdin)
+            fclose(in);
+        return EXIT_FAIL_DB;
+    }
+
+    while (*pfd >= 0 && getline(&line, &line_cap, in) != -1) {
+        char *argv[SDB_CMD_MAX_ARGS + 2];
+        char opt[3];
+        int rc;
+
+        if (line[strspn(line, " \t")] == '#')
+            continue;
+        int argc = parse_db_command(line, exename, argv, opt);
+        if (argc == 1)
+            continue;
+
+        // queue the commands that only touch one student
+        char cmd = argc > 1 && argv[1][0] == '-' ? argv[1][1] : '\0';
+        int id = argc > 2 ? atoi(argv[2]) : 0;
+        if ((cmd == 'a' && argc == 6 && validate_range(id, atoi(argv[5])) == NO_ERROR &&
+             validate_name(argv[3]) == NO_ERROR && validate_name(argv[4]) == NO_ERROR) ||
+            ((cmd == 'd' || cmd == 'f') && argc == 3)) {
+            batch_op_t *op = &ops[nops];
+            memset(op, 0, sizeof(*op));
+            op->seq = nops;
+            op->opt = cmd;
+            op->s.id = id;
+            if (cmd == 'a') {
+                strncpy(op->s.fname, argv[3], sizeof(op->s.fname) - 1);
+                strncpy(op->s.lname, argv[4], sizeof(op->s.lname) - 1);
+                op->s.gpa = atoi(argv[5]);
+            }
+            if (++nops == BATCH_MAX_OPS) {
+                rc = batch_run(*pfd, ops, nops);
+                exit_code = rc > exit_code ? rc : exit_code;
+                nops = 0;
+            }
+            continue;
+        }
+
+        // everything else runs in order, after what was queued before it
+        rc = batch_run(*pfd, ops, nops);
+        exit_code = rc > exit_code ? rc : exit_code;
+        nops = 0;
+
+        if (argc < 0) {
+            usage(exename);
+            rc = EXIT_FAIL_ARGS;
+        } else if (cmd == 'b') {
+            // a batch file that names itself would never end
+            printf(M_ERR_BATCH_NESTED);
+            rc = EXIT_FAIL_ARGS;
+        } else {
+            rc = exec_db_command(pfd, argc, argv);
+        }
+        exit_code = rc > exit_code ? rc : exit_code;
+    }
+
+    if (*pfd >= 0) {
+        int rc = batch_run(*pfd, ops, nops);
+        exit_code = rc > exit_code ? rc : exit_code;
+    } else {
+        exit_code = EXIT_FAIL_DB;
+    }
+
+    if (in != stdin)
+        fclose(in);
+    free(line);
+    free(ops);
+    return exit_code;
 }
 
 /*
@@ -414,7 +5310,7 @@ int compress_db(int fd)
 int validate_range(int id, int gpa)
 {
 
-    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+    if ((id < MIN_STD_ID) || (id > max_std_id()))
         return EXIT_FAIL_ARGS;
 
     if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
@@ -423,6 +5319,27 @@ int validate_range(int id, int gpa)
     return NO_ERROR;
 }
 
+/*
+ *  validate_name
+ *      name:  proposed first or last name
+ *
+ *  A csv export writes names as they are, so a name holding a field or
+ *  line separator would not read back the same.  Such names are never
+ *  stored.
+ *
+ *  returns:    NO_ERROR       the name has no comma, tab or line break
+ *              EXIT_FAIL_ARGS otherwise
+ *
+ *  console:  This function does not produce any output
+ */
+int validate_name(const char *name)
+{
+    if (name[strcspn(name, ",\t\r\n")] != '\0')
+        return EXIT_FAIL_ARGS;
+
+    return NO_ERROR;
+}
+
 /*
  *  usage
  *      exename:  the name of the executable from argv[0]
@@ -436,60 +5353,69 @@ int validate_range(int id, int gpa)
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|b|c|d|e|f|g|i|l|p|s|v|x|z|S|C] options.  Where:\n", exename);
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-b [file]:  runs one command per line, -a 1 john doe 345 etc (stdin if no file)\n");
     printf("\t-c:  counts the records in the database\n");
     printf("\t-d id:  deletes a student\n");
+    printf("\t-e csv|bin [file]:  exports all students for -i (stdout if no file)\n");
     printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-g min max:  prints students with a gpa(as 3 digit int) in the range\n");
+    printf("\t-i [file]:  bulk imports id,first_name,last_name,gpa rows (stdin if no file)\n");
+    printf("\t-l last_name:  finds and prints all students with a last name\n");
     printf("\t-p:  prints all records in the student database\n");
+    printf("\t-s:  prints gpa statistics and a histogram\n");
+    printf("\t-v:  verifies every page of the database against its checksum\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
     printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-S:  serves requests on the socket student.db.sock until stopped\n");
+    printf("\t-C [option args]:  sends one request (or one per stdin line) to the server\n");
 }
 
-// Welcome to main()
-int main(int argc, char *argv[])
+/*
+ *  exec_db_command
+ *      *pfd:   descriptor of the open database, updated when the command
+ *              replaces it (-x and -z)
+ *      argc:   number of arguments
+ *      argv:   arguments laid out the way main() gets them, argv[1] is the
+ *              option ("-a", "-f", ...)
+ *
+ *  Runs one database command.  main() runs the single command on its
+ *  command line through here, and the server runs each request it gets.
+ *
+ *  returns:  exit code for the command, EXIT_OK, EXIT_FAIL_DB or
+ *            EXIT_FAIL_ARGS
+ *
+ *  console:  whatever the command prints
+ */
+int exec_db_command(int *pfd, int argc, char *argv[])
 {
     char opt;      // user selected option
-    int fd;        // file descriptor of database files
+    int fd = *pfd; // file descriptor of database files
     int rc;        // return code from various operations
     int exit_code; // exit code to shell
     int id;        // userid from argv[2]
     int gpa;       // gpa from argv[5]
+    int min_gpa;   // lower bound of a gpa range from argv[2]
 
     // space for a student structure which we will get back from
     // some of the functions we will be writing such as get_student(),
     // and print_student().
     student_t student = {0};
 
-    // This function must have at least one arg, and the arg must start
-    // with a dash
+    // requests from the server and batch lines get the same check main()
+    // does
     if ((argc < 2) || (*argv[1] != '-'))
     {
         usage(argv[0]);
-        exit(1);
+        return EXIT_FAIL_ARGS;
     }
 
     // The option is the first character after the dash for example
     //-h -a -c -d -f -p -x -z
     opt = (char)*(argv[1] + 1); // get the option flag
 
-    // handle the help flag and then exit normally
-    if (opt == 'h')
-    {
-        usage(argv[0]);
-        exit(EXIT_OK);
-    }
-
-    // now lets open the file and continue if there is no error
-    // note we are not truncating the file using the second
-    // parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0)
-    {
-        exit(EXIT_FAIL_DB);
-    }
-
     // set rc to the return code of the operation to ensure the program
     // use that to determine the proper exit_code.  Look at the header
     // sdbsc.h for expected values.
@@ -520,6 +5446,12 @@ int main(int argc, char *argv[])
             printf(M_ERR_STD_RNG);
             break;
         }
+        if (validate_name(argv[3]) != NO_ERROR || validate_name(argv[4]) != NO_ERROR)
+        {
+            printf(M_ERR_STD_NAME);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
 
         rc = add_student(fd, id, argv[3], argv[4], gpa);
         if (rc < 0)
@@ -527,6 +5459,20 @@ int main(int argc, char *argv[])
 
         break;
 
+    case 'b':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -b  [file]
+        //-------------------------
+        // example:  prog_name -b ops.txt
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        exit_code = batch_db(&fd, argv[0], argc == 3 ? argv[2] : NULL);
+        break;
+
     case 'c':
         //    arv[0] arv[1]
         // prog_name     -c
@@ -568,21 +5514,91 @@ int main(int argc, char *argv[])
         }
         id = atoi(argv[2]);
         rc = get_student(fd, id, &student);
+        exit_code = report_find(rc, id, &student);
+        break;
+
+    case 'g':
+        //    arv[0] arv[1] arv[2] arv[3]
+        // prog_name     -g    min    max
+        //--------------------------------
+        // example:  prog_name -g 350 400
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        min_gpa = atoi(argv[2]);
+        gpa = atoi(argv[3]);
+        if (validate_range(MIN_STD_ID, min_gpa) != NO_ERROR ||
+            validate_range(MIN_STD_ID, gpa) != NO_ERROR || min_gpa > gpa)
+        {
+            printf(M_ERR_GPA_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = query_gpa_range(fd, min_gpa, gpa);
+        if (rc <= 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
 
-        switch (rc)
+    case 'i':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -i  [file]
+        //-------------------------
+        // example:  prog_name -i roster.csv
+        if (argc > 3)
         {
-        case NO_ERROR:
-            print_student(&student);
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
             break;
-        case SRCH_NOT_FOUND:
-            printf(M_STD_NOT_FND_MSG, id);
+        }
+        rc = import_db(fd, argc == 3 ? argv[2] : NULL);
+        if (rc < 0)
             exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'e':
+        //    arv[0] arv[1]    arv[2]  arv[3]
+        // prog_name     -e  csv|bin  [file]
+        //-----------------------------------
+        // example:  prog_name -e bin roster.bin
+        if (argc < 3 || argc > 4 ||
+            (strcmp(argv[2], "csv") != 0 && strcmp(argv[2], "bin") != 0))
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
             break;
-        default:
-            printf(M_ERR_DB_READ);
+        }
+        rc = export_db(fd, argv[2], argc == 4 ? argv[3] : NULL);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'v':
+        //    arv[0] arv[1]
+        // prog_name     -v
+        //-----------------
+        // example:  prog_name -v
+        rc = verify_db(fd);
+        if (rc != 0)
             exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'l':
+        //    arv[0] arv[1]     arv[2]
+        // prog_name     -l  last_name
+        //----------------------------
+        // example:  prog_name -l doe
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
             break;
         }
+        rc = find_students_by_lname(fd, argv[2]);
+        if (rc <= 0)
+            exit_code = EXIT_FAIL_DB;
         break;
 
     case 'p':
@@ -595,6 +5611,16 @@ int main(int argc, char *argv[])
             exit_code = EXIT_FAIL_DB;
         break;
 
+    case 's':
+        //    arv[0] arv[1]
+        // prog_name     -s
+        //-----------------
+        // example:  prog_name -s
+        rc = print_gpa_stats(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'x':
         //    arv[0] arv[1]
         // prog_name     -x
@@ -615,23 +5641,112 @@ int main(int argc, char *argv[])
         // example:  prog_name -x
         // HINT:  close the db file, we already have fd
         //       and reopen db indicating truncate=true
-        close(fd);
+        // the emptied database keeps its layout
+        if (db_paged(fd))
+            setenv(DB_LAYOUT_ENV, DB_LAYOUT_PAGED_NAME, 1);
+        close_db(fd);
         fd = open_db(DB_FILE, true);
         if (fd < 0)
         {
+            // a database another process has open is left as it was, and
+            // a server keeps serving it
+            fd = open_db(DB_FILE, false);
             exit_code = EXIT_FAIL_DB;
             break;
         }
         printf(M_DB_ZERO_OK);
         exit_code = EXIT_OK;
         break;
+    case 'h':
+        usage(argv[0]);
+        break;
+
     default:
         usage(argv[0]);
         exit_code = EXIT_FAIL_ARGS;
     }
 
+    *pfd = fd;
+    return exit_code;
+}
+
+// the benchmark in bench/ links this file and brings its own main()
+#ifndef SDBSC_NO_MAIN
+// Welcome to main()
+int main(int argc, char *argv[])
+{
+    char opt;      // user selected option
+    int fd;        // file descriptor of database files
+    int exit_code; // exit code to shell
+
+    // This function must have at least one arg, and the arg must start
+    // with a dash
+    if ((argc < 2) || (*argv[1] != '-'))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // The option is the first character after the dash for example
+    //-h -a -c -d -f -p -x -z
+    opt = (char)*(argv[1] + 1); // get the option flag
+
+    // handle the help flag and then exit normally
+    if (opt == 'h')
+    {
+        usage(argv[0]);
+        exit(EXIT_OK);
+    }
+
+    // the client talks to a running server and never opens the database
+    if (opt == 'C')
+    {
+        exit(run_client(argc - 2, argv + 2));
+    }
+
+    // the server keeps the database mapped unless told otherwise
+    if (opt == 'S')
+    {
+        setenv(DB_BACKEND_ENV, DB_BACKEND_MMAP, 0);
+    }
+
+    // now lets open the file and continue if there is no error
+    // note we are not truncating the file using the second
+    // parameter
+    fd = open_db(DB_FILE, false);
+    if (fd < 0)
+    {
+        exit(EXIT_FAIL_DB);
+    }
+
+    if (opt == 'S')
+    {
+        //    arv[0] arv[1]
+        // prog_name     -S
+        //-----------------
+        // example:  prog_name -S
+        if (argc != 2)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+        }
+        else
+        {
+            exit_code = run_server(&fd, argv[0]);
+        }
+    }
+    else
+    {
+        exit_code = exec_db_command(&fd, argc, argv);
+    }
+
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
-    close(fd);
+    if (fd >= 0 && close_db(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        exit_code = EXIT_FAIL_DB;
+    }
     exit(exit_code);
 }
+#endif
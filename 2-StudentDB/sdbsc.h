@@ -1,18 +1,274 @@
 #ifndef __SDB_H__
+    #define __SDB_H__
 
 #include "db.h" //get student record type
 
+//state kept by the mmap storage backend (see open_db() in sdbsc.c)
+typedef struct db_map {
+    int     fd;     //descriptor the mapping belongs to, -1 if none
+    char   *base;   //start of the shared mapping, NULL if the file is empty
+    size_t  len;    //bytes mapped, always equal to the file size
+} db_map_t;
+
+//every process that has the database open read locks this byte, far past
+//any record, so compress_db() can tell when it has the file to itself
+#define DB_LOCK_OPEN    (((off_t)MAX_PAGED_STD_ID + 1) * 64)
+
+//one parsed row of a bulk import, line is kept so sorting can stay stable
+typedef struct import_row {
+    int       line;
+    student_t rec;
+} import_row_t;
+
+#define IMPORT_INIT_ROWS    4096    //initial capacity of the row array
+#define IMPORT_RUN_MAX      16384   //rows read and written per batch (1MB)
+
+//the occupancy bitmap side file that belongs to the open database
+typedef struct db_occ {
+    int fd;         //database descriptor the bitmap belongs to
+    int bmp_fd;     //descriptor of the bitmap file
+} db_occ_t;
+
+//the page directory of a paged database, mapped MAP_SHARED (see dir_open())
+#define DIR_ROOT_OFF    DB_PAGE_SIZE    //root entries follow the header page
+#define DIR_LEAF_OFF    (DIR_ROOT_OFF + DB_DIR_ROOT_ENTRIES * sizeof(unsigned int))
+typedef struct db_dir {
+    int     fd;     //database descriptor the directory belongs to
+    int     dir_fd; //descriptor of the directory file
+    char   *base;   //start of the mapping
+    size_t  len;    //bytes mapped
+} db_dir_t;
+
+//the page checksum file that belongs to the open database
+#define CRC_BATCH_PAGES 256     //checksums written or checked per call (1MB)
+typedef struct db_crc {
+    int fd;         //database descriptor the checksums belong to
+    int crc_fd;     //descriptor of the checksum file
+} db_crc_t;
+
+//the last name index file that belongs to the open database
+#define IDX_READ_ENTRIES 64     //index entries read per call by -l (4KB)
+typedef struct db_idx {
+    int fd;         //database descriptor the index belongs to
+    int idx_fd;     //descriptor of the index file
+} db_idx_t;
+
+//server side of one client connection (see run_server() in sdbsc_server.c)
+#define SDB_SVR_MAX_CLIENTS     64          //connections served at once
+#define SDB_SVR_BACKLOG         20          //pending connections for listen()
+#define SDB_SVR_LINE_MAX        1024        //longest request line
+#define SDB_CMD_MAX_ARGS        16          //words in a request line
+typedef struct sdb_client {
+    int     sock;                   //connected socket, -1 if the slot is free
+    size_t  len;                    //bytes of the partial request in buf
+    char    buf[SDB_SVR_LINE_MAX];
+    int     out_fd;                 //memfd holding the reply being sent
+    off_t   out_off;                //bytes of the reply already sent
+    off_t   out_len;                //bytes of the reply, 0 if none pending
+} sdb_client_t;
+
+//every reply ends with this char followed by one byte holding the exit code
+//of the request, same EOF char the remote shell uses
+static const char SDB_SVR_EOF_CHAR = 0x04;
+
+//one add, delete or find queued by batch_db()
+#define BATCH_MAX_OPS   65536   //ops sorted and run as one group
+typedef struct batch_op {
+    int       seq;      //position in the batch, output goes in this order
+    char      opt;      //'a', 'd' or 'f'
+    int       rc;       //what the operation returned
+    student_t s;        //student to add, or the student found
+} batch_op_t;
+
+#define OCC_SCAN_RECS   1024    //records read per block by scans (64K)
+
+//occupancy of every student id, bit id % 64 of word id / 64, kept in chunks
+//that are only allocated once one of their ids is set, so a map costs memory
+//in proportion to where the students are and not to the largest id
+#define OCC_CHUNK_WORDS     DB_DIR_LEAF_ENTRIES     //a chunk covers one directory leaf
+#define OCC_END             0x7fffffff              //INT_MAX, past the last student
+typedef struct db_occmap {
+    uint64_t  **chunks;     //chunk c holds words c * OCC_CHUNK_WORDS .., or NULL
+    int         nchunks;    //room in chunks
+} db_occmap_t;
+
+//iterator over the allocated extents of the database (see db_scan_open())
+typedef struct db_scan {
+    int        fd;
+    off_t      pos;         //next file offset to read
+    off_t      extent_end;  //end of the data extent being read
+    student_t *buf;         //block buffer owned by the scan
+    student_t *blk;         //current block, buf or a view into the mapping
+    int        first_id;    //slot number of blk[0]
+    int        nrecs;       //slots in blk
+    int        next;        //next slot of blk db_scan_next() looks at
+    int        err;         //NO_ERROR, or ERR_DB_FILE if the scan failed
+} db_scan_t;
+
+//output buffer print_db(), query_gpa_range() and export_db() fill, handed
+//to write() in big chunks instead of a printf() per row
+#define DB_OUT_BUF_SZ   (1024 * 1024)   //flushed when it cannot take a row
+#define DB_ROW_MAX      128             //longest formatted row
+typedef struct db_out {
+    int     fd;         //descriptor the rows go to
+    size_t  len;        //bytes waiting in buf
+    bool    firstRow;   //true until the table header has been written
+    char   *buf;
+} db_out_t;
+
+//gpa statistics gathered by print_gpa_stats(), gpas are in int form
+#define GPA_HIST_WIDTH      50      //histogram buckets are 0.50 wide
+#define GPA_HIST_BUCKETS    10      //last bucket also holds 5.00
+#define GPA_HIST_BAR_MAX    40      //longest histogram bar printed
+typedef struct gpa_stats {
+    int       count;
+    int       min;
+    int       max;
+    long long sum;
+    int       hist[GPA_HIST_BUCKETS];
+} gpa_stats_t;
+
+//parallel scan of the occupied slots, see db_pscan() in sdbsc.c
+#define PSCAN_MAX_THREADS       64      //most threads one scan uses
+#define PSCAN_PARTS_PER_THREAD  4       //id ranges per thread, evens out the work
+#define PSCAN_MIN_RECS          8192    //fewest students worth another thread
+typedef struct db_pscan_part {
+    int         first_id;   //the part covers ids [first_id, end_id)
+    int         end_id;
+    int         rc;         //NO_ERROR, or ERR_DB_FILE if the part failed
+    int         found;      //rows formatted into out
+    char       *out;
+    size_t      len;
+    size_t      cap;
+    gpa_stats_t st;
+} db_pscan_part_t;
+
+typedef struct db_pscan db_pscan_t;
+struct db_pscan {
+    int         fd;
+    db_occmap_t *occ;       //occupancy the parts are read by
+    int         count;      //students in the bitmap
+    int         nthreads;
+    int         min;        //gpa range for query_gpa_range()
+    int         max;
+    int       (*block)(db_pscan_t *ps, db_pscan_part_t *part, const student_t *blk, int n);
+    int         nparts;
+    int         next;       //next part a thread takes, updated atomically
+    db_pscan_part_t parts[PSCAN_MAX_THREADS * PSCAN_PARTS_PER_THREAD];
+};
+
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+int close_db(int fd);
+int sync_db(int fd);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
+int get_students(int fd, const int *ids, student_t *s, int *rcs, int n);
 int del_student(int fd, int id);
 int compress_db(int fd);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
+int validate_name(const char *name);
 int count_db_records(int fd);
 int print_db(int fd);
+void print_db_row(const student_t *s, bool *firstRow);
+int format_db_row(char *dst, const student_t *s);
+int db_out_open(db_out_t *out, int fd);
+int db_out_write(db_out_t *out, const void *data, size_t len);
+int db_out_header(db_out_t *out);
+int db_out_row(db_out_t *out, const student_t *s);
+int db_out_flush(db_out_t *out);
+int db_out_close(db_out_t *out);
+int import_db(int fd, char *path);
+int export_db(int fd, char *format, char *path);
+int find_students_by_lname(int fd, char *lname);
+int gpa_filter_block(const student_t *blk, int n, int min, int max, unsigned char *match);
+int query_gpa_range(int fd, int min, int max);
+void gpa_stats_block(const student_t *blk, int n, gpa_stats_t *st);
+int print_gpa_stats(int fd);
+int report_gpa_stats(const gpa_stats_t *st);
 void usage(char *);
+double elapsed_ms(const struct timespec *start);
+
+//storage backend prototypes
+bool use_mmap_backend(void);
+bool db_mapped(int fd);
+bool db_paged(int fd);
+int db_map_open(int fd);
+ssize_t db_phys_read(int fd, void *buf, size_t len, off_t off);
+ssize_t db_read_at(int fd, void *buf, size_t len, off_t off);
+ssize_t db_write_at(int fd, const void *buf, size_t len, off_t off);
+ssize_t db_pread_at(int fd, void *buf, size_t len, off_t off);
+int dir_open(int fd, char *dbFile);
+void dir_close(int fd);
+off_t dir_phys(off_t off);
+int max_std_id(void);
+
+//page checksum prototypes
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+int crc_open(int fd, char *dbFile);
+void crc_close(int fd);
+int crc_update(int fd, const void *buf, size_t len, off_t off);
+int rebuild_page_crcs(int fd);
+int verify_db(int fd);
+
+//last name index prototypes
+int idx_open(int fd, char *dbFile);
+void idx_close(int fd);
+int idx_update(int fd, const student_t *s, bool insert);
+int rebuild_name_index(int fd);
+
+//server, client and batch prototypes
+int exec_db_command(int *pfd, int argc, char *argv[]);
+int parse_db_command(char *line, char *exename, char *argv[], char *opt);
+int batch_db(int *pfd, char *exename, char *path);
+int put_student(int fd, int id, char *fname, char *lname, int gpa);
+int clear_student(int fd, int id);
+int run_server(int *pfd, char *exename);
+int run_client(int argc, char *argv[]);
+
+//record locking prototypes
+int lock_range(int fd, short type, off_t off, off_t len, bool wait);
+int lock_header(int fd, short type);
+int lock_change(int fd);
+int lock_student(int fd, int id, short type);
+int unlock_student(int fd, int id);
+
+//side file prototypes
+int side_attach(int fd, bool change);
+int side_use(int fd, unsigned int bit);
+
+//sequential scan prototypes
+int db_scan_open(db_scan_t *sc, int fd);
+int db_scan_block(db_scan_t *sc);
+student_t *db_scan_next(db_scan_t *sc);
+int db_scan_id(db_scan_t *sc);
+void db_scan_close(db_scan_t *sc);
+
+//parallel scan prototypes
+int pscan_threads(int count);
+int pscan_open(int fd, db_pscan_t **pps);
+int db_pscan(db_pscan_t *ps);
+int db_pscan_output(db_pscan_t *ps, db_out_t *out);
+void db_pscan_free(db_pscan_t *ps);
+
+//occupancy header and bitmap prototypes
+int occ_open(int fd, char *dbFile, bool create);
+void occ_close(int fd);
+int read_db_header(int fd, db_header_t *hdr);
+int load_occupancy(int fd, db_header_t *hdr, db_occmap_t *occ);
+int begin_occupancy_update(db_header_t *hdr);
+int store_occupancy(int fd, db_header_t *hdr, db_occmap_t *occ);
+int rebuild_occupancy(int fd);
+int update_occupancy(int fd, int id, bool occupied, const student_t *rec);
+db_occmap_t *occ_map_new(void);
+void occ_map_free(db_occmap_t *occ);
+uint64_t *occ_map_word(db_occmap_t *occ, int page, bool create);
+int occ_map_set(db_occmap_t *occ, int id);
+bool occ_map_test(const db_occmap_t *occ, int id);
+int next_occupied(const db_occmap_t *occ, int id);
+int occupied_run(const db_occmap_t *occ, int id, int max);
+int read_occupied(int fd, const db_occmap_t *occ, int *id, student_t *blk);
 
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
@@ -38,21 +294,46 @@ void usage(char *);
 
 //Output messages
 #define M_ERR_STD_RNG     "Cant add student, either ID or GPA out of allowable range!\n"
+#define M_ERR_STD_NAME    "Cant add student, names cant hold a comma, tab or line break!\n"
+#define M_ERR_GPA_RNG     "GPA range must be two ints with 0 <= min <= max <= 500!\n"
 #define M_ERR_DB_CREATE   "Error creating DB file, exiting!\n"
 #define M_ERR_DB_OPEN     "Error opening DB file, exiting!\n"
 #define M_ERR_DB_READ     "Error reading DB file, exiting!\n"
 #define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
+#define M_ERR_DB_BUSY     "Database is open in another process, cant rewrite it!\n"
 #define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
 #define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
 
 #define M_STD_ADDED       "Student %d added to database.\n"
 #define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
 #define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
+#define M_STD_LNAME_NOT_FND "No students with last name %s were found in database.\n"
+#define M_DB_GPA_NONE     "No students with a GPA between %.2f and %.2f were found in database.\n"
+#define M_DB_GPA_STATS    "GPA statistics for %d student(s): min %.2f, max %.2f, mean %.2f\n"
+#define M_DB_GPA_HIST_ROW "  %.2f-%.2f %7d %s\n"
 #define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
+#define M_DB_RECLAIMED    "Reclaimed %lld bytes of storage in %.3f ms.\n"
 #define M_DB_ZERO_OK      "All database records removed!\n"
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_DB_IMPORTED     "Imported %d student record(s) into database.\n"
+#define M_DB_IMPORT_SKIP  "Skipped %d duplicate or invalid record(s).\n"
+#define M_ERR_IMPORT_LINE "Skipping invalid import record on line %d.\n"
+#define M_ERR_IMPORT_OPEN "Error opening import file %s!\n"
+#define M_DB_EXPORTED     "Exported %d student record(s) to %s.\n"
+#define M_ERR_EXPORT_OPEN "Error opening export file %s!\n"
+#define M_ERR_IMPORT_FORMAT "Import file %s is not a valid student export!\n"
+#define M_DB_VERIFIED     "Verified %lld page(s) of the database in %.3f ms, no errors.\n"
+#define M_ERR_PAGE_CRC    "Page %lld of the database file fails its checksum!\n"
+#define M_ERR_VERIFY      "%d of %lld page(s) failed verification.\n"
+#define M_ERR_BATCH_OPEN  "Error opening batch file %s!\n"
+#define M_ERR_BATCH_NESTED "Cant run a batch from a batch or a server request!\n"
+#define M_SVR_STARTED     "Serving %s on %s.\n"
+#define M_SVR_STOPPED     "Server stopped.\n"
+#define M_ERR_SVR_SOCKET  "Error opening server socket %s!\n"
+#define M_ERR_SVR_CONNECT "Cant connect to server at %s!\n"
+#define M_ERR_SVR_REQUEST "Request too long or has too many words!\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
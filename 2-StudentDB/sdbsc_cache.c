@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbsc_snap.h"
+#include "sdbsc_cache.h"
+
+/*
+ *  Page cache
+ *
+ *  With the read/write backend every lookup is a pread(), even when the
+ *  same few pages are read again and again by a batch or the server.  The
+ *  page cache keeps up to SDB_CACHE bytes of 4KB pages of the database
+ *  file in memory, evicting the least recently used, so a popular id is
+ *  served without a system call.  Reads that fit in one page go through
+ *  it, bigger ones (scans) go straight to the file and do not push the
+ *  hot pages out.  Writes go to the file and to the cached copy.
+ *
+ *  Other processes may change the file at any time, so every write bumps
+ *  the changes count in the shared header of the snapshot file, to an odd
+ *  value before and an even one after.  A process whose cache was filled
+ *  at another count empties it, and a page is only kept if the count was
+ *  even and did not move while it was read.  So a cached page is never
+ *  half written, and get_student() reads it without taking the record
+ *  lock.  The mmap backend has no need for the cache.
+ */
+static db_cache_t db_cache = {.fd = -1, .head = -1, .tail = -1};
+
+// empties the page cache, its memory is kept
+static void cache_clear(void)
+{
+    memset(db_cache.buckets, -1, db_cache.nbuckets * sizeof(int));
+    db_cache.nused = 0;
+    db_cache.head = -1;
+    db_cache.tail = -1;
+}
+
+// empties the cache if the database changed since it was filled
+static void cache_check(void)
+{
+    unsigned int changes = __atomic_load_n(&snap_hdr(db_cache.fd)->changes, __ATOMIC_ACQUIRE);
+
+    if (changes != db_cache.changes)
+    {
+        cache_clear();
+        db_cache.changes = changes;
+    }
+}
+
+// takes frame f out of the LRU list
+static void cache_unlink(int f)
+{
+    cache_frame_t *fr = &db_cache.frames[f];
+
+    if (fr->prev != -1)
+        db_cache.frames[fr->prev].next = fr->next;
+    else
+        db_cache.head = fr->next;
+    if (fr->next != -1)
+        db_cache.frames[fr->next].prev = fr->prev;
+    else
+        db_cache.tail = fr->prev;
+}
+
+// puts frame f at the head of the LRU list
+static void cache_push(int f)
+{
+    cache_frame_t *fr = &db_cache.frames[f];
+
+    fr->prev = -1;
+    fr->next = db_cache.head;
+    if (db_cache.head != -1)
+        db_cache.frames[db_cache.head].prev = f;
+    db_cache.head = f;
+    if (db_cache.tail == -1)
+        db_cache.tail = f;
+}
+
+// removes frame f from its hash chain
+static void cache_unhash(int f)
+{
+    int *link = &db_cache.buckets[db_cache.frames[f].page & (db_cache.nbuckets - 1)];
+
+    while (*link != f)
+        link = &db_cache.frames[*link].chain;
+    *link = db_cache.frames[f].chain;
+}
+
+// frame holding page, -1 if it is not cached
+static int cache_find(long long page)
+{
+    int f = db_cache.buckets[page & (db_cache.nbuckets - 1)];
+
+    while (f != -1 && db_cache.frames[f].page != page)
+        f = db_cache.frames[f].chain;
+    return f;
+}
+
+// copies part of a cached page out, short past the end of the file
+static ssize_t cache_copy(int f, void *buf, size_t len, size_t in)
+{
+    cache_frame_t *fr = &db_cache.frames[f];
+    size_t n = in >= (size_t)fr->len ? 0 : fr->len - in;
+
+    if (n > len)
+        n = len;
+    memcpy(buf, db_cache.data + (size_t)f * DB_PAGE_SIZE + in, n);
+
+    // most recently used
+    if (db_cache.head != f)
+    {
+        cache_unlink(f);
+        cache_push(f);
+    }
+    return n;
+}
+
+/*
+ *  cache_fill
+ *      fd:    linux file descriptor
+ *      page:  page of the file to read
+ *
+ *  Reads a page into a free frame, or into the least recently used one.
+ *  The page is only kept if no other process changed the file while it
+ *  was read.
+ *
+ *  returns:  the frame, or -1 if the page could not be cached
+ */
+static int cache_fill(int fd, long long page)
+{
+    db_snap_hdr_t *sh = snap_hdr(fd);
+    unsigned int before = __atomic_load_n(&sh->changes, __ATOMIC_ACQUIRE);
+    int f;
+
+    if (before & 1)
+        return -1;
+
+    if (db_cache.nused < db_cache.nframes)
+    {
+        f = db_cache.nused++;
+    }
+    else
+    {
+        f = db_cache.tail;
+        cache_unlink(f);
+        cache_unhash(f);
+    }
+
+    char *data = db_cache.data + (size_t)f * DB_PAGE_SIZE;
+    ssize_t got = pread(fd, data, DB_PAGE_SIZE, page * DB_PAGE_SIZE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (got == -1 || __atomic_load_n(&sh->changes, __ATOMIC_ACQUIRE) != before)
+    {
+        // the next lookup would empty the cache anyway
+        cache_clear();
+        return -1;
+    }
+    memset(data + got, 0, DB_PAGE_SIZE - got);
+
+    cache_frame_t *fr = &db_cache.frames[f];
+    fr->page = page;
+    fr->len = got;
+    fr->chain = db_cache.buckets[page & (db_cache.nbuckets - 1)];
+    db_cache.buckets[page & (db_cache.nbuckets - 1)] = f;
+    cache_push(f);
+    return f;
+}
+
+/*
+ *  cache_read
+ *      fd, buf, len, off:  as for pread()
+ *
+ *  pread() through the page cache.  A read that fits in one page is served
+ *  from its cached copy, after the page is read whole on a miss.  Other
+ *  reads, and every read while the cache is off, go to the file.
+ *
+ *  returns:  bytes read, or -1 on an I/O error
+ */
+ssize_t cache_read(int fd, void *buf, size_t len, off_t off)
+{
+    long long page = off / DB_PAGE_SIZE;
+    size_t in = off % DB_PAGE_SIZE;
+
+    if (db_cache.fd != fd || len == 0 || in + len > DB_PAGE_SIZE)
+        return pread(fd, buf, len, off);
+
+    cache_check();
+    int f = cache_find(page);
+    if (f != -1)
+    {
+        db_cache.hits++;
+        return cache_copy(f, buf, len, in);
+    }
+
+    db_cache.misses++;
+    if ((f = cache_fill(fd, page)) == -1)
+        return pread(fd, buf, len, off);
+    return cache_copy(f, buf, len, in);
+}
+
+/*
+ *  cache_peek
+ *      fd, buf, len, off:  as for pread()
+ *
+ *  cache_read() for a page the cache already holds, without any system
+ *  call.  The copy is never half written, so callers need no lock.
+ *
+ *  returns:  bytes read, or -1 if the page is not cached
+ */
+ssize_t cache_peek(int fd, void *buf, size_t len, off_t off)
+{
+    size_t in = off % DB_PAGE_SIZE;
+
+    if (db_cache.fd != fd || len == 0 || in + len > DB_PAGE_SIZE)
+        return -1;
+
+    cache_check();
+    int f = cache_find(off / DB_PAGE_SIZE);
+    if (f == -1)
+        return -1;
+    db_cache.hits++;
+    return cache_copy(f, buf, len, in);
+}
+
+/*
+ *  cache_begin_write / cache_end_write
+ *      fd:   linux file descriptor
+ *      buf:  bytes written, NULL if a hole was punched
+ *      len:  bytes written, -1 if the write failed
+ *      off:  file offset of the write
+ *
+ *  Bracket every change to the database file.  The shared changes count
+ *  is odd in between, so no process caches a page while it changes.  This
+ *  process keeps its cache, the pages the write touched are updated in
+ *  place, unless another process changed the file since it was filled.
+ *  Writers hold the header write lock, so they never overlap.
+ */
+void cache_begin_write(int fd)
+{
+    db_snap_hdr_t *sh = snap_hdr(fd);
+
+    if (sh == NULL)
+        return;
+
+    // odd from here on, even if a writer died halfway and left it odd
+    unsigned int was = __atomic_load_n(&sh->changes, __ATOMIC_ACQUIRE);
+    unsigned int now = (was + 1) | 1;
+    __atomic_store_n(&sh->changes, now, __ATOMIC_SEQ_CST);
+
+    if (db_cache.fd == fd)
+    {
+        if (was != db_cache.changes)
+            cache_clear();
+        db_cache.changes = now + 1;
+    }
+}
+
+// lays a write over the cached copies of the pages it touched
+void cache_update(int fd, const void *buf, ssize_t len, off_t off)
+{
+    if (db_cache.fd == fd && len <= 0)
+        cache_clear();
+
+    long long last = db_cache.fd == fd && len > 0 ? (off + len - 1) / DB_PAGE_SIZE : -1;
+    for (long long page = off / DB_PAGE_SIZE; page <= last && db_cache.nused > 0; page++)
+    {
+        int f = cache_find(page);
+        if (f == -1)
+            continue;
+
+        cache_frame_t *fr = &db_cache.frames[f];
+        off_t from = page * DB_PAGE_SIZE > off ? page * DB_PAGE_SIZE : off;
+        off_t to = (page + 1) * DB_PAGE_SIZE < off + len ? (page + 1) * DB_PAGE_SIZE : off + len;
+        char *data = db_cache.data + (size_t)f * DB_PAGE_SIZE + (from - page * DB_PAGE_SIZE);
+
+        if (buf != NULL)
+            memcpy(data, (const char *)buf + (from - off), to - from);
+        else
+            memset(data, 0, to - from);
+        if (to - page * DB_PAGE_SIZE > fr->len)
+            fr->len = to - page * DB_PAGE_SIZE;
+    }
+}
+
+void cache_end_write(int fd, const void *buf, ssize_t len, off_t off)
+{
+    db_snap_hdr_t *sh = snap_hdr(fd);
+
+    if (sh == NULL)
+        return;
+
+    cache_update(fd, buf, len, off);
+    unsigned int now = __atomic_load_n(&sh->changes, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&sh->changes, now + 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ *  cache_open
+ *      fd:  linux file descriptor
+ *
+ *  Sets up the page cache with the budget SDB_CACHE asks for.  The cache
+ *  needs the changes count of the snapshot file, so it is only set up once
+ *  snap_open() found or created one.  Called with the header write locked.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if memory ran out
+ */
+int cache_open(int fd)
+{
+    char *env = getenv(DB_CACHE_ENV);
+    long long budget = CACHE_DEF_BYTES;
+
+    if (env != NULL)
+    {
+        char *unit;
+        budget = strtoll(env, &unit, 10);
+        switch (*unit)
+        {
+        case 'g': case 'G': budget *= 1024;     // fall through
+        case 'm': case 'M': budget *= 1024;     // fall through
+        case 'k': case 'K': budget *= 1024;
+        }
+    }
+    if (budget < DB_PAGE_SIZE || db_mapped(fd) || snap_hdr(fd) == NULL)
+        return NO_ERROR;
+
+    db_cache.nframes = budget / DB_PAGE_SIZE > INT_MAX / 2 ? INT_MAX / 2 : budget / DB_PAGE_SIZE;
+    db_cache.nbuckets = 1;
+    while (db_cache.nbuckets < (unsigned int)db_cache.nframes)
+        db_cache.nbuckets *= 2;
+
+    db_cache.frames = malloc(db_cache.nframes * sizeof(cache_frame_t));
+    db_cache.buckets = malloc(db_cache.nbuckets * sizeof(int));
+    db_cache.data = malloc((size_t)db_cache.nframes * DB_PAGE_SIZE);
+    if (db_cache.frames == NULL || db_cache.buckets == NULL || db_cache.data == NULL)
+    {
+        cache_close(fd);
+        return ERR_DB_FILE;
+    }
+
+    db_cache.fd = fd;
+    db_cache.changes = __atomic_load_n(&snap_hdr(fd)->changes, __ATOMIC_ACQUIRE);
+    cache_clear();
+    return NO_ERROR;
+}
+
+// frees the page cache, the counters carry on for the process
+void cache_close(int fd)
+{
+    if (db_cache.fd != fd && db_cache.frames == NULL)
+        return;
+
+    free(db_cache.frames);
+    free(db_cache.buckets);
+    free(db_cache.data);
+    db_cache = (db_cache_t){.fd = -1, .head = -1, .tail = -1,
+                            .hits = db_cache.hits, .misses = db_cache.misses};
+}
+
+/*
+ *  cache_counters
+ *      *hits:    set to the reads the page cache served
+ *      *misses:  set to the reads that had to fill a page
+ */
+void cache_counters(unsigned long long *hits, unsigned long long *misses)
+{
+    *hits = db_cache.hits;
+    *misses = db_cache.misses;
+}
@@ -0,0 +1,38 @@
+#ifndef __SDB_CACHE_H__
+    #define __SDB_CACHE_H__
+
+//one 4KB page held by the page cache
+typedef struct cache_frame {
+    long long page;         //page of the database file, -1 if the frame is free
+    int       len;          //bytes of the page in the file, the rest reads short
+    int       prev, next;   //LRU list, most recently used first
+    int       chain;        //next frame in the same hash bucket
+} cache_frame_t;
+
+//user space cache of database pages (see cache_read())
+#define CACHE_DEF_BYTES (4 * 1024 * 1024)   //budget when SDB_CACHE is not set
+typedef struct db_cache {
+    int            fd;          //database descriptor the pages belong to, -1 if off
+    int            nframes;     //pages the budget holds
+    int            nused;       //frames handed out since the cache was emptied
+    int            head, tail;  //most and least recently used frame, -1 if none
+    unsigned int   changes;     //db_snap_hdr_t changes count the pages match
+    unsigned int   nbuckets;    //a power of 2
+    int           *buckets;     //first frame of each hash bucket, -1 if none
+    cache_frame_t *frames;
+    char          *data;        //nframes pages
+    unsigned long long hits;
+    unsigned long long misses;
+} db_cache_t;
+
+//page cache prototypes
+int cache_open(int fd);
+void cache_close(int fd);
+ssize_t cache_read(int fd, void *buf, size_t len, off_t off);
+ssize_t cache_peek(int fd, void *buf, size_t len, off_t off);
+void cache_begin_write(int fd);
+void cache_update(int fd, const void *buf, ssize_t len, off_t off);
+void cache_end_write(int fd, const void *buf, ssize_t len, off_t off);
+void cache_counters(unsigned long long *hits, unsigned long long *misses);
+
+#endif
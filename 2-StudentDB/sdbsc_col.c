@@ -0,0 +1,475 @@
+#define _GNU_SOURCE  //mremap()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbsc_col.h"
+
+/*
+ *  Column store
+ *
+ *  A gpa report only needs 4 bytes of each 64 byte record, but a scan
+ *  reads them all.  A side file (dbFile + DB_COL_SUFFIX) keeps the records
+ *  again by column: the ids in increasing order, their gpas, and the
+ *  offset of their names in a name heap.  print_gpa_stats() reads the gpa
+ *  column alone, 16 times less than the records, and query_gpa_range()
+ *  filters the gpa column and only looks at the ids and names of the
+ *  students it prints.  Both read the file under the header read lock and
+ *  fall back to the record scans if it is not up to date.
+ *
+ *  The file is mapped, and add_student() and del_student() move the tail
+ *  of each column by one entry in place.  A full column or a heap that is
+ *  mostly names of deleted students is rebuilt with a scan, with room for
+ *  twice the students.  The file is created by the first gpa report, the
+ *  header's side_files says so, and every change keeps it current from
+ *  then on.  Like the index it is stamped with the database generation
+ *  after every change, and rebuilt when a process opens it behind the
+ *  database.  Processes run with SDB_COLUMNS=off leave it behind.
+ */
+static db_col_t db_col = {-1, -1, NULL, 0};
+
+// header of the mapped column file
+static db_col_hdr_t *col_hdr(void)
+{
+    return (db_col_hdr_t *)db_col.base;
+}
+
+// file offset of the name heap when the arrays have room for cap entries
+static size_t col_heap_off(int cap)
+{
+    return sizeof(db_col_hdr_t) + (size_t)COL_NCOLS * cap * sizeof(int);
+}
+
+// array c (COL_IDS, COL_GPAS or COL_NAMES) of a file with room for cap
+static int *col_array(int c, int cap)
+{
+    return (int *)(db_col.base + sizeof(db_col_hdr_t)) + (size_t)c * cap;
+}
+
+// bytes the first and last name at names take in the heap
+static size_t col_names_len(const char *names)
+{
+    size_t flen = strlen(names) + 1;
+
+    return flen + strlen(names + flen) + 1;
+}
+
+/*
+ *  col_map_grow
+ *      len:  minimum size in bytes the column file and mapping must have
+ *
+ *  Like dir_map_grow(), the file is extended if it is shorter than len and
+ *  the mapping always covers the whole file.  The file never gets shorter,
+ *  even for sdbsc -z, so another process's mapping stays valid and a
+ *  mapping that covers len needs no check.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int col_map_grow(size_t len)
+{
+    struct stat st;
+    void *base;
+
+    if (len <= db_col.len)
+        return NO_ERROR;
+    if (fstat(db_col.col_fd, &st) == -1)
+        return ERR_DB_FILE;
+    if ((size_t)st.st_size > len)
+        len = st.st_size;
+    else if ((size_t)st.st_size < len && ftruncate(db_col.col_fd, len) == -1)
+        return ERR_DB_FILE;
+
+    if (len <= db_col.len)
+        return NO_ERROR;
+
+    if (db_col.base == NULL)
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, db_col.col_fd, 0);
+    else
+        base = mremap(db_col.base, db_col.len, len, MREMAP_MAYMOVE);
+
+    if (base == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    db_col.base = base;
+    db_col.len = len;
+    return NO_ERROR;
+}
+
+/*
+ *  col_current
+ *      fd:      linux file descriptor
+ *      behind:  generations the columns may be behind the database
+ *      *gen:    set to the database generation
+ *
+ *  Called with the header locked.  Maps all of the column file in use.
+ *
+ *  returns:  true if the columns are exactly behind generations old
+ */
+static bool col_current(int fd, int behind, unsigned long long *gen)
+{
+    db_header_t hdr;
+
+    if (db_col.fd != fd)
+        return false;
+
+    int rc = read_db_header(fd, &hdr);
+    if (rc == ERR_DB_FILE)
+        return false;
+    *gen = rc == NO_ERROR ? hdr.generation : 0;
+
+    db_col_hdr_t *ch = col_hdr();
+    if (memcmp(ch->magic, DB_COL_MAGIC, sizeof(ch->magic)) != 0 ||
+        ch->generation + behind != *gen)
+        return false;
+    return col_map_grow(col_heap_off(ch->cap) + ch->heap_len) == NO_ERROR;
+}
+
+// position of the first id >= id in the id column
+static int col_search(int id)
+{
+    const db_col_hdr_t *ch = col_hdr();
+    const int *ids = col_array(COL_IDS, ch->cap);
+    int lo = 0, hi = ch->count;
+
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ *  col_update
+ *      fd:      linux file descriptor
+ *      *s:      student added to or removed from the database
+ *      insert:  true to add s to the columns, false to remove it
+ *
+ *  Keeps the columns in step with a change add_student() or del_student()
+ *  has just committed, then stamps them with the database generation.
+ *  Columns a process with SDB_COLUMNS=off left behind stay behind, the
+ *  reports don't use them until a process opens them again.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int col_update(int fd, const student_t *s, bool insert)
+{
+    unsigned long long gen;
+
+    if (!col_current(fd, 1, &gen))
+        return NO_ERROR;
+
+    db_col_hdr_t *ch = col_hdr();
+    int cap = ch->cap;
+    int pos = col_search(s->id);
+    bool there = pos < ch->count && col_array(COL_IDS, cap)[pos] == s->id;
+
+    // a replayed log record may already be in the columns
+    if (insert && !there)
+    {
+        if (ch->count == cap)
+            return rebuild_columns(fd) < 0 ? ERR_DB_FILE : NO_ERROR;
+
+        size_t flen = strnlen(s->fname, sizeof(s->fname));
+        size_t llen = strnlen(s->lname, sizeof(s->lname));
+        unsigned int at = ch->heap_len;
+        if (col_map_grow(col_heap_off(cap) + at + flen + llen + 2) != NO_ERROR)
+            return ERR_DB_FILE;
+        ch = col_hdr();
+
+        char *names = db_col.base + col_heap_off(cap) + at;
+        memcpy(names, s->fname, flen);
+        names[flen] = '\0';
+        memcpy(names + flen + 1, s->lname, llen);
+        names[flen + 1 + llen] = '\0';
+
+        for (int c = 0; c < COL_NCOLS; c++)
+        {
+            int *col = col_array(c, cap);
+            memmove(col + pos + 1, col + pos, (size_t)(ch->count - pos) * sizeof(int));
+        }
+        col_array(COL_IDS, cap)[pos] = s->id;
+        col_array(COL_GPAS, cap)[pos] = s->gpa;
+        col_array(COL_NAMES, cap)[pos] = at;
+        ch->count++;
+        ch->heap_len += flen + llen + 2;
+        ch->heap_live += flen + llen + 2;
+    }
+    else if (!insert && there)
+    {
+        ch->heap_live -= col_names_len(db_col.base + col_heap_off(cap) + col_array(COL_NAMES, cap)[pos]);
+        if (ch->heap_len > COL_HEAP_SLACK && ch->heap_live < ch->heap_len / 2)
+            return rebuild_columns(fd) < 0 ? ERR_DB_FILE : NO_ERROR;
+
+        for (int c = 0; c < COL_NCOLS; c++)
+        {
+            int *col = col_array(c, cap);
+            memmove(col + pos, col + pos + 1, (size_t)(ch->count - pos - 1) * sizeof(int));
+        }
+        ch->count--;
+    }
+
+    ch->generation = gen;
+    return NO_ERROR;
+}
+
+/*
+ *  rebuild_columns
+ *      fd:  linux file descriptor
+ *
+ *  Rebuilds the whole column store from a scan of the database, with room
+ *  for twice the students it finds.  The header goes last, so columns a
+ *  crash left halfway are never taken for current ones.
+ *
+ *  returns:  number of students on success, ERR_DB_FILE on failure
+ */
+int rebuild_columns(int fd)
+{
+    db_header_t hdr;
+    db_scan_t scan;
+    student_t *rows = NULL;
+    student_t *s;
+    int count = 0, cap = 0;
+    int rc = ERR_DB_FILE;
+
+    if (db_col.fd != fd)
+        return NO_ERROR;
+    if (read_db_header(fd, &hdr) != NO_ERROR)
+        memset(&hdr, 0, sizeof(hdr));
+    if (db_scan_open(&scan, fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    size_t heap_len = 0;
+    while ((s = db_scan_next(&scan)) != NULL)
+    {
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : IMPORT_INIT_ROWS;
+            student_t *grown = realloc(rows, cap * sizeof(student_t));
+            if (grown == NULL)
+                goto done;
+            rows = grown;
+        }
+        rows[count++] = *s;
+        heap_len += strnlen(s->fname, sizeof(s->fname)) + strnlen(s->lname, sizeof(s->lname)) + 2;
+    }
+    if (scan.err != NO_ERROR)
+        goto done;
+
+    int room = count * 2 > COL_MIN_CAP ? count * 2 : COL_MIN_CAP;
+    if (col_map_grow(col_heap_off(room) + heap_len) != NO_ERROR)
+        goto done;
+
+    int *ids = col_array(COL_IDS, room);
+    int *gpas = col_array(COL_GPAS, room);
+    int *names = col_array(COL_NAMES, room);
+    char *heap = db_col.base + col_heap_off(room);
+    unsigned int at = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size_t flen = strnlen(rows[i].fname, sizeof(rows[i].fname));
+        size_t llen = strnlen(rows[i].lname, sizeof(rows[i].lname));
+
+        ids[i] = rows[i].id;
+        gpas[i] = rows[i].gpa;
+        names[i] = at;
+        memcpy(heap + at, rows[i].fname, flen);
+        heap[at + flen] = '\0';
+        memcpy(heap + at + flen + 1, rows[i].lname, llen);
+        heap[at + flen + 1 + llen] = '\0';
+        at += flen + llen + 2;
+    }
+
+    db_col_hdr_t *ch = col_hdr();
+    memset(ch, 0, sizeof(*ch));
+    memcpy(ch->magic, DB_COL_MAGIC, sizeof(ch->magic));
+    ch->count = count;
+    ch->cap = room;
+    ch->heap_len = at;
+    ch->heap_live = at;
+    ch->generation = hdr.generation;
+    rc = count;
+
+done:
+    free(rows);
+    db_scan_close(&scan);
+    return rc;
+}
+
+/*
+ *  col_open
+ *      fd:      linux file descriptor, the caller holds the header write lock
+ *      dbFile:  name of the database file
+ *
+ *  Opens and maps the column file, creating it if it is missing, unless
+ *  SDB_COLUMNS=off, and rebuilds it if it is behind the database.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int col_open(int fd, char *dbFile)
+{
+    char path[PATH_MAX];
+    char *env = getenv(DB_COLUMNS_ENV);
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    unsigned long long gen;
+
+    if (env != NULL && strcmp(env, DB_COLUMNS_OFF) == 0)
+        return NO_ERROR;
+
+    // never O_TRUNC, other processes may have the file mapped
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_COL_SUFFIX);
+    db_col.col_fd = open(path, O_RDWR | O_CREAT, mode);
+    if (db_col.col_fd == -1)
+        return ERR_DB_FILE;
+    db_col.fd = fd;
+
+    if (col_map_grow(sizeof(db_col_hdr_t)) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (col_current(fd, 0, &gen))
+        return NO_ERROR;
+
+    return rebuild_columns(fd) < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+// unmaps and closes the column file that belongs to fd
+void col_close(int fd)
+{
+    if (db_col.fd != fd)
+        return;
+
+    if (db_col.base != NULL)
+        munmap(db_col.base, db_col.len);
+    close(db_col.col_fd);
+    db_col = (db_col_t){-1, -1, NULL, 0};
+}
+
+// true if the column store of fd is open
+bool col_attached(int fd)
+{
+    return fd >= 0 && db_col.fd == fd;
+}
+
+/*
+ *  col_gpa_stats
+ *      fd:   linux file descriptor
+ *      *st:  running statistics to fold the gpa column into
+ *
+ *  The statistics of print_gpa_stats() from the gpa column alone.
+ *
+ *  returns:  NO_ERROR on success, SRCH_NOT_FOUND if the columns are not up
+ *            to date, ERR_DB_FILE on I/O errors
+ */
+int col_gpa_stats(int fd, gpa_stats_t *st)
+{
+    unsigned long long gen;
+    int rc = SRCH_NOT_FOUND;
+
+    if (db_col.fd != fd && side_use(fd, DB_SIDE_COLUMNS) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_col.fd != fd)
+        return SRCH_NOT_FOUND;
+    if (lock_header(fd, F_RDLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (col_current(fd, 0, &gen))
+    {
+        const db_col_hdr_t *ch = col_hdr();
+        const int *gpa = col_array(COL_GPAS, ch->cap);
+
+        for (int i = 0; i < ch->count; i++)
+        {
+            int bucket = gpa[i] / GPA_HIST_WIDTH;
+            if (bucket >= GPA_HIST_BUCKETS)
+                bucket = GPA_HIST_BUCKETS - 1;
+
+            st->sum += gpa[i];
+            st->hist[bucket]++;
+            st->min = gpa[i] < st->min ? gpa[i] : st->min;
+            st->max = gpa[i] > st->max ? gpa[i] : st->max;
+        }
+        st->count += ch->count;
+        rc = NO_ERROR;
+    }
+
+    if (lock_header(fd, F_UNLCK) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+/*
+ *  col_gpa_range
+ *      fd:      linux file descriptor
+ *      min:     lowest gpa wanted
+ *      max:     highest gpa wanted
+ *      **text:  set to the print_db() rows of the students in the range in
+ *               id order, to be freed
+ *      *len:    set to the length of text
+ *
+ *  Filters the gpa column, then formats the students that match from the
+ *  id column and the name heap.  The rows are kept in memory, like the
+ *  parts of a parallel scan, so the header lock is not held while they
+ *  are written out.
+ *
+ *  returns:  number of students in the range, SRCH_NOT_FOUND if the
+ *            columns are not up to date, ERR_DB_FILE on failure
+ */
+int col_gpa_range(int fd, int min, int max, char **text, size_t *len)
+{
+    unsigned span = (unsigned)(max - min);
+    unsigned long long gen;
+    int rc = SRCH_NOT_FOUND;
+
+    *text = NULL;
+    *len = 0;
+    if (db_col.fd != fd && side_use(fd, DB_SIDE_COLUMNS) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_col.fd != fd)
+        return SRCH_NOT_FOUND;
+    if (lock_header(fd, F_RDLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (col_current(fd, 0, &gen))
+    {
+        const db_col_hdr_t *ch = col_hdr();
+        const int *ids = col_array(COL_IDS, ch->cap);
+        const int *gpa = col_array(COL_GPAS, ch->cap);
+        const int *names = col_array(COL_NAMES, ch->cap);
+        const char *heap = db_col.base + col_heap_off(ch->cap);
+        int found = 0;
+
+        for (int i = 0; i < ch->count; i++)
+            found += (unsigned)(gpa[i] - min) <= span;
+
+        *text = malloc((size_t)(found > 0 ? found : 1) * DB_ROW_MAX);
+        rc = *text != NULL ? found : ERR_DB_FILE;
+        for (int i = 0; rc > 0 && i < ch->count; i++)
+        {
+            if ((unsigned)(gpa[i] - min) > span)
+                continue;
+
+            student_t s = {ids[i], "", "", gpa[i]};
+            const char *fname = heap + names[i];
+            strncpy(s.fname, fname, sizeof(s.fname) - 1);
+            strncpy(s.lname, fname + strlen(fname) + 1, sizeof(s.lname) - 1);
+            *len += format_db_row(*text + *len, &s);
+        }
+    }
+
+    if (lock_header(fd, F_UNLCK) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
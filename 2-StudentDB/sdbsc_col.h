@@ -0,0 +1,29 @@
+#ifndef __SDB_COL_H__
+    #define __SDB_COL_H__
+
+#include "sdbsc.h" //get the gpa statistics type
+
+//the column store file that belongs to the open database, mapped whole
+#define COL_MIN_CAP     1024    //entries the arrays have room for at least
+#define COL_IDS         0       //the arrays in the order they are in the file
+#define COL_GPAS        1
+#define COL_NAMES       2
+#define COL_NCOLS       3
+#define COL_HEAP_SLACK  (32 * 1024)     //dead name bytes never worth a rebuild
+typedef struct db_col {
+    int     fd;         //database descriptor the columns belong to, -1 if off
+    int     col_fd;     //descriptor of the column file
+    char   *base;       //start of the mapping
+    size_t  len;        //bytes mapped, the file never gets shorter
+} db_col_t;
+
+//column store prototypes
+int col_open(int fd, char *dbFile);
+void col_close(int fd);
+int col_update(int fd, const student_t *s, bool insert);
+int rebuild_columns(int fd);
+bool col_attached(int fd);
+int col_gpa_stats(int fd, gpa_stats_t *st);
+int col_gpa_range(int fd, int min, int max, char **text, size_t *len);
+
+#endif
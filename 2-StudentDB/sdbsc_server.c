@@ -0,0 +1,658 @@
+#define _GNU_SOURCE  //memfd_create()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbsc_wal.h"
+
+/*
+ *  StudentDB server
+ *
+ *  Every sdbsc command pays for a fork/exec and an open_db() (side file
+ *  checks, mapping the file) before it does a single lookup.  `sdbsc -S`
+ *  opens the database once and answers requests on a Unix domain socket
+ *  (DB_FILE + DB_SOCK_SUFFIX) until it is stopped, following the protocol
+ *  of the remote shell in 6-RShell:
+ *
+ *    - a request is one line holding an sdbsc command without the program
+ *      name, "-f 100" or just "f 100", plus the builtins "exit" (close the
+ *      connection) and "stop-server".
+ *    - the reply is whatever the command prints, exactly what the command
+ *      line sdbsc would print, then SDB_SVR_EOF_CHAR and one byte with the
+ *      command's exit code.
+ *
+ *  Up to SDB_SVR_MAX_CLIENTS connections are multiplexed with poll(), each
+ *  request runs to completion before the next one.  A request's output goes
+ *  to a reply buffer of its connection and out through a non-blocking
+ *  socket, so a client that stops reading its replies never holds up the
+ *  others (see serve_client()).  The server keeps the database mapped (it
+ *  uses the mmap backend unless SDB_BACKEND says otherwise), and when
+ *  SDB_WAL is set the poll timeout commits the queued group once it is
+ *  due, so changes never sit in the queue while the server is idle.  Other
+ *  sdbsc processes can keep using the database while the server runs, see
+ *  "Concurrent access" in sdbsc.c.
+ *
+ *  The socket has the mode of the database file, so whoever can connect
+ *  could as well open the file and run any command on it.  Every command
+ *  but -b is served, -z, -x and "stop-server" included.
+ */
+
+static volatile sig_atomic_t svr_stop = 0;
+
+// SIGINT/SIGTERM stop the server cleanly so close_db() commits and syncs
+static void svr_on_signal(int sig)
+{
+    (void)sig;
+    svr_stop = 1;
+}
+
+// name of the server socket that belongs to DB_FILE
+static void sock_path(char *path, size_t len)
+{
+    snprintf(path, len, "%s%s", DB_FILE, DB_SOCK_SUFFIX);
+}
+
+/*
+ *  boot_server
+ *      path:  name of the socket file
+ *
+ *  Creates, binds and listens on the server socket.  It is bound under a
+ *  temporary name and only renamed to path once it listens, so a client
+ *  never finds a socket file that refuses connections.  The rename also
+ *  replaces a socket file left behind by a server that was killed.  Only
+ *  users who may write the database file may connect.
+ *
+ *  returns:  the listening socket, or ERR_DB_FILE on failure
+ */
+static int boot_server(char *path)
+{
+    struct sockaddr_un addr;
+    int svr_socket;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%d", path, (int)getpid()) >=
+        (int)sizeof(addr.sun_path))
+        return ERR_DB_FILE;
+
+    svr_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (svr_socket < 0)
+        return ERR_DB_FILE;
+
+    // the socket gets the mode of the database file, rw-rw----
+    unlink(addr.sun_path);
+    mode_t old_mask = umask(S_IXUSR | S_IXGRP | S_IRWXO);
+    int bound = bind(svr_socket, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound < 0 || listen(svr_socket, SDB_SVR_BACKLOG) < 0 ||
+        rename(addr.sun_path, path) < 0)
+    {
+        if (bound == 0)
+            unlink(addr.sun_path);
+        close(svr_socket);
+        return ERR_DB_FILE;
+    }
+
+    return svr_socket;
+}
+
+/*
+ *  send_all
+ *      sock:  connected socket
+ *      buf:   bytes to send
+ *      len:   number of bytes
+ *
+ *  returns:  NO_ERROR once every byte is sent, ERR_DB_FILE on failure
+ */
+static int send_all(int sock, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = send(sock, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  queue_reply
+ *      *cli:  client the bytes are for
+ *      buf:   bytes to send
+ *      len:   number of bytes
+ *
+ *  Adds bytes to the end of the client's pending reply.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int queue_reply(sdb_client_t *cli, const void *buf, size_t len)
+{
+    if (write(cli->out_fd, buf, len) != (ssize_t)len)
+        return ERR_DB_FILE;
+    cli->out_len += len;
+    return NO_ERROR;
+}
+
+/*
+ *  queue_reply_eof
+ *      *cli:       client the reply is for
+ *      exit_code:  exit code of the request
+ *
+ *  Ends the reply to one request.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int queue_reply_eof(sdb_client_t *cli, int exit_code)
+{
+    char eof[2] = {SDB_SVR_EOF_CHAR, (char)exit_code};
+
+    return queue_reply(cli, eof, sizeof(eof));
+}
+
+/*
+ *  send_replies
+ *      *cli:  client with a pending reply
+ *
+ *  Sends as much of the pending reply as the socket takes without
+ *  blocking.  Once all of it is sent the buffer is emptied for the next
+ *  request.
+ *
+ *  returns:  NO_ERROR       all sent, or the rest waits for POLLOUT
+ *            ERR_DB_FILE    the client can't be written to
+ */
+static int send_replies(sdb_client_t *cli)
+{
+    while (cli->out_off < cli->out_len)
+    {
+        ssize_t n = sendfile(cli->sock, cli->out_fd, &cli->out_off, cli->out_len - cli->out_off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return NO_ERROR;
+        if (n <= 0)
+            return ERR_DB_FILE;
+    }
+
+    if (cli->out_len > 0 &&
+        (ftruncate(cli->out_fd, 0) == -1 || lseek(cli->out_fd, 0, SEEK_SET) == -1))
+        return ERR_DB_FILE;
+    cli->out_off = cli->out_len = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  exec_request
+ *      *pfd:     database descriptor, updated by -x and -z
+ *      exename:  program name, for usage()
+ *      *cli:     client that sent the request
+ *      line:     the request, modified in place
+ *
+ *  Splits a request into words and runs it with exec_db_command(), with
+ *  stdout pointing at the client's reply buffer for the duration of the
+ *  command.  A -b request is refused with M_ERR_BATCH_NESTED.
+ *
+ *  returns:  NO_ERROR       request answered, keep the connection
+ *            ERR_DB_OP      the client sent "exit"
+ *            SRCH_NOT_FOUND the client sent "stop-server"
+ *            ERR_DB_FILE    the reply can't be buffered
+ */
+static int exec_request(int *pfd, char *exename, sdb_client_t *cli, char *line)
+{
+    char *argv[SDB_CMD_MAX_ARGS + 2];
+    char opt[3];
+    int exit_code;
+
+    int argc = parse_db_command(line, exename, argv, opt);
+    if (argc < 0)
+    {
+        if (queue_reply(cli, M_ERR_SVR_REQUEST, strlen(M_ERR_SVR_REQUEST)) != NO_ERROR)
+            return ERR_DB_FILE;
+        return queue_reply_eof(cli, EXIT_FAIL_ARGS);
+    }
+
+    // blank lines get an empty reply
+    if (argc == 1)
+        return queue_reply_eof(cli, EXIT_OK);
+
+    if (strcmp(argv[1], "exit") == 0)
+    {
+        queue_reply_eof(cli, EXIT_OK);
+        return ERR_DB_OP;
+    }
+    if (strcmp(argv[1], "stop-server") == 0)
+    {
+        queue_reply_eof(cli, EXIT_OK);
+        return SRCH_NOT_FOUND;
+    }
+
+    // a batch would hold up every other client until it ends
+    if (argv[1][0] == '-' && argv[1][1] == 'b')
+    {
+        if (queue_reply(cli, M_ERR_BATCH_NESTED, strlen(M_ERR_BATCH_NESTED)) != NO_ERROR)
+            return ERR_DB_FILE;
+        return queue_reply_eof(cli, EXIT_FAIL_ARGS);
+    }
+
+    // the command prints with printf(), so point stdout at the reply
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    if (saved_stdout < 0 || dup2(cli->out_fd, STDOUT_FILENO) < 0)
+    {
+        if (saved_stdout >= 0)
+            close(saved_stdout);
+        return ERR_DB_FILE;
+    }
+
+    exit_code = exec_db_command(pfd, argc, argv);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    // stdout shares the file offset of out_fd, which ends the output
+    off_t end = lseek(cli->out_fd, 0, SEEK_CUR);
+    if (end == -1)
+        return ERR_DB_FILE;
+    cli->out_len = end;
+    return queue_reply_eof(cli, exit_code);
+}
+
+/*
+ *  serve_client
+ *      *pfd:     database descriptor
+ *      exename:  program name, for usage()
+ *      *cli:     the client poll() woke up for
+ *      revents:  what poll() reported for it
+ *
+ *  Sends what is left of the client's reply, reads what it sent, and runs
+ *  its complete request lines one at a time.  A request is only run once
+ *  the reply to the one before has gone out, so a client that stops
+ *  reading stalls itself and nobody else, and never has more than one
+ *  reply buffered.  The remains of a partial line are kept for the next
+ *  read.
+ *
+ *  returns:  NO_ERROR to keep the connection, ERR_DB_OP to close it,
+ *            SRCH_NOT_FOUND to stop the server
+ */
+static int serve_client(int *pfd, char *exename, sdb_client_t *cli, short revents)
+{
+    if (send_replies(cli) != NO_ERROR)
+        return ERR_DB_OP;
+
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) && cli->out_len == 0)
+    {
+        ssize_t n = recv(cli->sock, cli->buf + cli->len, sizeof(cli->buf) - cli->len, 0);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            return NO_ERROR;
+        if (n <= 0)
+            return ERR_DB_OP;
+        cli->len += n;
+    }
+
+    char *start = cli->buf;
+    char *nl;
+    while (cli->out_len == 0 && (nl = memchr(start, '\n', cli->buf + cli->len - start)) != NULL)
+    {
+        *nl = '\0';
+        int rc = exec_request(pfd, exename, cli, start);
+        start = nl + 1;
+        if (rc != NO_ERROR)
+        {
+            // the last reply goes out if the socket takes it right away
+            send_replies(cli);
+            return rc == ERR_DB_FILE ? ERR_DB_OP : rc;
+        }
+        if (send_replies(cli) != NO_ERROR)
+            return ERR_DB_OP;
+    }
+
+    cli->len -= start - cli->buf;
+    memmove(cli->buf, start, cli->len);
+
+    // a line that does not fit can never be completed
+    if (cli->len == sizeof(cli->buf))
+    {
+        queue_reply(cli, M_ERR_SVR_REQUEST, strlen(M_ERR_SVR_REQUEST));
+        queue_reply_eof(cli, EXIT_FAIL_ARGS);
+        send_replies(cli);
+        return ERR_DB_OP;
+    }
+    return NO_ERROR;
+}
+
+// hangs up on a client and frees its slot
+static void drop_client(sdb_client_t *cli)
+{
+    close(cli->sock);
+    close(cli->out_fd);
+    cli->sock = -1;
+    cli->out_fd = -1;
+}
+
+/*
+ *  add_client
+ *      *cli:  free slot
+ *      sock:  socket accept() returned
+ *
+ *  Makes the socket non-blocking and gives the client its reply buffer, a
+ *  memfd the command output is written to and sendfile() sends from.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int add_client(sdb_client_t *cli, int sock)
+{
+    int flags = fcntl(sock, F_GETFL);
+
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+        return ERR_DB_FILE;
+    cli->out_fd = memfd_create("sdbsc-reply", MFD_CLOEXEC);
+    if (cli->out_fd == -1)
+        return ERR_DB_FILE;
+
+    cli->sock = sock;
+    cli->len = 0;
+    cli->out_off = cli->out_len = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  run_server
+ *      *pfd:     descriptor of the open database, updated by -x and -z
+ *      exename:  program name, for usage()
+ *
+ *  Serves requests until a client sends "stop-server" or the server gets
+ *  SIGINT or SIGTERM.
+ *
+ *  returns:  EXIT_OK when stopped, EXIT_FAIL_DB if the socket fails
+ *
+ *  console:  M_SVR_STARTED     once the server is listening
+ *            M_SVR_STOPPED     when it stops
+ *            M_ERR_SVR_SOCKET  the socket can't be created
+ */
+int run_server(int *pfd, char *exename)
+{
+    struct pollfd fds[SDB_SVR_MAX_CLIENTS + 1];
+    sdb_client_t *clients;
+    struct sigaction sa;
+    char path[PATH_MAX];
+    int svr_socket;
+    int exit_code = EXIT_OK;
+    bool running = true;
+
+    sock_path(path, sizeof(path));
+    svr_socket = boot_server(path);
+    if (svr_socket < 0)
+    {
+        printf(M_ERR_SVR_SOCKET, path);
+        return EXIT_FAIL_DB;
+    }
+
+    clients = malloc(SDB_SVR_MAX_CLIENTS * sizeof(sdb_client_t));
+    if (clients == NULL)
+    {
+        close(svr_socket);
+        unlink(path);
+        return EXIT_FAIL_DB;
+    }
+    for (int i = 0; i < SDB_SVR_MAX_CLIENTS; i++)
+    {
+        clients[i].sock = -1;
+        clients[i].out_fd = -1;
+    }
+
+    // a client that goes away mid reply must not kill the server, and
+    // nothing the server runs may wait on the terminal (-i with no file)
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = svr_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    int devnull = open("/dev/null", O_RDONLY);
+    if (devnull >= 0)
+    {
+        dup2(devnull, STDIN_FILENO);
+        close(devnull);
+    }
+
+    printf(M_SVR_STARTED, DB_FILE, path);
+    fflush(stdout);
+
+    while (running && !svr_stop)
+    {
+        int nfds = 1;
+
+        fds[0].fd = svr_socket;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < SDB_SVR_MAX_CLIENTS; i++)
+        {
+            if (clients[i].sock < 0)
+                continue;
+            // a client with a reply still going out is not read from
+            fds[nfds].fd = clients[i].sock;
+            fds[nfds].events = clients[i].out_len > 0 ? POLLOUT : POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+
+        // wake up in time to commit a queued log group
+        int rc = poll(fds, nfds, wal_due_ms(*pfd));
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        if (rc == 0)
+        {
+            if (wal_flush(*pfd) != NO_ERROR)
+            {
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+            continue;
+        }
+
+        // requests from clients already connected
+        for (int i = 0, f = 1; i < SDB_SVR_MAX_CLIENTS && running; i++)
+        {
+            if (clients[i].sock < 0)
+                continue;
+            if (fds[f++].revents == 0)
+                continue;
+
+            rc = serve_client(pfd, exename, &clients[i], fds[f - 1].revents);
+            if (rc == SRCH_NOT_FOUND)
+                running = false;
+
+            // a failed -x or -z leaves no database to serve
+            if (*pfd < 0)
+            {
+                exit_code = EXIT_FAIL_DB;
+                running = false;
+            }
+            if (rc != NO_ERROR)
+                drop_client(&clients[i]);
+        }
+
+        // new connections, turned away when every slot is in use
+        if (running && (fds[0].revents & POLLIN))
+        {
+            int cli_socket = accept(svr_socket, NULL, NULL);
+            if (cli_socket < 0)
+                continue;
+
+            int slot = 0;
+            while (slot < SDB_SVR_MAX_CLIENTS && clients[slot].sock >= 0)
+                slot++;
+            if (slot == SDB_SVR_MAX_CLIENTS || add_client(&clients[slot], cli_socket) != NO_ERROR)
+                close(cli_socket);
+        }
+    }
+
+    for (int i = 0; i < SDB_SVR_MAX_CLIENTS; i++)
+    {
+        if (clients[i].sock >= 0)
+            drop_client(&clients[i]);
+    }
+    free(clients);
+    close(svr_socket);
+    unlink(path);
+
+    printf(M_SVR_STOPPED);
+    return exit_code;
+}
+
+/*
+ *  client_request
+ *      sock:  socket connected to the server
+ *      line:  request, ending in a newline
+ *
+ *  Sends one request and copies the reply to stdout.
+ *
+ *  returns:  exit code of the request, or EXIT_FAIL_DB if the server
+ *            went away
+ */
+static int client_request(int sock, const char *line)
+{
+    char buf[4096];
+    bool eof = false;
+
+    if (send_all(sock, line, strlen(line)) != NO_ERROR)
+        return EXIT_FAIL_DB;
+
+    for (;;)
+    {
+        ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return EXIT_FAIL_DB;
+
+        // the exit code may come in a later recv() than the EOF char
+        if (eof)
+            return (unsigned char)buf[0];
+
+        char *end = memchr(buf, SDB_SVR_EOF_CHAR, n);
+        fwrite(buf, 1, end != NULL ? end - buf : n, stdout);
+        if (end == NULL)
+            continue;
+
+        if (end + 1 < buf + n)
+            return (unsigned char)end[1];
+        eof = true;
+    }
+}
+
+/*
+ *  run_client
+ *      argc:  number of words in argv
+ *      argv:  one request, "-f 100", or nothing to send each line of
+ *             stdin as a request over the same connection
+ *
+ *  Client side of the server: the output of each request is printed just
+ *  like the command line sdbsc would print it.
+ *
+ *  returns:  exit code of the request, or the highest exit code of all of
+ *            them in stdin mode, EXIT_FAIL_DB if no server is running
+ *
+ *  console:  the output of the requests
+ *            M_ERR_SVR_CONNECT  no server is listening on the socket
+ */
+int run_client(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    char line[SDB_SVR_LINE_MAX];
+    char *path = addr.sun_path;
+    int exit_code = EXIT_OK;
+    int sock;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    sock_path(addr.sun_path, sizeof(addr.sun_path));
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        printf(M_ERR_SVR_CONNECT, path);
+        if (sock >= 0)
+            close(sock);
+        return EXIT_FAIL_DB;
+    }
+
+    if (argc > 0)
+    {
+        // put the words back together as one request line
+        size_t len = 0;
+        line[0] = '\0';
+        for (int i = 0; i < argc; i++)
+        {
+            int n = snprintf(line + len, sizeof(line) - len, "%s%s", i ? " " : "", argv[i]);
+            if (n < 0 || (size_t)n >= sizeof(line) - len - 1)
+            {
+                printf(M_ERR_SVR_REQUEST);
+                close(sock);
+                return EXIT_FAIL_ARGS;
+            }
+            len += n;
+        }
+        strcat(line, "\n");
+        exit_code = client_request(sock, line);
+    }
+    else
+    {
+        while (fgets(line, sizeof(line), stdin) != NULL)
+        {
+            size_t len = strlen(line);
+            if (line[len - 1] != '\n')
+            {
+                // the server would drop a line this long, skip the rest of it
+                if (len == sizeof(line) - 1)
+                {
+                    int c;
+                    while ((c = getchar()) != EOF && c != '\n')
+                        ;
+                    printf(M_ERR_SVR_REQUEST);
+                    exit_code = EXIT_FAIL_ARGS;
+                    continue;
+                }
+                strcat(line, "\n");
+            }
+
+            int rc = client_request(sock, line);
+            if (rc > exit_code)
+                exit_code = rc;
+
+            // the server hangs up after these
+            if (strcmp(line, "exit\n") == 0 || strcmp(line, "stop-server\n") == 0)
+                break;
+        }
+    }
+
+    fflush(stdout);
+    close(sock);
+    return exit_code;
+}
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbsc_snap.h"
+
+/*
+ *  Snapshots
+ *
+ *  print_db(), the gpa reports and export_db() read the database as it was
+ *  when they started, without holding a lock while they run.  Starting one
+ *  pins a snapshot: under a short header write lock it takes one of
+ *  DB_SNAP_SLOTS slots in a side file (dbFile + DB_SNAP_SUFFIX) and loads
+ *  the occupancy bitmap.  From then on, any writer about to change a 4KB
+ *  page of the database file first appends a copy of the page as it is to
+ *  the snapshot file, once per page for each pinned snapshot.  A report
+ *  reads the database file as usual and lays the copies saved for its slot
+ *  over what it read, so writers never wait for it and it never sees
+ *  their changes.
+ *
+ *  A pinned slot is held with a read lock on its byte of the snapshot
+ *  file, so slots left by a process that died are found and freed by the
+ *  next pin.  The saved pages are dropped once no snapshot is pinned.  If
+ *  every slot is taken a report runs unpinned, and like before it can see
+ *  changes made while it runs.  sdbsc -z empties the database under a
+ *  running report, a snapshot does not survive that.
+ */
+static db_snap_t db_snap = {.fd = -1, .snap_fd = -1, .slot = -1};
+
+// guards db_snap.saved while a pinned scan runs on several threads
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// offset of saved page i in the snapshot file
+static off_t snap_entry_off(unsigned int i)
+{
+    return SNAP_LOG_OFF + (off_t)i * SNAP_ENTRY_SZ;
+}
+
+// bucket of page in m, the one holding it or the free one it would go in
+static unsigned int snap_map_bucket(const snap_map_t *m, uint64_t page)
+{
+    unsigned int b = (unsigned int)((page + 1) * 0x9E3779B97F4A7C15ULL >> 32) & (m->cap - 1);
+
+    while (m->keys[b] != 0 && m->keys[b] != page + 1)
+        b = (b + 1) & (m->cap - 1);
+    return b;
+}
+
+// value kept for page, NULL if there is none
+static unsigned int *snap_map_get(snap_map_t *m, uint64_t page)
+{
+    if (m->n == 0)
+        return NULL;
+
+    unsigned int b = snap_map_bucket(m, page);
+    return m->keys[b] != 0 ? &m->vals[b] : NULL;
+}
+
+// sets the value of page, the table is kept at most half full
+static int snap_map_put(snap_map_t *m, uint64_t page, unsigned int val)
+{
+    if (2 * (m->n + 1) > m->cap)
+    {
+        snap_map_t big = {NULL, NULL, m->cap != 0 ? 2 * m->cap : 1024, m->n};
+
+        big.keys = calloc(big.cap, sizeof(*big.keys));
+        big.vals = malloc(big.cap * sizeof(*big.vals));
+        if (big.keys == NULL || big.vals == NULL)
+        {
+            free(big.keys);
+            free(big.vals);
+            return ERR_DB_FILE;
+        }
+        for (unsigned int b = 0; b < m->cap; b++)
+        {
+            if (m->keys[b] == 0)
+                continue;
+            unsigned int nb = snap_map_bucket(&big, m->keys[b] - 1);
+            big.keys[nb] = m->keys[b];
+            big.vals[nb] = m->vals[b];
+        }
+        free(m->keys);
+        free(m->vals);
+        *m = big;
+    }
+
+    unsigned int b = snap_map_bucket(m, page);
+    if (m->keys[b] == 0)
+    {
+        m->keys[b] = page + 1;
+        m->n++;
+    }
+    m->vals[b] = val;
+    return NO_ERROR;
+}
+
+// empties m, keeping its buckets
+static void snap_map_clear(snap_map_t *m)
+{
+    if (m->n != 0)
+        memset(m->keys, 0, m->cap * sizeof(*m->keys));
+    m->n = 0;
+}
+
+/*
+ *  snap_sync
+ *
+ *  Brings db_snap.saved up to date with the pages saved in the snapshot
+ *  file.  While this process has a snapshot pinned it maps each page saved
+ *  for its slot to the first copy, which is the page as the snapshot saw
+ *  it.  Otherwise it maps each page to the pinned slots that already have
+ *  a copy, starting over whenever a slot is pinned or freed.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int snap_sync(void)
+{
+    db_snap_hdr_t *sh = db_snap.hdr;
+    unsigned int seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE);
+    unsigned int active = __atomic_load_n(&sh->active, __ATOMIC_ACQUIRE);
+    unsigned int nsaved = __atomic_load_n(&sh->nsaved, __ATOMIC_ACQUIRE);
+    db_snap_entry_t e;
+
+    if (db_snap.slot == -1 && (!db_snap.built || seq != db_snap.seq))
+    {
+        snap_map_clear(&db_snap.saved);
+        db_snap.seen = nsaved;
+        for (int s = 0; s < DB_SNAP_SLOTS; s++)
+        {
+            if ((active >> s & 1) && sh->start[s] < db_snap.seen)
+                db_snap.seen = sh->start[s];
+        }
+        db_snap.seq = seq;
+        db_snap.built = true;
+    }
+
+    for (; db_snap.seen < nsaved; db_snap.seen++)
+    {
+        unsigned int i = db_snap.seen;
+
+        if (pread(db_snap.snap_fd, &e, sizeof(e), snap_entry_off(i)) != sizeof(e))
+            return ERR_DB_FILE;
+
+        if (db_snap.slot != -1)
+        {
+            if ((e.slots >> db_snap.slot & 1) && snap_map_get(&db_snap.saved, e.page) == NULL &&
+                snap_map_put(&db_snap.saved, e.page, i) != NO_ERROR)
+                return ERR_DB_FILE;
+            continue;
+        }
+
+        // a slot pinned again since the copy was saved does not own it
+        unsigned int slots = 0;
+        for (int s = 0; s < DB_SNAP_SLOTS; s++)
+        {
+            if ((e.slots & active) >> s & 1 && i >= sh->start[s])
+                slots |= 1u << s;
+        }
+        unsigned int *have = snap_map_get(&db_snap.saved, e.page);
+        if (slots != 0 &&
+            snap_map_put(&db_snap.saved, e.page, slots | (have != NULL ? *have : 0)) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  snap_save
+ *      fd:   linux file descriptor
+ *      len:  number of bytes about to be written
+ *      off:  file offset of the write
+ *
+ *  Called by db_phys_write() before it changes the file.  Every page the
+ *  write touches that a pinned snapshot has no copy of yet is appended to
+ *  the snapshot file as it is now, zeros past the end of the database, and
+ *  published by bumping nsaved.  Only then is the page changed, so a
+ *  reader that sees the new data also finds the copy.  Costs one load when
+ *  no snapshot is pinned.  Writers hold the header write lock.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int snap_save(int fd, size_t len, off_t off)
+{
+    struct {
+        db_snap_entry_t e;
+        unsigned char   page[DB_PAGE_SIZE];
+    } copy;
+
+    if (db_snap.fd != fd || len == 0 ||
+        __atomic_load_n(&db_snap.hdr->active, __ATOMIC_ACQUIRE) == 0)
+        return NO_ERROR;
+
+    if (snap_sync() != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_snap_hdr_t *sh = db_snap.hdr;
+    unsigned int active = __atomic_load_n(&sh->active, __ATOMIC_ACQUIRE);
+    off_t last = (off + len - 1) / DB_PAGE_SIZE;
+
+    for (off_t p = off / DB_PAGE_SIZE; p <= last; p++)
+    {
+        unsigned int *have = snap_map_get(&db_snap.saved, p);
+        unsigned int had = have != NULL ? *have : 0;
+        unsigned int need = active & ~had;
+
+        if (need == 0)
+            continue;
+
+        ssize_t got = db_phys_read(fd, copy.page, DB_PAGE_SIZE, p * DB_PAGE_SIZE);
+        if (got == -1)
+            return ERR_DB_FILE;
+        memset(copy.page + got, 0, DB_PAGE_SIZE - got);
+        memset(&copy.e, 0, sizeof(copy.e));
+        copy.e.page = p;
+        copy.e.slots = need;
+
+        unsigned int i = sh->nsaved;
+        if (pwrite(db_snap.snap_fd, &copy, sizeof(copy), snap_entry_off(i)) != sizeof(copy))
+            return ERR_DB_FILE;
+        __atomic_store_n(&sh->nsaved, i + 1, __ATOMIC_RELEASE);
+        db_snap.seen = i + 1;
+        if (snap_map_put(&db_snap.saved, p, had | need) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  snap_overlay
+ *      fd:   linux file descriptor
+ *      buf:  bytes just read from the database file
+ *      len:  number of bytes asked for
+ *      off:  file offset of the read
+ *      got:  what the read returned
+ *
+ *  Lays the copies saved for the pinned snapshot of this process over a
+ *  read, so it returns the pages as the snapshot saw them.  The database
+ *  is read first, so a page a writer changed in the meantime always has
+ *  its copy published by then.  Scan threads may call it side by side.
+ *
+ *  returns:  got, or more if a copy reaches past a short read, or -1 on
+ *            I/O errors
+ */
+ssize_t snap_overlay(int fd, void *buf, size_t len, off_t off, ssize_t got)
+{
+    ssize_t end = got;
+    int rc;
+
+    if (got == -1 || len == 0 || db_snap.fd != fd || db_snap.slot == -1)
+        return got;
+
+    // nothing saved since the pin, the common case
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&db_snap.hdr->nsaved, __ATOMIC_ACQUIRE) == db_snap.hdr->start[db_snap.slot])
+        return got;
+
+    if ((size_t)got < len)
+        memset((char *)buf + got, 0, len - got);
+
+    pthread_mutex_lock(&snap_lock);
+    rc = snap_sync();
+    pthread_mutex_unlock(&snap_lock);
+    if (rc != NO_ERROR)
+        return -1;
+
+    off_t last = (off + len - 1) / DB_PAGE_SIZE;
+    for (off_t p = off / DB_PAGE_SIZE; p <= last; p++)
+    {
+        pthread_mutex_lock(&snap_lock);
+        unsigned int *saved = snap_map_get(&db_snap.saved, p);
+        unsigned int i = saved != NULL ? *saved : 0;
+        pthread_mutex_unlock(&snap_lock);
+        if (saved == NULL)
+            continue;
+
+        off_t from = p * DB_PAGE_SIZE > off ? p * DB_PAGE_SIZE : off;
+        off_t to = (p + 1) * DB_PAGE_SIZE < off + (off_t)len ? (p + 1) * DB_PAGE_SIZE : off + (off_t)len;
+        off_t at = snap_entry_off(i) + sizeof(db_snap_entry_t) + (from - p * DB_PAGE_SIZE);
+
+        if (pread(db_snap.snap_fd, (char *)buf + (from - off), to - from, at) != to - from)
+            return -1;
+        if (to - off > end)
+            end = to - off;
+    }
+    return end;
+}
+
+/*
+ *  snap_sweep
+ *
+ *  Frees the slots of processes that died with a snapshot pinned, their
+ *  byte of the snapshot file is no longer locked, and drops the saved pages
+ *  once no slot is pinned.  Called with the header write locked.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int snap_sweep(void)
+{
+    db_snap_hdr_t *sh = db_snap.hdr;
+
+    for (int s = 0; s < DB_SNAP_SLOTS; s++)
+    {
+        if (s == db_snap.slot || !(__atomic_load_n(&sh->active, __ATOMIC_ACQUIRE) >> s & 1))
+            continue;
+
+        int rc = lock_range(db_snap.snap_fd, F_WRLCK, s, 1, false);
+        if (rc == ERR_DB_OP)
+            continue;
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+        __atomic_fetch_and(&sh->active, ~(1u << s), __ATOMIC_ACQ_REL);
+        __atomic_fetch_add(&sh->seq, 1, __ATOMIC_ACQ_REL);
+        lock_range(db_snap.snap_fd, F_UNLCK, s, 1, false);
+    }
+
+    if (__atomic_load_n(&sh->active, __ATOMIC_ACQUIRE) == 0 && sh->nsaved != 0)
+    {
+        if (ftruncate(db_snap.snap_fd, SNAP_LOG_OFF) == -1)
+            return ERR_DB_FILE;
+        __atomic_store_n(&sh->nsaved, 0, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&sh->seq, 1, __ATOMIC_ACQ_REL);
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  snap_open
+ *      fd:      linux file descriptor
+ *      dbFile:  name of the database file
+ *      create:  create the snapshot file if it is not there
+ *
+ *  Opens the snapshot file and maps its header.  The file is never
+ *  truncated with the database, other processes may have snapshots of it
+ *  pinned.  Called with the header write locked.
+ *
+ *  returns:  NO_ERROR on success, or if there is no file and create is
+ *            false, ERR_DB_FILE on failure
+ */
+int snap_open(int fd, char *dbFile, bool create)
+{
+    char path[PATH_MAX];
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_SNAP_SUFFIX);
+    db_snap.snap_fd = open(path, O_RDWR | (create ? O_CREAT : 0), mode);
+    if (db_snap.snap_fd == -1)
+        return !create && errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+    db_snap.fd = fd;
+
+    // the file is only used once its header is mapped
+    void *base = MAP_FAILED;
+    if (fstat(db_snap.snap_fd, &st) == 0 &&
+        (st.st_size >= SNAP_LOG_OFF || ftruncate(db_snap.snap_fd, SNAP_LOG_OFF) == 0))
+        base = mmap(NULL, SNAP_LOG_OFF, PROT_READ | PROT_WRITE, MAP_SHARED, db_snap.snap_fd, 0);
+    if (base == MAP_FAILED)
+    {
+        snap_close(fd);
+        return ERR_DB_FILE;
+    }
+    db_snap.hdr = base;
+
+    if (memcmp(db_snap.hdr->magic, DB_SNAP_MAGIC, sizeof(db_snap.hdr->magic)) != 0)
+    {
+        memset(db_snap.hdr, 0, sizeof(*db_snap.hdr));
+        memcpy(db_snap.hdr->magic, DB_SNAP_MAGIC, sizeof(db_snap.hdr->magic));
+    }
+    return snap_sweep();
+}
+
+// unpins and closes the snapshot file that belongs to fd
+void snap_close(int fd)
+{
+    if (db_snap.fd != fd)
+        return;
+
+    snap_unpin(fd);
+    if (db_snap.hdr != NULL)
+        munmap(db_snap.hdr, SNAP_LOG_OFF);
+    close(db_snap.snap_fd);
+    free(db_snap.saved.keys);
+    free(db_snap.saved.vals);
+    memset(&db_snap, 0, sizeof(db_snap));
+    db_snap.fd = -1;
+    db_snap.snap_fd = -1;
+    db_snap.slot = -1;
+}
+
+// the mapped header page of the snapshot file of fd, NULL if it has none
+db_snap_hdr_t *snap_hdr(int fd)
+{
+    return db_snap.fd == fd ? db_snap.hdr : NULL;
+}
+
+/*
+ *  snap_pin
+ *      fd:    linux file descriptor
+ *      *hdr:  receives the database header
+ *      *occ:  receives the occupancy bitmap
+ *
+ *  Pins a snapshot of the database for a report and loads its bitmap, both
+ *  under one short header write lock so no change is half in either.
+ *  Until snap_unpin() every read of the database returns it as it was at
+ *  this point.  If every slot is taken, or the database was never changed
+ *  and has no snapshot file, the bitmap is loaded all the same and the
+ *  report reads the live database.  A process pins one snapshot
+ *  at a time and does not change the database while it is pinned.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int snap_pin(int fd, db_header_t *hdr, db_occmap_t *occ)
+{
+    int rc = NO_ERROR;
+
+    if (lock_header(fd, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // the snapshot file and the bitmap may have been created since open
+    if ((rc = side_attach(fd, false)) == NO_ERROR && db_snap.fd == fd &&
+        db_snap.slot == -1 && (rc = snap_sweep()) == NO_ERROR)
+    {
+        db_snap_hdr_t *sh = db_snap.hdr;
+
+        for (int s = 0; s < DB_SNAP_SLOTS; s++)
+        {
+            if ((sh->active >> s & 1) ||
+                lock_range(db_snap.snap_fd, F_WRLCK, s, 1, false) != NO_ERROR)
+                continue;
+
+            sh->start[s] = sh->nsaved;
+            __atomic_fetch_or(&sh->active, 1u << s, __ATOMIC_ACQ_REL);
+            __atomic_fetch_add(&sh->seq, 1, __ATOMIC_ACQ_REL);
+
+            // the slot stays read locked for as long as it is pinned
+            if (lock_range(db_snap.snap_fd, F_RDLCK, s, 1, false) != NO_ERROR)
+                rc = ERR_DB_FILE;
+            db_snap.slot = s;
+            db_snap.seen = sh->start[s];
+            db_snap.built = false;
+            snap_map_clear(&db_snap.saved);
+            break;
+        }
+    }
+
+    if (rc == NO_ERROR)
+        rc = load_occupancy(fd, hdr, occ);
+    if (lock_header(fd, F_UNLCK) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+        snap_unpin(fd);
+    return rc;
+}
+
+/*
+ *  snap_unpin
+ *      fd:  linux file descriptor
+ *
+ *  Frees the slot snap_pin() took, if it took one.  The last snapshot to
+ *  be unpinned drops the saved pages.
+ */
+void snap_unpin(int fd)
+{
+    if (db_snap.fd != fd || db_snap.slot == -1)
+        return;
+
+    db_snap_hdr_t *sh = db_snap.hdr;
+    unsigned int left = __atomic_and_fetch(&sh->active, ~(1u << db_snap.slot), __ATOMIC_ACQ_REL);
+
+    __atomic_fetch_add(&sh->seq, 1, __ATOMIC_ACQ_REL);
+    lock_range(db_snap.snap_fd, F_UNLCK, db_snap.slot, 1, false);
+    db_snap.slot = -1;
+    db_snap.built = false;
+    snap_map_clear(&db_snap.saved);
+
+    if (left == 0 && lock_header(fd, F_WRLCK) == NO_ERROR)
+    {
+        snap_sweep();
+        lock_header(fd, F_UNLCK);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef __SDB_SNAP_H__
+    #define __SDB_SNAP_H__
+
+#include "sdbsc.h" //get the occupancy map type
+
+//page -> value table of the snapshot code, open addressing
+typedef struct snap_map {
+    uint64_t     *keys;     //page + 1, 0 marks a free bucket
+    unsigned int *vals;
+    unsigned int  cap;      //buckets, a power of 2
+    unsigned int  n;        //buckets in use
+} snap_map_t;
+
+//the snapshot file that belongs to the open database (see snap_pin())
+#define SNAP_LOG_OFF    DB_PAGE_SIZE    //saved pages follow the header page
+#define SNAP_ENTRY_SZ   (sizeof(db_snap_entry_t) + DB_PAGE_SIZE)
+typedef struct db_snap {
+    int            fd;      //database descriptor the snapshots belong to
+    int            snap_fd; //descriptor of the snapshot file
+    db_snap_hdr_t *hdr;     //header page, mapped MAP_SHARED
+    int            slot;    //slot this process has pinned, -1 if none
+    bool           built;   //saved matches hdr->seq
+    unsigned int   seq;     //hdr->seq saved was built for
+    unsigned int   seen;    //saved pages looked at so far
+    snap_map_t     saved;   //pinned: page -> its saved copy
+                            //writing: page -> slots that have a copy
+} db_snap_t;
+
+//snapshot prototypes
+int snap_open(int fd, char *dbFile, bool create);
+void snap_close(int fd);
+db_snap_hdr_t *snap_hdr(int fd);
+int snap_pin(int fd, db_header_t *hdr, db_occmap_t *occ);
+void snap_unpin(int fd);
+int snap_save(int fd, size_t len, off_t off);
+ssize_t snap_overlay(int fd, void *buf, size_t len, off_t off, ssize_t got);
+
+#endif
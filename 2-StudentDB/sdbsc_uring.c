@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h> //raw io_uring interface, liburing is not needed
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbsc_cache.h"
+#include "sdbsc_snap.h"
+#include "sdbsc_uring.h"
+
+/*
+ *  Batched I/O
+ *
+ *  A batch of finds or an import of scattered ids costs one pread() or
+ *  pwrite() per record with the read/write backend.  SDB_BACKEND=uring is
+ *  that backend plus an io_uring: db_read_many() and db_write_many() put
+ *  up to URING_DEPTH transfers in the submission ring and hand them all to
+ *  the kernel with one io_uring_enter(), which also waits for and reaps
+ *  their completions.  Everything else still goes through db_read_at() and
+ *  db_write_at().  If the kernel has no io_uring (or it is not allowed),
+ *  or its ring has no IORING_OP_READ and IORING_OP_WRITE (before 5.6), the
+ *  batches fall back to one call per transfer, as they do with the other
+ *  backends and the paged layout's writes.
+ */
+static db_uring_t db_uring = {.fd = -1, .ring_fd = -1};
+
+// true if the ring can do IORING_OP_READ and IORING_OP_WRITE, kernels too
+// old for them don't have IORING_REGISTER_PROBE either and fail the probe
+static bool uring_probe(int ring_fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    bool ok = false;
+
+    if (probe == NULL)
+        return false;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+        ok = probe->last_op >= IORING_OP_WRITE &&
+             (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+             (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+/*
+ *  uring_open
+ *      fd:  descriptor of the database just opened
+ *
+ *  Sets up the rings of the uring backend when SDB_BACKEND asks for it.
+ *  A kernel that won't give us a ring, or gives one that can't do plain
+ *  reads and writes, leaves db_read_many() and db_write_many() on pread()
+ *  and pwrite(), so this never fails.
+ */
+void uring_open(int fd)
+{
+    char *backend = getenv(DB_BACKEND_ENV);
+    struct io_uring_params p;
+
+    if (backend == NULL || strcmp(backend, DB_BACKEND_URING) != 0)
+        return;
+
+    memset(&p, 0, sizeof(p));
+    int ring_fd = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (ring_fd == -1)
+        return;
+    if (!uring_probe(ring_fd))
+    {
+        close(ring_fd);
+        return;
+    }
+
+    db_uring.fd = fd;
+    db_uring.ring_fd = ring_fd;
+    db_uring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    db_uring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    db_uring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    db_uring.sq_ring = mmap(NULL, db_uring.sq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    db_uring.cq_ring = mmap(NULL, db_uring.cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    db_uring.sqes = mmap(NULL, db_uring.sqes_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (db_uring.sq_ring == MAP_FAILED || db_uring.cq_ring == MAP_FAILED ||
+        db_uring.sqes == MAP_FAILED)
+    {
+        uring_close(fd);
+        return;
+    }
+
+    char *sq = db_uring.sq_ring, *cq = db_uring.cq_ring;
+    db_uring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    db_uring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    db_uring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    db_uring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    db_uring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    db_uring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    db_uring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    db_uring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+// unmaps and closes the rings, batches go back to pread() and pwrite()
+void uring_close(int fd)
+{
+    if (db_uring.fd != fd || db_uring.ring_fd == -1)
+        return;
+
+    if (db_uring.sq_ring != NULL && db_uring.sq_ring != MAP_FAILED)
+        munmap(db_uring.sq_ring, db_uring.sq_len);
+    if (db_uring.cq_ring != NULL && db_uring.cq_ring != MAP_FAILED)
+        munmap(db_uring.cq_ring, db_uring.cq_len);
+    if (db_uring.sqes != NULL && db_uring.sqes != MAP_FAILED)
+        munmap(db_uring.sqes, db_uring.sqes_len);
+    close(db_uring.ring_fd);
+    db_uring = (db_uring_t){.fd = -1, .ring_fd = -1};
+}
+
+// fills in the next submission, io gets its result, at most URING_DEPTH
+// are queued between two uring_submit() calls
+static void uring_queue(int op, void *buf, size_t len, off_t off, db_io_t *io)
+{
+    unsigned tail = *db_uring.sq_tail;
+    unsigned i = tail & *db_uring.sq_mask;
+    struct io_uring_sqe *sqe = &db_uring.sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = db_uring.fd;
+    sqe->off = off;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = (uintptr_t)io;
+    db_uring.sq_array[i] = i;
+    __atomic_store_n(db_uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    db_uring.queued++;
+}
+
+/*
+ *  uring_submit
+ *
+ *  Hands the queued transfers to the kernel and waits for all of them,
+ *  setting the res of each one's db_io_t.  That is one io_uring_enter()
+ *  unless a signal or the kernel cuts it short.  If the ring fails it is
+ *  closed, so later batches fall back to pread() and pwrite().
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if io_uring_enter() failed
+ */
+static int uring_submit(void)
+{
+    unsigned want = db_uring.queued, submitted = 0, done = 0;
+
+    while (done < want)
+    {
+        int n = syscall(__NR_io_uring_enter, db_uring.ring_fd, want - submitted,
+                        want - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+        {
+            uring_close(db_uring.fd);
+            return ERR_DB_FILE;
+        }
+        submitted += n;
+
+        unsigned head = *db_uring.cq_head;
+        unsigned tail = __atomic_load_n(db_uring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, done++)
+        {
+            struct io_uring_cqe *cqe = &db_uring.cqes[head & *db_uring.cq_mask];
+            db_io_t *io = (db_io_t *)(uintptr_t)cqe->user_data;
+            io->res = cqe->res < 0 ? -1 : cqe->res;
+        }
+        __atomic_store_n(db_uring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    db_uring.queued = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  db_read_many
+ *      fd:  linux file descriptor
+ *      io:  the reads, each one's res is set as db_read_at() returns it
+ *      n:   number of reads
+ *
+ *  db_read_at() of every read in io.  With the uring backend, the reads
+ *  the page cache can't serve go to the kernel URING_DEPTH at a time, so
+ *  a batch costs n / URING_DEPTH system calls rather than n.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the ring failed
+ */
+int db_read_many(int fd, db_io_t *io, int n)
+{
+    off_t phys[URING_DEPTH];
+
+    if (db_uring.fd != fd)
+    {
+        for (int i = 0; i < n; i++)
+            io[i].res = db_read_at(fd, io[i].buf, io[i].len, io[i].off);
+        return NO_ERROR;
+    }
+
+    for (int first = 0; first < n; first += URING_DEPTH)
+    {
+        db_io_t *chunk = io + first;
+        int m = n - first < URING_DEPTH ? n - first : URING_DEPTH;
+
+        for (int i = 0; i < m; i++)
+        {
+            db_io_t *r = &chunk[i];
+            bool paged = db_paged(fd);
+
+            // a paged read over several pages is left to dir_read()
+            phys[i] = paged ? dir_phys(r->off) : r->off;
+            if (paged && r->off % DB_PAGE_SIZE + r->len > DB_PAGE_SIZE)
+            {
+                r->res = db_read_at(fd, r->buf, r->len, r->off);
+                phys[i] = -1;
+            }
+            else if (phys[i] == -1)
+            {
+                memset(r->buf, 0, r->len);
+                r->res = r->len;
+            }
+            else if ((r->res = cache_peek(fd, r->buf, r->len, phys[i])) == -1)
+            {
+                uring_queue(IORING_OP_READ, r->buf, r->len, phys[i], r);
+            }
+        }
+
+        if (uring_submit() != NO_ERROR)
+            return ERR_DB_FILE;
+
+        for (int i = 0; i < m; i++)
+            if (phys[i] != -1)
+                chunk[i].res = snap_overlay(fd, chunk[i].buf, chunk[i].len, phys[i], chunk[i].res);
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_write_many
+ *      fd:  linux file descriptor
+ *      io:  the writes, each one's res is set as db_write_at() returns it
+ *      n:   number of writes, none of them may overlap
+ *
+ *  db_write_at() of every write in io, with the uring backend all of them
+ *  go to the kernel URING_DEPTH at a time.  Snapshots save the pages
+ *  first, and the page cache and checksums follow once they are done,
+ *  just as for db_phys_write().  The paged layout allocates pages as it
+ *  writes, so it always writes one at a time.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the ring failed
+ */
+int db_write_many(int fd, db_io_t *io, int n)
+{
+    if (db_uring.fd != fd || db_paged(fd))
+    {
+        for (int i = 0; i < n; i++)
+            io[i].res = db_write_at(fd, io[i].buf, io[i].len, io[i].off);
+        return NO_ERROR;
+    }
+
+    for (int first = 0; first < n; first += URING_DEPTH)
+    {
+        db_io_t *chunk = io + first;
+        int m = n - first < URING_DEPTH ? n - first : URING_DEPTH;
+
+        for (int i = 0; i < m; i++)
+        {
+            chunk[i].res = -1;
+            if (snap_save(fd, chunk[i].len, chunk[i].off) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+
+        cache_begin_write(fd);
+        for (int i = 0; i < m; i++)
+            uring_queue(IORING_OP_WRITE, chunk[i].buf, chunk[i].len, chunk[i].off, &chunk[i]);
+        int rc = uring_submit();
+        for (int i = 0; i < m - 1; i++)
+            cache_update(fd, chunk[i].buf, chunk[i].res, chunk[i].off);
+        cache_end_write(fd, chunk[m - 1].buf, chunk[m - 1].res, chunk[m - 1].off);
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+
+        // writes that share a page have it summed once, after all of them
+        for (int i = 0; i < m; i++)
+        {
+            if (chunk[i].res <= 0)
+                continue;
+
+            const void *buf = chunk[i].buf;
+            off_t from = chunk[i].off;
+            off_t to = from + chunk[i].res;
+            while (i + 1 < m && chunk[i + 1].res > 0 && chunk[i + 1].off >= to &&
+                   chunk[i + 1].off / DB_PAGE_SIZE <= to / DB_PAGE_SIZE)
+            {
+                i++;
+                to = chunk[i].off + chunk[i].res;
+                buf = NULL;
+            }
+            if (crc_update(fd, buf, to - from, from) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
@@ -0,0 +1,32 @@
+#ifndef __SDB_URING_H__
+    #define __SDB_URING_H__
+
+//one transfer of a batch, see db_read_many()
+typedef struct db_io {
+    void    *buf;
+    size_t   len;
+    off_t    off;           //logical offset, as for db_read_at()
+    ssize_t  res;           //bytes transferred, -1 on an I/O error
+} db_io_t;
+
+//io_uring rings of the uring backend (see db_read_many())
+#define URING_DEPTH     256     //transfers submitted per io_uring_enter()
+typedef struct db_uring {
+    int       fd;           //database descriptor the ring belongs to, -1 if none
+    int       ring_fd;
+    unsigned  queued;       //sqes filled in since the last submit
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void     *sq_ring, *cq_ring;
+    size_t    sq_len, cq_len, sqes_len;
+} db_uring_t;
+
+//batched I/O prototypes
+void uring_open(int fd);
+void uring_close(int fd);
+int db_read_many(int fd, db_io_t *io, int n);
+int db_write_many(int fd, db_io_t *io, int n);
+
+#endif
@@ -0,0 +1,614 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbsc_col.h"
+#include "sdbsc_wal.h"
+
+/*
+ *  Write-ahead log
+ *
+ *  With SDB_WAL=records[,ms] in the environment, add_student() and
+ *  del_student() do not touch the database directly.  Each change is queued
+ *  as a db_wal_rec_t holding the full record image, and a group commit
+ *  appends the queue to the log (dbFile + DB_WAL_SUFFIX) with one write and
+ *  one fdatasync() before applying it to the database.  A group is committed
+ *  once it holds `records` changes, once its oldest change is `ms`
+ *  milliseconds old, before any scan, and on close_db().  So at most one
+ *  group can be lost in a crash and a group is never half applied.
+ *
+ *  Records are numbered in the order they are logged, and the numbers keep
+ *  growing across checkpoints (see db_wal_hdr_t).  The database header
+ *  says whether a process may be logging changes (wal_log) and below which
+ *  number every record is known to be applied (wal_floor).  A change that
+ *  skips the log, from a process without SDB_WAL or an import, first
+ *  replays the records from wal_floor on and moves wal_floor past them
+ *  (see wal_catch_up()), so a log record is never replayed over a newer
+ *  change to the same student.
+ *
+ *  The log is emptied at checkpoints, after every record in it has been
+ *  replayed and the database itself synced: on close_db(), whenever it grows
+ *  past WAL_CHECKPOINT_BYTES, and in open_db() when no live process holds
+ *  the log, whether or not SDB_WAL is set.  Every record is a full image so
+ *  replaying one twice is harmless.  The log file itself is only created by
+ *  the first change a process logs.
+ */
+static db_wal_t db_wal = {.fd = -1, .wal_fd = -1};
+
+// writes one change to the database, the caller holds the header lock
+static int write_change(int fd, int op, const student_t *s)
+{
+    bool add = op == WAL_OP_ADD;
+
+    if (update_occupancy(fd, s->id, add, add ? s : &EMPTY_STUDENT_RECORD) != NO_ERROR ||
+        idx_update(fd, s, add) != NO_ERROR || col_update(fd, s, add) != NO_ERROR)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+// FNV-1a checksum of a log record, not counting the checksum field itself
+static unsigned int wal_checksum(const db_wal_rec_t *r)
+{
+    const unsigned char *p = (const unsigned char *)r;
+    unsigned int h = 2166136261u;
+
+    for (size_t i = 0; i < offsetof(db_wal_rec_t, checksum); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+// true if a log record was written whole
+static bool wal_valid(const db_wal_rec_t *r)
+{
+    return memcmp(r->magic, WAL_REC_MAGIC, sizeof(r->magic)) == 0 &&
+           r->checksum == wal_checksum(r) &&
+           (r->op == WAL_OP_ADD || r->op == WAL_OP_DEL);
+}
+
+// true if the write-ahead log is active for fd
+bool wal_enabled(int fd)
+{
+    return fd >= 0 && db_wal.fd == fd && db_wal.sync_recs > 0;
+}
+
+// sets the wal_log flag of the database header, the caller holds the header lock
+static int wal_mark(int fd, int on)
+{
+    db_header_t hdr;
+
+    if (load_occupancy(fd, &hdr, NULL) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (hdr.wal_log == on)
+        return NO_ERROR;
+    hdr.wal_log = on;
+    return db_write_at(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) ? NO_ERROR : ERR_DB_FILE;
+}
+
+// empties the log, the next record appended is numbered base
+static int wal_reset(unsigned long long base)
+{
+    db_wal_hdr_t wh = {DB_WAL_MAGIC, base, {0}};
+
+    // the header goes first: records left behind by a crash before the
+    // truncate are numbered below base and never replayed again
+    if (pwrite(db_wal.wal_fd, &wh, sizeof(wh), 0) != sizeof(wh) ||
+        ftruncate(db_wal.wal_fd, sizeof(wh)) == -1 || fdatasync(db_wal.wal_fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  wal_tail
+ *      *base:  receives the number of the first record in the log file
+ *      *end:   receives the number the next record appended gets
+ *
+ *  Reads the log header and works out where the log ends, cutting off a
+ *  record a crash left half written.  The caller holds the append lock or
+ *  the whole log.
+ *
+ *  returns:  NO_ERROR       on success
+ *            SRCH_NOT_FOUND the log has no header yet
+ *            ERR_DB_FILE    on I/O errors
+ */
+static int wal_tail(unsigned long long *base, unsigned long long *end)
+{
+    db_wal_hdr_t wh;
+    struct stat st;
+
+    if (fstat(db_wal.wal_fd, &st) == -1)
+        return ERR_DB_FILE;
+    ssize_t n = pread(db_wal.wal_fd, &wh, sizeof(wh), 0);
+    if (n == -1)
+        return ERR_DB_FILE;
+    if (n != sizeof(wh) || memcmp(wh.magic, DB_WAL_MAGIC, sizeof(wh.magic)) != 0)
+        return SRCH_NOT_FOUND;
+
+    off_t nrecs = (st.st_size - (off_t)sizeof(wh)) / (off_t)sizeof(db_wal_rec_t);
+    off_t size = (off_t)sizeof(wh) + nrecs * (off_t)sizeof(db_wal_rec_t);
+    if (size != st.st_size && ftruncate(db_wal.wal_fd, size) == -1)
+        return ERR_DB_FILE;
+
+    *base = wh.base;
+    *end = wh.base + nrecs;
+    return NO_ERROR;
+}
+
+/*
+ *  wal_replay
+ *      fd:    linux file descriptor, the caller holds the header lock
+ *      base:  number of the first record in the log file
+ *      from:  first record number to replay
+ *      end:   number past the last record to replay
+ *
+ *  Applies the valid records numbered from..end-1 in order.  Torn or
+ *  corrupt records are skipped, and so are records numbered below from,
+ *  which a checkpoint that crashed before emptying the log can leave
+ *  behind.
+ *
+ *  returns:  number of records replayed, or ERR_DB_FILE on I/O errors
+ */
+static int wal_replay(int fd, unsigned long long base, unsigned long long from,
+                      unsigned long long end)
+{
+    db_wal_rec_t *recs = malloc(WAL_MAX_PENDING * sizeof(db_wal_rec_t));
+    unsigned long long pos = from > base ? from : base;
+    int replayed = 0;
+
+    if (recs == NULL)
+        return ERR_DB_FILE;
+
+    while (pos < end)
+    {
+        size_t nrecs = end - pos < WAL_MAX_PENDING ? end - pos : WAL_MAX_PENDING;
+        off_t off = (off_t)sizeof(db_wal_hdr_t) + (off_t)(pos - base) * sizeof(db_wal_rec_t);
+        ssize_t n = pread(db_wal.wal_fd, recs, nrecs * sizeof(db_wal_rec_t), off);
+        if (n == -1)
+        {
+            free(recs);
+            return ERR_DB_FILE;
+        }
+        // the log was truncated under us (sdbsc -z), nothing more to replay
+        if (n < (ssize_t)sizeof(db_wal_rec_t))
+            break;
+
+        nrecs = n / sizeof(db_wal_rec_t);
+        for (size_t i = 0; i < nrecs; i++)
+        {
+            if (!wal_valid(&recs[i]) || recs[i].seq < from || recs[i].seq >= end)
+                continue;
+            if (write_change(fd, recs[i].op, &recs[i].rec) != NO_ERROR)
+            {
+                free(recs);
+                return ERR_DB_FILE;
+            }
+            replayed++;
+        }
+        pos += nrecs;
+    }
+    free(recs);
+    return replayed;
+}
+
+/*
+ *  wal_catch_up
+ *      fd:     linux file descriptor, the caller holds the header lock
+ *      force:  look at the log even if the header says nobody logs changes
+ *      *pend:  receives the number the next record logged gets, or NULL
+ *
+ *  Records numbered from the header's wal_floor on may not be applied yet,
+ *  their process may have crashed between the log and the database.  They
+ *  are replayed here and wal_floor moves past them before anything changes
+ *  the database without the log, so a later replay never brings back an
+ *  older image of a student changed in the meantime.  The replay is synced
+ *  before wal_floor moves, and wal_floor before the change that follows.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int wal_catch_up(int fd, bool force, unsigned long long *pend)
+{
+    db_header_t hdr;
+    unsigned long long base, end;
+
+    if (db_wal.fd != fd)
+        return NO_ERROR;
+    if (load_occupancy(fd, &hdr, NULL) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (pend != NULL)
+        *pend = hdr.wal_floor;
+    if (!hdr.wal_log && !force)
+        return NO_ERROR;
+
+    // a process that started before the log existed opens it now
+    if (db_wal.wal_fd == -1)
+    {
+        db_wal.wal_fd = open(db_wal.path, O_RDWR);
+        if (db_wal.wal_fd == -1)
+            return errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+    }
+
+    if (lock_range(db_wal.wal_fd, F_WRLCK, WAL_LOCK_APPEND, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    int rc = wal_tail(&base, &end);
+    if (lock_range(db_wal.wal_fd, F_UNLCK, WAL_LOCK_APPEND, 1, true) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR || end <= hdr.wal_floor)
+        return rc == ERR_DB_FILE ? rc : NO_ERROR;
+
+    if (wal_replay(fd, base, hdr.wal_floor, end) < 0 || sync_db(fd) != NO_ERROR ||
+        load_occupancy(fd, &hdr, NULL) != NO_ERROR)
+        return ERR_DB_FILE;
+    hdr.wal_floor = end;
+    if (db_write_at(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || sync_db(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (pend != NULL)
+        *pend = end;
+    return NO_ERROR;
+}
+
+/*
+ *  apply_change
+ *      fd:   linux file descriptor
+ *      op:   WAL_OP_ADD or WAL_OP_DEL
+ *      *s:   the student added, or the student being deleted
+ *
+ *  Writes one change straight to the database: the record slot, the
+ *  occupancy bitmap and header, the last name index and the columns, all
+ *  under the header lock.  Records other processes logged are caught up
+ *  with first so a replay can never undo the change.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int apply_change(int fd, int op, const student_t *s)
+{
+    int rc = NO_ERROR;
+
+    if (lock_change(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (wal_catch_up(fd, false, NULL) != NO_ERROR || write_change(fd, op, s) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (lock_header(fd, F_UNLCK) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+/*
+ *  wal_checkpoint
+ *      fd:       linux file descriptor
+ *      closing:  the caller will not append to the log again
+ *
+ *  Replays every record the database may not have yet, makes the database
+ *  durable and then empties the log.  The log is left alone while other
+ *  processes hold it, the last one out empties it and, if it is closing,
+ *  clears the header's wal_log flag.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int wal_checkpoint(int fd, bool closing)
+{
+    unsigned long long base, end, next;
+
+    int rc = lock_range(db_wal.wal_fd, F_WRLCK, WAL_LOCK_HOLD, 1, false);
+    if (rc == ERR_DB_OP)
+        return NO_ERROR;
+    if (rc != NO_ERROR || lock_change(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = wal_catch_up(fd, true, &next);
+    if (rc == NO_ERROR)
+    {
+        // a log that holds nothing but its header is already empty
+        int tail = wal_tail(&base, &end);
+        if (tail == ERR_DB_FILE)
+            rc = ERR_DB_FILE;
+        else if (tail == SRCH_NOT_FOUND || base != end)
+            rc = sync_db(fd) == NO_ERROR ? wal_reset(next) : ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR && closing && wal_mark(fd, 0) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (lock_header(fd, F_UNLCK) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    db_wal.marked = false;
+
+    // back to a shared hold if we keep appending to it
+    if (lock_range(db_wal.wal_fd, closing ? F_UNLCK : F_RDLCK, WAL_LOCK_HOLD, 1, true) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    db_wal.held = !closing;
+    return rc;
+}
+
+/*
+ *  wal_append
+ *      fd:  linux file descriptor
+ *
+ *  Numbers the queued records and appends them to the log under its
+ *  append lock, then waits for them to be durable.  The first append
+ *  creates the log if it is not there and holds it from then on.  The
+ *  database header is marked first so processes that skip the log know to
+ *  catch up.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+static int wal_append(int fd)
+{
+    size_t len = db_wal.npending * sizeof(db_wal_rec_t);
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    unsigned long long base, end;
+    db_header_t hdr;
+    int rc = NO_ERROR;
+
+    if (!db_wal.held)
+    {
+        if (db_wal.wal_fd == -1)
+            db_wal.wal_fd = open(db_wal.path, O_RDWR | O_CREAT, mode);
+        if (db_wal.wal_fd == -1 ||
+            lock_range(db_wal.wal_fd, F_RDLCK, WAL_LOCK_HOLD, 1, true) != NO_ERROR)
+            return ERR_DB_FILE;
+        db_wal.held = true;
+    }
+
+    if (!db_wal.marked)
+    {
+        if (lock_change(fd) != NO_ERROR)
+            return ERR_DB_FILE;
+        rc = wal_mark(fd, 1);
+        if (lock_header(fd, F_UNLCK) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        if (rc != NO_ERROR)
+            return rc;
+        db_wal.marked = true;
+    }
+
+    if (lock_range(db_wal.wal_fd, F_WRLCK, WAL_LOCK_APPEND, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = wal_tail(&base, &end);
+    if (rc == SRCH_NOT_FOUND)
+    {
+        // a new log starts at the database's floor
+        rc = load_occupancy(fd, &hdr, NULL);
+        if (rc == NO_ERROR)
+            rc = wal_reset(hdr.wal_floor);
+        base = end = hdr.wal_floor;
+    }
+
+    for (int i = 0; i < db_wal.npending; i++)
+    {
+        db_wal.pending[i].seq = end + i;
+        db_wal.pending[i].checksum = wal_checksum(&db_wal.pending[i]);
+    }
+    off_t off = (off_t)sizeof(db_wal_hdr_t) + (off_t)(end - base) * sizeof(db_wal_rec_t);
+    if (rc == NO_ERROR && pwrite(db_wal.wal_fd, db_wal.pending, len, off) != (ssize_t)len)
+        rc = ERR_DB_FILE;
+
+    if (lock_range(db_wal.wal_fd, F_UNLCK, WAL_LOCK_APPEND, 1, true) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && fdatasync(db_wal.wal_fd) == -1)
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+/*
+ *  wal_flush
+ *      fd:  linux file descriptor
+ *
+ *  Group commit: appends every queued change to the log, waits for it to
+ *  be durable, then applies the changes to the database.  The queue is
+ *  empty afterwards even if the commit fails: a group that could not be
+ *  logged is dropped, one that was logged but not applied is left to the
+ *  next replay, and either way the error goes to the caller that committed
+ *  it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int wal_flush(int fd)
+{
+    struct stat st;
+    int rc = NO_ERROR;
+
+    if (!wal_enabled(fd) || db_wal.npending == 0)
+        return NO_ERROR;
+
+    rc = wal_append(fd);
+    if (rc == NO_ERROR && lock_change(fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR)
+    {
+        for (int i = 0; rc == NO_ERROR && i < db_wal.npending; i++)
+            rc = write_change(fd, db_wal.pending[i].op, &db_wal.pending[i].rec);
+        if (lock_header(fd, F_UNLCK) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+
+    // the records of the group are no longer ours to hold
+    for (int i = 0; i < db_wal.npending; i++)
+    {
+        off_t off = (off_t)db_wal.pending[i].rec.id * STUDENT_RECORD_SIZE;
+        if (lock_range(fd, F_UNLCK, off, STUDENT_RECORD_SIZE, false) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    db_wal.npending = 0;
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (fstat(db_wal.wal_fd, &st) == 0 && st.st_size >= WAL_CHECKPOINT_BYTES)
+        return wal_checkpoint(fd, false);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_log
+ *      fd:   linux file descriptor
+ *      op:   WAL_OP_ADD or WAL_OP_DEL
+ *      *s:   the student added, or the student being deleted
+ *
+ *  Queues a change for the next group commit, and commits the group if the
+ *  SDB_WAL policy says it is due.  A group is committed before the queue
+ *  can overflow.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int wal_log(int fd, int op, const student_t *s)
+{
+    if (db_wal.npending >= WAL_MAX_PENDING &&
+        (wal_flush(fd) != NO_ERROR || db_wal.npending >= WAL_MAX_PENDING))
+        return ERR_DB_FILE;
+
+    db_wal_rec_t *r = &db_wal.pending[db_wal.npending];
+
+    memset(r, 0, sizeof(*r));
+    memcpy(r->magic, WAL_REC_MAGIC, sizeof(r->magic));
+    r->op = op;
+    r->rec = *s;
+
+    if (db_wal.npending++ == 0)
+        clock_gettime(CLOCK_MONOTONIC, &db_wal.first_pending);
+
+    if (db_wal.npending >= db_wal.sync_recs ||
+        (db_wal.sync_ms > 0 && elapsed_ms(&db_wal.first_pending) >= db_wal.sync_ms))
+        return wal_flush(fd);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_lookup
+ *      id:  student id
+ *      *s:  receives the queued record of id
+ *
+ *  Looks for a change to id that is queued but not committed yet, so
+ *  get_student() sees a process's own writes.
+ *
+ *  returns:  NO_ERROR       a queued add, copied to *s
+ *            SRCH_NOT_FOUND a queued delete
+ *            ERR_DB_OP      nothing queued for id
+ */
+int wal_lookup(int id, student_t *s)
+{
+    for (int i = db_wal.npending - 1; i >= 0; i--)
+    {
+        if (db_wal.pending[i].rec.id != id)
+            continue;
+        if (db_wal.pending[i].op == WAL_OP_DEL)
+            return SRCH_NOT_FOUND;
+        *s = db_wal.pending[i].rec;
+        return NO_ERROR;
+    }
+    return ERR_DB_OP;
+}
+
+/*
+ *  wal_due_ms
+ *      fd:  linux file descriptor
+ *
+ *  Tells a caller that waits for input (the server) how long it may wait
+ *  before the queued group must be committed.  With no time limit in the
+ *  policy a group is due as soon as the caller is idle.
+ *
+ *  returns:  -1 if nothing is queued, else milliseconds until the group
+ *            is due (0 if it is due now)
+ */
+int wal_due_ms(int fd)
+{
+    if (!wal_enabled(fd) || db_wal.npending == 0)
+        return -1;
+    if (db_wal.sync_ms <= 0)
+        return 0;
+
+    double left = db_wal.sync_ms - elapsed_ms(&db_wal.first_pending);
+    return left > 0 ? (int)left + 1 : 0;
+}
+
+/*
+ *  commit_change
+ *      fd:   linux file descriptor
+ *      op:   WAL_OP_ADD or WAL_OP_DEL
+ *      *s:   the student added, or the student being deleted
+ *
+ *  Entry point add_student() and del_student() use for their writes: the
+ *  change goes through the log if it is enabled, straight to the database
+ *  otherwise.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int commit_change(int fd, int op, const student_t *s)
+{
+    if (wal_enabled(fd))
+        return wal_log(fd, op, s);
+    return apply_change(fd, op, s);
+}
+
+/*
+ *  wal_open
+ *      fd:      descriptor of the database just opened
+ *      dbFile:  name of the database file
+ *
+ *  Reads the SDB_WAL policy and opens the log if another process left one
+ *  behind.  A log no live process holds is checkpointed here, replaying
+ *  whatever a crashed process logged but did not apply.  Without a log
+ *  nothing is created, the first change logged does that.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+int wal_open(int fd, char *dbFile)
+{
+    char *policy = getenv(DB_WAL_ENV);
+
+    db_wal.sync_recs = 0;
+    db_wal.sync_ms = 0;
+    db_wal.npending = 0;
+    db_wal.marked = false;
+    db_wal.held = false;
+    if (policy != NULL && sscanf(policy, "%d,%d", &db_wal.sync_recs, &db_wal.sync_ms) >= 1 &&
+        db_wal.sync_recs > WAL_MAX_PENDING)
+        db_wal.sync_recs = WAL_MAX_PENDING;
+
+    // kept even without a log, wal_append() creates it and wal_catch_up()
+    // opens one another process created
+    snprintf(db_wal.path, sizeof(db_wal.path), "%s%s", dbFile, DB_WAL_SUFFIX);
+    db_wal.fd = fd;
+    db_wal.wal_fd = open(db_wal.path, O_RDWR);
+    if (db_wal.wal_fd == -1)
+        return errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+
+    // a log another process holds is still in use, only one nobody holds
+    // is checkpointed.  We hold it again once we log a change.
+    return wal_checkpoint(fd, true);
+}
+
+/*
+ *  wal_close
+ *      fd:  database file descriptor
+ *
+ *  Commits the last group and checkpoints before the log is closed.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on I/O errors
+ */
+int wal_close(int fd)
+{
+    int rc = NO_ERROR;
+
+    if (db_wal.fd != fd)
+        return NO_ERROR;
+
+    if (wal_enabled(fd) &&
+        (wal_flush(fd) != NO_ERROR || (db_wal.held && wal_checkpoint(fd, true) != NO_ERROR)))
+        rc = ERR_DB_FILE;
+
+    if (db_wal.wal_fd != -1)
+        close(db_wal.wal_fd);
+    db_wal.fd = -1;
+    db_wal.wal_fd = -1;
+    db_wal.npending = 0;
+    return rc;
+}
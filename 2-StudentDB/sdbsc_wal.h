@@ -0,0 +1,36 @@
+#ifndef __SDB_WAL_H__
+    #define __SDB_WAL_H__
+
+#include "db.h" //get the log record type
+
+//write-ahead log state, see wal_open()
+#define WAL_MAX_PENDING         4096            //largest group commit
+#define WAL_CHECKPOINT_BYTES    (4 * 1024 * 1024)
+#define WAL_LOCK_HOLD           0               //log byte read locked by its users
+#define WAL_LOCK_APPEND         1               //log byte write locked to append
+typedef struct db_wal {
+    int             fd;             //database descriptor the log belongs to
+    int             wal_fd;         //descriptor of the log file, -1 if none
+    char            path[PATH_MAX]; //name of the log file
+    int             sync_recs;      //commit a group at this many changes, 0 = off
+    int             sync_ms;        //or when its oldest change is this old
+    int             npending;       //changes queued for the next commit
+    bool            marked;         //wal_log is set in the database header
+    bool            held;           //WAL_LOCK_HOLD is read locked by us
+    struct timespec first_pending;  //when the oldest queued change was made
+    db_wal_rec_t    pending[WAL_MAX_PENDING];
+} db_wal_t;
+
+//write-ahead log prototypes
+int wal_open(int fd, char *dbFile);
+int wal_close(int fd);
+int wal_log(int fd, int op, const student_t *s);
+int wal_flush(int fd);
+int wal_lookup(int id, student_t *s);
+bool wal_enabled(int fd);
+int wal_catch_up(int fd, bool force, unsigned long long *pend);
+int wal_due_ms(int fd);
+int commit_change(int fd, int op, const student_t *s);
+int apply_change(int fd, int op, const student_t *s);
+
+#endif
@@ -166,7 +166,6 @@ setup_file() {
 
 
 @test "Compress db - try 1" {
-    skip
     run ./sdbsc -x
     [ "$status" -eq 0 ]
     [ "${lines[0]}" = "Database successfully compressed!" ] || {
@@ -192,4 +191,954 @@ setup_file() {
         echo "Failed Output:  $output"
         return 1
     }
-}
\ No newline at end of file
+}
+
+@test "Bulk import students" {
+    run bash -c 'printf "2,amy,lee,350\n3,dup,rec,100\n4\tbob\tray\t3.10\n" | ./sdbsc -i'
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Imported 2 student record(s) into database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Skipped 1 duplicate or invalid record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 4
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "4 bob ray 3.10" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+}
+
+@test "Find students by last name" {
+    run ./sdbsc -l doe
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 3 jane doe 3.90 63 jim doe 2.85 1 john doe 3.45"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -l nobody
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No students with last name nobody were found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Query students by gpa range" {
+    run ./sdbsc -g 340 360
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 2 amy lee 3.50"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -s
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "GPA statistics for 5 student(s): min 2.85, max 3.90, mean 3.36" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Concurrent adds lock records" {
+    for i in $(seq 1 16); do
+        ./sdbsc -a 90000 same id 300 > concurrent.$i &
+        ./sdbsc -a $((90000 + i)) other id 300 > /dev/null &
+    done
+    wait
+
+    added=$(cat concurrent.* | grep -c "added to database")
+    rm -f concurrent.*
+    [ "$added" -eq 1 ] || {
+        echo "Student 90000 added $added times"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 22 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    for i in $(seq 0 16); do
+        ./sdbsc -d $((90000 + i)) > /dev/null
+    done
+}
+
+@test "Serve requests from a running server" {
+    ./sdbsc -S > /dev/null &
+    for i in $(seq 1 50); do
+        [ -S student.db.sock ] && break
+        sleep 0.1
+    done
+
+    run ./sdbsc -C f 3
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 3 jane doe 3.90"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -C -f 64
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 64 was not found in database." ]
+
+    run bash -c 'printf "a 77 sam lee 300\nd 77\nc\nstop-server\n" | ./sdbsc -C'
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 77 added to database." ]
+    [ "${lines[1]}" = "Student 77 was deleted from database." ]
+    [ "${lines[2]}" = "Database contains 5 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    wait
+}
+
+@test "Run a batch of commands" {
+    run bash -c 'printf -- "-a 81 ann lee 300\n-a 80 bob lee 310\n-f 81\n-d 80\n-a 81 ann lee 300\n-c\nd 81\n" | ./sdbsc -b'
+    [ "$status" -eq 1 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="Student 81 added to database. Student 80 added to database. ID FIRST_NAME LAST_NAME GPA 81 ann lee 3.00 Student 80 was deleted from database. Cant add student with ID=81, already exists in db. Database contains 6 student record(s). Student 81 was deleted from database."
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "A batch can not run another batch" {
+    mkdir -p nested
+    cd nested
+    rm -f student.db*
+
+    printf -- "-a 1 ann lee 300\n-b loop.txt\n-c\n" > loop.txt
+    run ../sdbsc -b loop.txt
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Student 1 added to database." ]
+    [ "${lines[1]}" = "Cant run a batch from a batch or a server request!" ]
+    [ "${lines[2]}" = "Database contains 1 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # nor can a request to the server
+    ../sdbsc -S > /dev/null &
+    for i in $(seq 1 50); do
+        [ -S student.db.sock ] && break
+        sleep 0.1
+    done
+    run ../sdbsc -C -b loop.txt
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Cant run a batch from a batch or a server request!" ]
+    run ../sdbsc -C c
+    [ "${lines[0]}" = "Database contains 1 student record(s)." ]
+    ../sdbsc -C stop-server > /dev/null
+    wait
+
+    cd ..
+    rm -rf nested
+}
+
+@test "Export and import a roster" {
+    run ./sdbsc -e csv
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "id,first_name,last_name,gpa" ]
+    [ "${lines[1]}" = "1,john,doe,345" ]
+
+    run ./sdbsc -e bin roster.bin
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Exported 5 student record(s) to roster.bin." ]
+
+    ./sdbsc -e csv > roster.csv
+    ./sdbsc -z > /dev/null
+    run ./sdbsc -i roster.bin
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Imported 5 student record(s) into database." ]
+
+    run ./sdbsc -e csv
+    [ "$output" = "$(cat roster.csv)" ]
+    rm -f roster.bin roster.csv
+
+    run ./sdbsc -e xml
+    [ "$status" -eq 2 ]
+}
+
+@test "Parallel scans print the same as sequential ones" {
+    [ "$(SDB_THREADS=4 ./sdbsc -p)" = "$(SDB_THREADS=1 ./sdbsc -p)" ]
+    [ "$(SDB_THREADS=4 ./sdbsc -g 0 400)" = "$(SDB_THREADS=1 ./sdbsc -g 0 400)" ]
+    [ "$(SDB_THREADS=4 ./sdbsc -s)" = "$(SDB_THREADS=1 ./sdbsc -s)" ]
+}
+
+@test "Parallel scans of a big database match sequential ones" {
+    mkdir -p pscan
+    cd pscan
+    rm -f student.db*
+
+    # well past PSCAN_MIN_RECS, with gaps so the id ranges are uneven
+    for i in $(seq 1 3 60000); do echo "$i,first$i,last$((i % 97)),$((i * 13 % 501))"; done > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+    for i in $(seq 10 7 30000); do echo "-d $i"; done > deletes.txt
+    ../sdbsc -b deletes.txt > /dev/null || true
+
+    # the column store would answer -s and -g without scanning the records
+    for query in "-c" "-s" "-g 100 300" "-p"; do
+        SDB_COLUMNS=off SDB_THREADS=4 ../sdbsc $query > parallel.out
+        SDB_COLUMNS=off SDB_THREADS=1 ../sdbsc $query > sequential.out
+        cmp parallel.out sequential.out
+    done
+    [ "$(wc -l < parallel.out)" -gt 8192 ]
+
+    cd ..
+    rm -rf pscan
+}
+
+@test "A paged database holds large ids in a small file" {
+    mkdir -p paged
+    cd paged
+    rm -f student.db*
+
+    run env SDB_LAYOUT=paged ../sdbsc -a 999999999 big id 345
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 999999999 added to database." ]
+
+    # the layout is kept in the header, the variable is only read on create
+    run ../sdbsc -a 7 small id 300
+    [ "$status" -eq 0 ]
+
+    run ../sdbsc -f 999999999
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "999999999 big                      id                               3.45" ]
+
+    run stat --format="%s" student.db
+    [ "$output" -le 8192 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ../sdbsc -d 999999999
+    [ "${lines[0]}" = "Student 999999999 was deleted from database." ]
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 1 student record(s)." ]
+
+    cd ..
+    rm -rf paged
+}
+
+@test "Verify finds a corrupted page" {
+    unset SDB_LAYOUT
+    mkdir -p verify
+    cd verify
+    rm -f student.db*
+
+    ../sdbsc -a 1 john doe 345 > /dev/null
+    ../sdbsc -a 200 jane doe 390 > /dev/null
+    ../sdbsc -d 1 > /dev/null
+
+    run ../sdbsc -v
+    [ "$status" -eq 0 ]
+    [[ "${lines[0]}" == "Verified 4 page(s) of the database in "*" ms, no errors." ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # flip a byte of jane's first name behind sdbsc's back
+    printf 'J' | dd of=student.db bs=1 seek=$((200 * 64 + 4)) conv=notrunc 2> /dev/null
+    run ../sdbsc -v
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Page 3 of the database file fails its checksum!" ]
+    [ "${lines[1]}" = "1 of 4 page(s) failed verification." ]
+
+    cd ..
+    rm -rf verify
+}
+
+@test "A report reads the database as it was when it started" {
+    mkdir -p snap
+    cd snap
+    rm -f student.db* pipe
+
+    # big enough that print_db() is still writing when the pipe fills up
+    seq 1 30000 | awk '{ print $1 ",first" $1 ",last" $1 ",300" }' > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+    SDB_THREADS=1 ../sdbsc -p > before
+
+    mkfifo pipe
+    SDB_THREADS=1 ../sdbsc -p > pipe &
+    exec 3< pipe
+    dd bs=100 count=1 <&3 > first 2> /dev/null
+
+    # the report is stalled on the pipe with its snapshot pinned
+    ../sdbsc -d 1 > /dev/null
+    ../sdbsc -d 29000 > /dev/null
+    ../sdbsc -a 30001 new student 400 > /dev/null
+
+    cat <&3 > rest
+    exec 3<&-
+    wait
+    cat first rest > after
+    cmp before after
+
+    run ../sdbsc -f 30001
+    [ "$status" -eq 0 ]
+
+    cd ..
+    rm -rf snap
+}
+
+@test "A cached page sees changes made by other processes" {
+    mkdir -p cache
+    cd cache
+    rm -f student.db*
+
+    ../sdbsc -a 3 jane doe 390 > /dev/null
+    # the server maps the file unless told to read it, reads go through the cache
+    SDB_BACKEND=rw SDB_CACHE=4K ../sdbsc -S > /dev/null &
+    for i in $(seq 1 50); do
+        [ -S student.db.sock ] && break
+        sleep 0.1
+    done
+
+    # the server reads the page once, then serves it from its cache
+    run ../sdbsc -C -f 3
+    [ "$status" -eq 0 ]
+    run ../sdbsc -C -f 3
+    [ "$status" -eq 0 ]
+
+    ../sdbsc -d 3 > /dev/null
+    ../sdbsc -a 3 jim doe 250 > /dev/null
+    run ../sdbsc -C -f 3
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 3 jim doe 2.50"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    ../sdbsc -d 3 > /dev/null
+    run ../sdbsc -C -f 3
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 3 was not found in database." ]
+
+    ../sdbsc -C stop-server > /dev/null
+    wait
+    cd ..
+    rm -rf cache
+}
+
+@test "Batched finds and imports through io_uring match the read/write backend" {
+    mkdir -p uring
+    cd uring
+    rm -f student.db* rw.out uring.out
+
+    for i in $(seq 5 37 74000); do echo "$i,first$i,last$i,3.$((i % 10))0"; done > scattered.csv
+    for i in $(seq 1 11 75000); do echo "-f $i"; done > finds.txt
+    echo "-a 38 new student 250" >> finds.txt
+    echo "-f 38" >> finds.txt
+
+    for backend in rw uring; do
+        rm -f student.db*
+        SDB_BACKEND=$backend ../sdbsc -i scattered.csv > $backend.out
+        SDB_BACKEND=$backend ../sdbsc -b finds.txt >> $backend.out || echo "status $?" >> $backend.out
+        SDB_BACKEND=$backend ../sdbsc -i scattered.csv >> $backend.out
+        ../sdbsc -p >> $backend.out
+    done
+
+    grep -q "3 was not found" rw.out
+    grep -q "^ *38 *new *student *2.50" rw.out
+    cmp rw.out uring.out
+
+    cd ..
+    rm -rf uring
+}
+
+@test "GPA reports from the column store match the record scans" {
+    mkdir -p columns
+    cd columns
+    rm -f student.db*
+
+    for i in $(seq 1 3 6000); do echo "$i,first$i,last$((i % 40)),$((i * 37 % 501))"; done > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+    [ ! -e student.db.col ]
+
+    # the first gpa report creates the columns, changes keep them current
+    ../sdbsc -s > /dev/null
+    [ -s student.db.col ]
+    for i in $(seq 4 9 6000); do echo "-d $i"; done > deletes.txt
+    ../sdbsc -b deletes.txt > /dev/null || true
+
+    # a change made without the columns leaves them behind until next open
+    SDB_COLUMNS=off ../sdbsc -a 2 late student 405 > /dev/null
+
+    for query in "-s" "-g 100 250" "-g 405 405" "-g 0 500"; do
+        ../sdbsc $query > columns.out || echo "status $?" >> columns.out
+        SDB_COLUMNS=off ../sdbsc $query > records.out || echo "status $?" >> records.out
+        cmp columns.out records.out
+    done
+    run ../sdbsc -g 405 405
+    [ "$status" -eq 0 ]
+    [[ "$output" == *"late"* ]]
+
+    cd ..
+    rm -rf columns
+}
+
+@test "A log left by a crashed process is replayed, torn and stale records are not" {
+    mkdir -p wal
+    cd wal
+    rm -f student.db*
+
+    # little endian bytes of $1, $2 bytes wide
+    le() { for ((b = 0; b < $2; b++)); do printf '\\x%02x' $(( ($1 >> (8 * b)) & 255 )); done; }
+    # log record: seq op id first last gpa, then the checksum, wrong if $7 is set
+    wal_rec() {
+        printf "WAL1$(le $2 4)$(le $1 8)$(le $3 4)$4$(le 0 $((24 - ${#4})))$5$(le 0 $((32 - ${#5})))$(le $6 4)" > rec
+        local h=2166136261
+        for byte in $(od -An -v -tu1 rec); do
+            h=$(( ((h ^ byte) * 16777619) & 0xffffffff ))
+        done
+        printf "$(le $((h ^ ${7:-0})) 4)$(le 0 4)" >> rec
+        cat rec
+    }
+
+    {
+        printf "SDBWAL1$(le 0 1)$(le 0 8)$(le 0 72)"
+        wal_rec 0 1 77 sam lee 300
+        wal_rec 1 1 78 bad sum 300 1
+        wal_rec 2 1 79 pat kim 310
+        wal_rec 3 1 80 torn rec 320 | head -c 40
+    } > student.db.wal
+    rm -f rec
+
+    run env -u SDB_WAL ../sdbsc -f 77
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "77     sam                      lee                              3.00" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ../sdbsc -f 79
+    [ "$status" -eq 0 ]
+    run ../sdbsc -f 78
+    [ "$status" -eq 1 ]
+    run ../sdbsc -f 80
+    [ "$status" -eq 1 ]
+    [ "$(stat --format=%s student.db.wal)" -eq 88 ]
+
+    # a record the server logged and applied, then a delete made without the
+    # log: the server dying must not bring the student back
+    SDB_WAL=1 ../sdbsc -S > /dev/null &
+    server=$!
+    for i in $(seq 1 50); do
+        [ -S student.db.sock ] && break
+        sleep 0.1
+    done
+    ../sdbsc -C a 90 ann lee 300 > /dev/null
+    env -u SDB_WAL ../sdbsc -d 90 > /dev/null
+    kill -9 $server
+    wait $server || true
+    rm -f student.db.sock
+
+    run ../sdbsc -f 90
+    [ "$status" -eq 1 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # a group commit applies every change and the last process out empties the log
+    for i in $(seq 100 199); do echo "-a $i first$i last$i 300"; done > adds.txt
+    SDB_WAL=64,1000 ../sdbsc -b adds.txt > /dev/null
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 102 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(stat --format=%s student.db.wal)" -eq 88 ]
+
+    cd ..
+    rm -rf wal
+}
+
+@test "An mmap process is not cut off when the database is emptied" {
+    mkdir -p mmap
+    cd mmap
+    rm -f student.db*
+
+    ../sdbsc -a 3 jane doe 390 > /dev/null
+    ../sdbsc -a 7000 jim doe 250 > /dev/null
+    SDB_BACKEND=mmap ../sdbsc -S > /dev/null &
+    for i in $(seq 1 50); do
+        [ -S student.db.sock ] && break
+        sleep 0.1
+    done
+    run ../sdbsc -C -f 7000
+    [ "$status" -eq 0 ]
+
+    # sdbsc does not empty a file another process has open
+    run ../sdbsc -z
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Database is open in another process, cant rewrite it!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ../sdbsc -C -f 7000
+    [ "$status" -eq 0 ]
+
+    # and the server copes with something else shortening it
+    truncate -s 128 student.db
+    run ../sdbsc -C -f 7000
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 7000 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ../sdbsc -C -a 5000 new student 300
+    [ "$status" -eq 0 ]
+    run ../sdbsc -C -f 5000
+    [ "$status" -eq 0 ]
+
+    ../sdbsc -C stop-server > /dev/null
+    wait
+    run ../sdbsc -z
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "All database records removed!" ]
+
+    cd ..
+    rm -rf mmap
+}
+
+@test "A client that stops reading does not stall the server" {
+    mkdir -p stall
+    cd stall
+    rm -f student.db*
+
+    seq 1 30000 | awk '{ print $1 ",first" $1 ",last" $1 ",300" }' > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+    ../sdbsc -S > /dev/null &
+    for i in $(seq 1 50); do
+        [ -S student.db.sock ] && break
+        sleep 0.1
+    done
+    [ "$(stat --format=%a student.db.sock)" = "660" ]
+
+    # the report is far bigger than the socket buffers and nobody reads it
+    ../sdbsc -C -p | sleep 30 &
+    stalled=$!
+    sleep 0.5
+
+    run timeout 5 ../sdbsc -C -f 3
+    [ "$status" -eq 0 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    kill $stalled
+    ../sdbsc -C stop-server > /dev/null
+    wait
+    cd ..
+    rm -rf stall
+}
+
+@test "The mmap backend stores and prints the same as the read/write backend" {
+    mkdir -p backends
+    cd backends
+    rm -f student.db* rw.out mmap.out
+
+    # ids on both sides of page and file size boundaries, added out of order
+    printf -- "-a %s first%s last%s 3%s\n" 99999 a a 10 64 b b 20 63 c c 30 1 d d 40 \
+        4096 e e 50 4095 f f 60 65536 g g 70 > ops.txt
+    printf -- "-d 64\n-f 63\n-f 64\n-a 64 h h 380\n-d 99999\n-f 65536\n-c\n" >> ops.txt
+
+    for backend in rw mmap; do
+        rm -f student.db*
+        SDB_BACKEND=$backend ../sdbsc -b ops.txt > $backend.out || echo "status $?" >> $backend.out
+        SDB_BACKEND=$backend ../sdbsc -p >> $backend.out
+        cp student.db $backend.db
+    done
+
+    grep -q "Database contains 6 student record(s)." rw.out
+    cmp rw.out mmap.out
+    cmp rw.db mmap.db
+
+    # each backend reads what the other one wrote
+    SDB_BACKEND=mmap ../sdbsc -a 2 mmap wrote 300 > /dev/null
+    run env SDB_BACKEND=rw ../sdbsc -f 2
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "2      mmap                     wrote                            3.00" ]
+    SDB_BACKEND=rw ../sdbsc -d 4096 > /dev/null
+    run env SDB_BACKEND=mmap ../sdbsc -f 4096
+    [ "$status" -eq 1 ]
+    run env SDB_BACKEND=mmap ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 6 student record(s)." ]
+
+    cd ..
+    rm -rf backends
+}
+
+@test "The record count and occupancy bitmap follow adds and deletes" {
+    unset SDB_LAYOUT
+    mkdir -p bitmap
+    cd bitmap
+    rm -f student.db*
+
+    for i in 1 2 63 64 65 4000 99999; do ../sdbsc -a $i first$i last$i 300 > /dev/null; done
+    ../sdbsc -d 64 > /dev/null
+    ../sdbsc -d 99999 > /dev/null
+
+    # the header lives in slot 0, which student id 0 never uses
+    [ "$(head -c 7 student.db)" = "SDBHDR1" ]
+    [ "$(head -c 7 student.db.bmp)" = "SDBBMP1" ]
+
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 5 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(../sdbsc -p | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "1 2 63 65 4000 " ]
+
+    # a bitmap from an older generation is rebuilt instead of trusted
+    cp student.db.bmp old.bmp
+    ../sdbsc -a 5000 new student 390 > /dev/null
+    ../sdbsc -d 2 > /dev/null
+    cp old.bmp student.db.bmp
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 5 student record(s)." ]
+    [ "$(../sdbsc -p | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "1 63 65 4000 5000 " ]
+
+    # and so is a missing one
+    rm student.db.bmp
+    run ../sdbsc -f 5000
+    [ "$status" -eq 0 ]
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 5 student record(s)." ]
+
+    ../sdbsc -z > /dev/null
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains no student records." ]
+    [ "$(../sdbsc -p)" = "Database contains no student records." ]
+
+    cd ..
+    rm -rf bitmap
+}
+
+@test "Scans of a sparse database only see the data extents" {
+    unset SDB_LAYOUT
+    mkdir -p sparse
+    cd sparse
+    rm -f student.db*
+
+    # first and last slots of 4k pages, far apart, so the file is mostly holes
+    for i in 99999 1 63 64 4095 4096 32768 65535; do ../sdbsc -a $i first$i last$i 250 > /dev/null; done
+    [ "$(stat --format="%s" student.db)" = "6400000" ]
+    [ "$(stat --format="%b" student.db)" -lt 1024 ] || {
+        echo "Allocated blocks:  $(stat --format="%b" student.db)"
+        return 1
+    }
+
+    expected="1 63 64 4095 4096 32768 65535 99999 "
+    [ "$(SDB_THREADS=1 ../sdbsc -p | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "$expected" ]
+    [ "$(SDB_THREADS=1 ../sdbsc -g 250 250 | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "$expected" ]
+
+    # compress punches the emptied pages into new holes the scan must skip
+    ../sdbsc -d 4095 > /dev/null
+    ../sdbsc -d 4096 > /dev/null
+    ../sdbsc -d 99999 > /dev/null
+    run ../sdbsc -x
+    [ "${lines[0]}" = "Database successfully compressed!" ]
+    [ "$(SDB_THREADS=1 ../sdbsc -p | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "1 63 64 32768 65535 " ]
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 5 student record(s)." ]
+
+    cd ..
+    rm -rf sparse
+}
+
+@test "Last name lookups follow deletes and re-adds" {
+    mkdir -p lname
+    cd lname
+    rm -f student.db*
+
+    printf "%s\n" "1,zoe,park,300" "2,amy,park,310" "3,bob,parker,320" "4,cat,par,330" \
+        "5,dan,park,340" "6,eve,lee,350" > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+
+    run ../sdbsc -l park
+    [ "$status" -eq 0 ]
+    [ "$(echo "$output" | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "2 5 1 " ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    ../sdbsc -d 5 > /dev/null
+    ../sdbsc -d 1 > /dev/null
+    run ../sdbsc -l park
+    [ "$(echo "$output" | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "2 " ]
+
+    # a prefix of the name must not match
+    ../sdbsc -d 2 > /dev/null
+    run ../sdbsc -l park
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No students with last name park were found in database." ]
+
+    ../sdbsc -a 7 ann park 360 > /dev/null
+    run ../sdbsc -l park
+    [ "$status" -eq 0 ]
+    [ "$(echo "$output" | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "7 " ]
+
+    # a missing index is rebuilt from the records
+    rm -f student.db.idx
+    run ../sdbsc -l parker
+    [ "$status" -eq 0 ]
+    [ "$(echo "$output" | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = "3 " ]
+
+    cd ..
+    rm -rf lname
+}
+
+@test "Writers of different records run side by side without losing updates" {
+    mkdir -p locks
+    cd locks
+    rm -f student.db* deleted.*
+
+    seq 1 400 | awk '{ print $1 ",first" $1 ",last" $1 ",300" }' > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+    ../sdbsc -a 500 only once 300 > /dev/null
+
+    # each writer deletes its own 50 students and adds 50 interleaved with
+    # the other writers' adds, while all of them race to delete student 500
+    for k in $(seq 0 7); do
+        for j in $(seq 1 50); do
+            echo "-d $((k * 50 + j))"
+            echo "-a $((1000 + j * 8 + k)) new$k student 310"
+        done > writer.$k
+        ../sdbsc -b writer.$k > /dev/null &
+        ../sdbsc -d 500 > deleted.$k &
+    done
+    wait
+
+    deleted=$(cat deleted.* | grep -c "was deleted from database")
+    [ "$deleted" -eq 1 ] || {
+        echo "Student 500 deleted $deleted times"
+        return 1
+    }
+
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 400 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(SDB_THREADS=1 ../sdbsc -p | tail -n +2 | awk '{ print $1 }' | tr '\n' ' ')" = \
+      "$(seq 1008 1 1407 | tr '\n' ' ')" ]
+
+    cd ..
+    rm -rf locks
+}
+
+@test "The benchmark runs every workload and cleans up after it" {
+    make -s -f makefile.txt bench/sdbbench
+
+    run ./bench/sdbbench -n 300 -r 5
+    [ "$status" -eq 0 ]
+    [[ "${lines[0]}" == "records=300 "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    for workload in dense sparse churn; do
+        for phase in insert lookup delete print compress; do
+            echo "$output" | grep -q "^$workload *$phase *[0-9]" || {
+                echo "No $workload $phase phase in:  $output"
+                return 1
+            }
+        done
+    done
+    [ -z "$(ls -d /tmp/sdbbench.* 2> /dev/null)" ]
+
+    # the same seed generates the same roster, and sdbsc can load it
+    ./bench/sdbbench -n 200 -w churn -r 11 -g > bench.csv
+    [ "$(./bench/sdbbench -n 200 -w churn -r 11 -g)" = "$(cat bench.csv)" ]
+    [ "$(wc -l < bench.csv)" -eq 200 ]
+
+    mkdir -p benchdb
+    cd benchdb
+    rm -f student.db*
+    run ../sdbsc -i ../bench.csv
+    [ "${lines[0]}" = "Imported 200 student record(s) into database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    cd ..
+    rm -rf benchdb bench.csv
+}
+
+@test "Buffered rows print exactly what printf would" {
+    mkdir -p rows
+    cd rows
+    rm -f student.db*
+
+    # more rows than one output buffer holds, every gpa from 0.00 to 5.00
+    # and names at and past the width of their columns
+    seq 1 30000 | awk '{
+        f = "f" $1; for (j = 0; j < $1 % 30; j++) f = f "x"
+        l = "l" $1 * 7; for (j = 0; j < $1 % 40; j++) l = l "y"
+        print $1 "," f "," l "," $1 % 501 }' > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+
+    awk -F, 'BEGIN { printf "%-6s %-24s %-32s %-3s\n", "ID", "FIRST_NAME", "LAST_NAME", "GPA" }
+        { printf "%-6d %-24.24s %-32.32s %-3.2f\n", $1, substr($2, 1, 23), substr($3, 1, 31), $4 / 100.0 }' \
+        roster.csv > expected.out
+
+    ../sdbsc -p > file.out
+    cmp expected.out file.out
+    ../sdbsc -p | cat > pipe.out
+    cmp expected.out pipe.out
+
+    # the other reports share the row formatter
+    ../sdbsc -g 0 500 | cmp expected.out -
+    ../sdbsc -f 29999 | cmp <(sed -n '1p;30000p' expected.out) -
+
+    cd ..
+    rm -rf rows
+}
+
+@test "Binary and csv exports survive an import round trip" {
+    mkdir -p export
+    cd export
+    rm -f student.db*
+
+    seq 1 7 70000 | awk '{ print $1 ",first" $1 ",last" $1 % 113 "," $1 % 501 }' > roster.csv
+    ../sdbsc -i roster.csv > /dev/null
+    ../sdbsc -d 8 > /dev/null
+
+    run ../sdbsc -e bin first.bin
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Exported 9999 student record(s) to first.bin." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    ../sdbsc -e csv > first.csv
+    ../sdbsc -p > first.out
+
+    ../sdbsc -z > /dev/null
+    run ../sdbsc -i first.bin
+    [ "${lines[0]}" = "Imported 9999 student record(s) into database." ]
+    ../sdbsc -e bin second.bin
+    cmp first.bin second.bin
+    ../sdbsc -p | cmp first.out -
+
+    # a binary stream on stdin, then the csv export back in
+    ../sdbsc -z > /dev/null
+    ../sdbsc -i < first.bin > /dev/null
+    ../sdbsc -e csv | cmp first.csv -
+    ../sdbsc -z > /dev/null
+    ../sdbsc -i first.csv > /dev/null
+    ../sdbsc -e bin | cmp first.bin -
+
+    cd ..
+    rm -rf export
+}
+
+@test "Reads of a new database create no side files" {
+    unset SDB_LAYOUT
+    mkdir -p side
+    cd side
+    rm -f student.db*
+
+    ../sdbsc -c > /dev/null
+    ../sdbsc -p > /dev/null
+    run ../sdbsc -f 1
+    [ "$status" -eq 1 ]
+    [ "$(ls | tr '\n' ' ')" = "student.db " ] || {
+        echo "Failed Output:  $(ls)"
+        return 1
+    }
+
+    # the first change creates what every change keeps current, and the
+    # log if one is wanted
+    ../sdbsc -a 1 first1 last1 300 > /dev/null
+    expected="student.db student.db.bmp student.db.crc student.db.snap "
+    if [ -n "$SDB_WAL" ]; then
+        expected="${expected}student.db.wal "
+    fi
+    [ "$(ls | tr '\n' ' ')" = "$expected" ] || {
+        echo "Failed Output:  $(ls)"
+        return 1
+    }
+
+    cd ..
+    rm -rf side
+}
+
+@test "Names that would not survive a csv export are refused" {
+    unset SDB_LAYOUT
+    mkdir -p names
+    cd names
+    rm -f student.db*
+
+    run ../sdbsc -a 5 ann,marie smith 300
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Cant add student, names cant hold a comma, tab or line break!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ../sdbsc -a 6 bob "$(printf 'o\tneil')" 310
+    [ "$status" -eq 2 ]
+    run bash -c 'printf -- "-a 7 amy lee,jo 320\n-a 8 amy lee 320\n" | ../sdbsc -b'
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Cant add student, names cant hold a comma, tab or line break!" ]
+    [ "${lines[1]}" = "Student 8 added to database." ]
+
+    # an import that skips invalid rows says so in its exit code
+    run bash -c 'printf "9,bob,ray,310\n10,sam,lee\n" | ../sdbsc -i'
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Skipping invalid import record on line 2." ]
+    [ "${lines[1]}" = "Imported 1 student record(s) into database." ]
+
+    ../sdbsc -e csv backup.csv > /dev/null
+    ../sdbsc -z > /dev/null
+    run ../sdbsc -i backup.csv
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Imported 2 student record(s) into database." ]
+
+    cd ..
+    rm -rf names
+}
+
+@test "Import refuses out of range numbers and extra fields" {
+    unset SDB_LAYOUT
+    mkdir -p badrows
+    cd badrows
+    rm -f student.db*
+
+    run bash -c 'printf "1,a,b,300,junk,more\n-5,a,b,300\n99999999999999999999,a,b,300\n2,a,b,nan\n3,a,b,1e300\n4,a,b,5.01\n5,a,b,5.00\n" | ../sdbsc -i'
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Skipping invalid import record on line 1." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[5]}" = "Skipping invalid import record on line 6." ]
+    [ "${lines[6]}" = "Imported 1 student record(s) into database." ]
+
+    run ../sdbsc -f 1
+    [ "$status" -eq 1 ]
+    run ../sdbsc -f 5
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "5 a b 5.00" ]
+
+    cd ..
+    rm -rf badrows
+}